@@ -224,6 +224,7 @@ HEADERS += src/qt/bitcreditgui.h \
   src/eccryptoverify.h \
   src/ecwrapper.h \
   src/hash.h \
+  src/iblt.h \
   src/init.h \
   src/instantx.h \
   src/key.h \
@@ -234,10 +235,14 @@ HEADERS += src/qt/bitcreditgui.h \
   src/lz4/lz4.h \
   src/main.h \
   src/banknode.h \
+  src/banknode-collateral.h \
+  src/banknode-sigqueue.h \
   src/banknodeconfig.h \
   src/merkleblock.h \
   src/miner.h \
+  src/bidtracker.h \
   src/momentum.h \
+  src/birthdaytable.h \
   src/mruset.h \
   src/netbase.h \
   src/net.h \
@@ -256,11 +261,11 @@ HEADERS += src/qt/bitcreditgui.h \
   src/script/sign.h \
   src/script/standard.h \
   src/script/script_error.h \
-  src/semiOrderedMap.h \
   src/serialize.h \
   src/smessage.h \
   src/streams.h \
   src/spork.h \
+  src/stratum.h \
   src/sync.h \
   src/threadsafety.h \
   src/timedata.h \
@@ -294,6 +299,8 @@ HEADERS += src/qt/bitcreditgui.h \
   src/crypto/common.h \
   src/crypto/sha256.h \
   src/crypto/sha512.h \
+  src/crypto/sha512_batch.h \
+  src/crypto/sha512_batch_lanes.h \
   src/crypto/hmac_sha256.h \
   src/crypto/rfc6979_hmac_sha256.h \
   src/crypto/hmac_sha512.h \ 
@@ -443,12 +450,14 @@ SOURCES += src/qt/bitcredit.cpp src/qt/bitcreditgui.cpp \
   src/bloom.cpp \
   src/chain.cpp \
   src/checkpoints.cpp \
+  src/iblt.cpp \
   src/init.cpp \
   src/leveldbwrapper.cpp \
   src/lz4/lz4.c \
   src/main.cpp \
   src/merkleblock.cpp \
   src/miner.cpp \
+  src/bidtracker.cpp \
   src/net.cpp \
   src/noui.cpp \
   src/pow.cpp \
@@ -475,6 +484,7 @@ SOURCES += src/qt/bitcredit.cpp src/qt/bitcreditgui.cpp \
   src/crypter.cpp \
   src/rpcdump.cpp \
   src/rpcwallet.cpp \
+  src/stratum.cpp \
   src/wallet.cpp \
   src/wallet_ismine.cpp \
   src/walletdb.cpp \
@@ -482,6 +492,7 @@ SOURCES += src/qt/bitcredit.cpp src/qt/bitcreditgui.cpp \
   src/crypto/sha1.cpp \
   src/crypto/sha256.cpp \
   src/crypto/sha512.cpp \
+  src/crypto/sha512_batch.cpp \
   src/crypto/hmac_sha256.cpp \
   src/crypto/rfc6979_hmac_sha256.cpp \
   src/crypto/hmac_sha512.cpp \
@@ -497,9 +508,12 @@ SOURCES += src/qt/bitcredit.cpp src/qt/bitcreditgui.cpp \
   src/compressor.cpp \
   src/darksend.cpp \
   src/banknode.cpp \
+  src/banknode-collateral.cpp \
+  src/banknode-sigqueue.cpp \
   src/banknodeconfig.cpp \
   src/instantx.cpp \
   src/momentum.cpp \
+  src/birthdaytable.cpp \
   src/primitives/block.cpp \
   src/primitives/transaction.cpp \
   src/core_read.cpp \
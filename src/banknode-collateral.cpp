@@ -0,0 +1,150 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "banknode-collateral.h"
+
+#include "coins.h"
+#include "txmempool.h"
+#include "util.h"
+
+CBanknodeCollateralWatcher mncollateral;
+
+unsigned int CBanknodeCollateralWatcher::Watch(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    CCollateral collateral;
+    collateral.nValue = 0;
+    collateral.nHeight = 0;
+    collateral.fCoinBase = false;
+    bool fSpent = true;
+
+    const CCoins* coins = pcoinsTip->AccessCoins(outpoint.hash);
+    if (coins && coins->IsAvailable(outpoint.n)) {
+        collateral.nValue = coins->vout[outpoint.n].nValue;
+        collateral.nHeight = coins->nHeight;
+        collateral.fCoinBase = coins->IsCoinBase();
+        fSpent = false;
+    }
+
+    unsigned int nSlot;
+    if (vFreeSlots.empty()) {
+        nSlot = vCollateral.size();
+        vCollateral.push_back(collateral);
+        vSpent.push_back(fSpent);
+    } else {
+        nSlot = vFreeSlots.back();
+        vFreeSlots.pop_back();
+        vCollateral[nSlot] = collateral;
+        vSpent[nSlot] = fSpent;
+    }
+
+    {
+        LOCK(mempool.cs);
+        std::map<COutPoint, CInPoint>::const_iterator it = mempool.mapNextTx.find(outpoint);
+        if (it != mempool.mapNextTx.end())
+            mapSpenders[nSlot] = it->second.ptx->GetHash();
+    }
+
+    mapSlots[outpoint] = nSlot;
+    return nSlot;
+}
+
+void CBanknodeCollateralWatcher::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    /*
+        Called for transactions entering the mempool or conflicting with a block
+        (pblock NULL), for those of connected blocks and again, with pblock NULL,
+        for those of disconnected blocks.
+    */
+
+    LOCK(cs);
+    if (mapSlots.empty())
+        return;
+
+    uint256 hash = tx.GetHash();
+    boost::unordered_map<COutPoint, unsigned int, COutPointHasher>::iterator it;
+
+    // -- outputs, a watched outpoint that was missing got (re)confirmed, or
+    //    is missing from the UTXO set again when its block was disconnected
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        it = mapSlots.find(COutPoint(hash, i));
+        if (it == mapSlots.end())
+            continue;
+        if (!pblock) {
+            vSpent[it->second] = true;
+            continue;
+        }
+        CCollateral& collateral = vCollateral[it->second];
+        collateral.nValue = tx.vout[i].nValue;
+        collateral.nHeight = chainActive.Height();
+        collateral.fCoinBase = tx.IsCoinBase();
+        vSpent[it->second] = false;
+    }
+
+    if (tx.IsCoinBase())
+        return;
+
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        it = mapSlots.find(txin.prevout);
+        if (it == mapSlots.end())
+            continue;
+
+        unsigned int nSlot = it->second;
+        if (pblock) {
+            vSpent[nSlot] = true;
+            mapSpenders[nSlot] = hash;
+            continue;
+        }
+
+        // -- a transaction conflicting with the confirmed spend does not unspend it
+        std::map<unsigned int, uint256>::iterator itSpender = mapSpenders.find(nSlot);
+        if (vSpent[nSlot] && itSpender != mapSpenders.end() && itSpender->second != hash)
+            continue;
+
+        vSpent[nSlot] = false;
+        mapSpenders[nSlot] = hash;
+    }
+}
+
+bool CBanknodeCollateralWatcher::IsValidCollateral(const COutPoint& outpoint)
+{
+    LOCK(cs);
+
+    boost::unordered_map<COutPoint, unsigned int, COutPointHasher>::iterator it = mapSlots.find(outpoint);
+    unsigned int nSlot = it == mapSlots.end() ? Watch(outpoint) : it->second;
+
+    if (vSpent[nSlot])
+        return false;
+
+    std::map<unsigned int, uint256>::iterator itSpender = mapSpenders.find(nSlot);
+    if (itSpender != mapSpenders.end()) {
+        if (mempool.exists(itSpender->second))
+            return false;
+        // -- the spend left the mempool without being mined
+        mapSpenders.erase(itSpender);
+    }
+
+    const CCollateral& collateral = vCollateral[nSlot];
+    int nHeight = chainActive.Height();
+    if (collateral.fCoinBase && nHeight - collateral.nHeight < COINBASE_MATURITY)
+        return false;
+
+    CAmount nRequired = (nHeight < BANKNODE_COLLATERAL_SWITCH_HEIGHT ? 250000 : 50000) * COIN;
+    return collateral.nValue >= nRequired;
+}
+
+void CBanknodeCollateralWatcher::Forget(const COutPoint& outpoint)
+{
+    LOCK(cs);
+
+    boost::unordered_map<COutPoint, unsigned int, COutPointHasher>::iterator it = mapSlots.find(outpoint);
+    if (it == mapSlots.end())
+        return;
+
+    mapSpenders.erase(it->second);
+    vFreeSlots.push_back(it->second);
+    mapSlots.erase(it);
+}
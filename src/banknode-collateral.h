@@ -0,0 +1,69 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BANKNODE_COLLATERAL_H
+#define BANKNODE_COLLATERAL_H
+
+#include "amount.h"
+#include "main.h"
+#include "sync.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+class CBanknodeCollateralWatcher;
+
+extern CBanknodeCollateralWatcher mncollateral;
+
+/** Height from which a Banknode needs 50K instead of 250K BCR of collateral */
+static const int BANKNODE_COLLATERAL_SWITCH_HEIGHT = 145000;
+
+/**
+ * Keeps track of whether the collateral outpoints of Banknodes are spent.
+ *
+ * An outpoint is looked up in the UTXO set and the mempool once, when it is
+ * first asked about. From then on the transactions of connected and
+ * disconnected blocks and of the mempool keep its state current, so
+ * CBanknode::Check no longer has to validate a transaction spending it.
+ * CBanknodeMan forgets the outpoint once its Banknode has left the list.
+ */
+class CBanknodeCollateralWatcher : public CValidationInterface
+{
+private:
+    struct CCollateral
+    {
+        CAmount nValue;
+        int nHeight;
+        bool fCoinBase;
+    };
+
+    mutable CCriticalSection cs;
+
+    // slot of each watched outpoint
+    boost::unordered_map<COutPoint, unsigned int, COutPointHasher> mapSlots;
+    // value and origin of the output in each slot
+    std::vector<CCollateral> vCollateral;
+    // spent in the active chain (or missing from the UTXO set), by slot
+    std::vector<bool> vSpent;
+    // last transaction seen spending a slot; unless vSpent is set it is
+    // only a spend while it is in the mempool
+    std::map<unsigned int, uint256> mapSpenders;
+    // slots of forgotten outpoints, reused by Watch
+    std::vector<unsigned int> vFreeSlots;
+
+    unsigned int Watch(const COutPoint& outpoint);
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+public:
+    /** Whether outpoint is unspent, mature and holds enough coins to back a Banknode; must hold cs_main */
+    bool IsValidCollateral(const COutPoint& outpoint);
+    /** Stop watching outpoint */
+    void Forget(const COutPoint& outpoint);
+};
+
+#endif
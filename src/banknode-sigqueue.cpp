@@ -0,0 +1,250 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "banknode-sigqueue.h"
+
+#include "banknode.h"
+#include "banknodeman.h"
+#include "darksend.h"
+#include "hash.h"
+#include "instantx.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
+
+using namespace std;
+
+CBanknodeSigQueue mnsigqueue;
+
+bool CBanknodeSigCheck::operator()()
+{
+    std::string strError;
+    *pfValid = darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, strError);
+    // a bad signature only concerns its own message, the batch goes on
+    return true;
+}
+
+CBanknodeSigQueue::CBanknodeSigQueue() : nPendingJobs(0), nVerified(0), pcheckqueue(NULL), fStarted(false)
+{
+}
+
+CBanknodeSigQueue::~CBanknodeSigQueue()
+{
+    delete pcheckqueue;
+}
+
+uint256 CBanknodeSigQueue::GetSigHash(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << pubkey << vchSig << strMessage;
+    return ss.GetHash();
+}
+
+void CBanknodeSigQueue::Remember(const uint256& hash, bool fValid)
+{
+    if (!mapCache.insert(make_pair(hash, fValid)).second)
+        return;
+    dequeCache.push_back(hash);
+    while (dequeCache.size() > BANKNODE_SIGCACHE_SIZE) {
+        mapCache.erase(dequeCache.front());
+        dequeCache.pop_front();
+    }
+}
+
+void CBanknodeSigQueue::Start(boost::thread_group& threadGroup, int nThreads)
+{
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    if (nThreads <= 0)
+        nThreads = 1;
+    if (nThreads > BANKNODE_SIGQUEUE_MAX_THREADS)
+        nThreads = BANKNODE_SIGQUEUE_MAX_THREADS;
+
+    // the thread driving a batch is the last verifier
+    if (nThreads > 1) {
+        pcheckqueue = new CCheckQueue<CBanknodeSigCheck>(16);
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(boost::bind(&CBanknodeSigQueue::ThreadCheck, pcheckqueue));
+    }
+    threadGroup.create_thread(boost::bind(&CBanknodeSigQueue::ThreadVerify, this));
+
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        fStarted = true;
+    }
+    LogPrintf("Using %d threads for banknode signature verification\n", nThreads);
+}
+
+void CBanknodeSigQueue::ThreadCheck(CCheckQueue<CBanknodeSigCheck>* pqueue)
+{
+    RenameThread("bitcredit-mnsigcheck");
+    pqueue->Thread();
+}
+
+void CBanknodeSigQueue::ThreadVerify()
+{
+    RenameThread("bitcredit-mnsig");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (dequePending.empty())
+                condPending.wait(lock);
+        }
+        ProcessBatch();
+    }
+}
+
+void CBanknodeSigQueue::ProcessBatch()
+{
+    // peers still connected, their messages are kept however long they wait
+    std::set<NodeId> setConnected;
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            setConnected.insert(pnode->id);
+    }
+
+    std::vector<uint256> vHashes;
+    std::vector<CBanknodeSigCheck> vChecks;
+    boost::scoped_array<bool> pfValid(new bool[BANKNODE_SIGQUEUE_BATCH]);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        while (!dequePending.empty() && vHashes.size() < BANKNODE_SIGQUEUE_BATCH) {
+            const CSigPending& pending = mapPending[dequePending.front()];
+            vChecks.push_back(CBanknodeSigCheck(pending.pubkey, pending.vchSig, pending.strMessage, &pfValid[vHashes.size()]));
+            vHashes.push_back(dequePending.front());
+            dequePending.pop_front();
+        }
+    }
+
+    int64_t nStart = GetTimeMicros();
+    if (pcheckqueue) {
+        CCheckQueueControl<CBanknodeSigCheck> control(pcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        BOOST_FOREACH(CBanknodeSigCheck& check, vChecks)
+            check();
+    }
+    int64_t nMicros = GetTimeMicros() - nStart;
+
+    int64_t nNow = GetTime();
+    unsigned int nJobs = 0;
+    boost::lock_guard<boost::mutex> lock(mutex);
+    for (unsigned int i = 0; i < vHashes.size(); i++) {
+        std::map<uint256, CSigPending>::iterator it = mapPending.find(vHashes[i]);
+        Remember(vHashes[i], pfValid[i]);
+        BOOST_FOREACH(CSigJob& job, it->second.vJobs) {
+            job.nTime = nNow;
+            mapReady[job.nodeid].push_back(job);
+        }
+        nJobs += it->second.vJobs.size();
+        nPendingJobs -= it->second.vJobs.size();
+        mapPending.erase(it);
+    }
+    nVerified += vHashes.size();
+
+    // messages of peers that went away are never picked up
+    std::map<NodeId, std::vector<CSigJob> >::iterator it = mapReady.begin();
+    while (it != mapReady.end()) {
+        if (!setConnected.count(it->first) && it->second.back().nTime < nNow - BANKNODE_SIGQUEUE_EXPIRE)
+            mapReady.erase(it++);
+        else
+            ++it;
+    }
+
+    if(fDebug) LogPrintf("CBanknodeSigQueue::ProcessBatch - verified %u signatures for %u messages in %.2fms\n", vHashes.size(), nJobs, nMicros * 0.001);
+}
+
+bool CBanknodeSigQueue::Defer(CNode* pfrom, const std::string& strCommand, const CDataStream& vMsg, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    uint256 hash = GetSigHash(pubkey, vchSig, strMessage);
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if (!fStarted || mapCache.count(hash) || nPendingJobs >= BANKNODE_SIGQUEUE_MAX_PENDING)
+        return false;
+
+    std::map<uint256, CSigPending>::iterator it = mapPending.find(hash);
+    if (it == mapPending.end()) {
+        it = mapPending.insert(make_pair(hash, CSigPending())).first;
+        it->second.pubkey = pubkey;
+        it->second.vchSig = vchSig;
+        it->second.strMessage = strMessage;
+        dequePending.push_back(hash);
+        condPending.notify_one();
+    }
+
+    // the same message relayed twice by a peer is handled once
+    BOOST_FOREACH(const CSigJob& job, it->second.vJobs)
+        if (job.nodeid == pfrom->id && job.strCommand == strCommand)
+            return true;
+
+    it->second.vJobs.push_back(CSigJob(pfrom->id, strCommand, vMsg));
+    nPendingJobs++;
+    return true;
+}
+
+bool CBanknodeSigQueue::Verify(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    uint256 hash = GetSigHash(pubkey, vchSig, strMessage);
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::map<uint256, bool>::const_iterator it = mapCache.find(hash);
+        if (it != mapCache.end())
+            return it->second;
+    }
+
+    bool fValid;
+    CBanknodeSigCheck check(pubkey, vchSig, strMessage, &fValid);
+    check();
+
+    boost::lock_guard<boost::mutex> lock(mutex);
+    Remember(hash, fValid);
+    nVerified++;
+    return fValid;
+}
+
+bool CBanknodeSigQueue::TakeReady(NodeId nodeid, std::vector<CSigJob>& vJobs)
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    std::map<NodeId, std::vector<CSigJob> >::iterator it = mapReady.find(nodeid);
+    if (it == mapReady.end())
+        return false;
+    vJobs.swap(it->second);
+    mapReady.erase(it);
+    return true;
+}
+
+uint64_t CBanknodeSigQueue::GetVerifiedCount()
+{
+    boost::lock_guard<boost::mutex> lock(mutex);
+    return nVerified;
+}
+
+void CBanknodeSigQueue::ProcessReady(CNode* pfrom)
+{
+    std::vector<CSigJob> vJobs;
+    if (!TakeReady(pfrom->id, vJobs))
+        return;
+
+    BOOST_FOREACH(CSigJob& job, vJobs) {
+        if (pfrom->fDisconnect)
+            break;
+        try {
+            if (job.strCommand == "mnw")
+                ProcessMessageBanknodePayments(pfrom, job.strCommand, job.vMsg);
+            else if (job.strCommand == "txlvote")
+                ProcessMessageInstantX(pfrom, job.strCommand, job.vMsg);
+            else
+                mnodeman.ProcessMessage(pfrom, job.strCommand, job.vMsg);
+        } catch (const std::exception& e) {
+            LogPrintf("CBanknodeSigQueue::ProcessReady - %s from peer=%d: %s\n", job.strCommand, pfrom->id, e.what());
+        }
+    }
+}
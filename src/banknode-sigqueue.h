@@ -0,0 +1,146 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BANKNODE_SIGQUEUE_H
+#define BANKNODE_SIGQUEUE_H
+
+#include "checkqueue.h"
+#include "net.h"
+#include "pubkey.h"
+#include "streams.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+class CBanknodeSigQueue;
+
+extern CBanknodeSigQueue mnsigqueue;
+
+/** Maximum number of signature verification threads */
+static const int BANKNODE_SIGQUEUE_MAX_THREADS = 16;
+/** Signatures a worker pass verifies at most */
+static const unsigned int BANKNODE_SIGQUEUE_BATCH = 256;
+/** Messages waiting for a verification at most, further ones are verified on arrival */
+static const unsigned int BANKNODE_SIGQUEUE_MAX_PENDING = 20000;
+/** Verification results remembered */
+static const unsigned int BANKNODE_SIGCACHE_SIZE = 50000;
+/** Seconds the verified messages of a disconnected peer are kept */
+static const int BANKNODE_SIGQUEUE_EXPIRE = 5 * 60;
+
+/** One compact signature verification, the outcome goes to *pfValid */
+class CBanknodeSigCheck
+{
+private:
+    CPubKey pubkey;
+    std::vector<unsigned char> vchSig;
+    std::string strMessage;
+    bool* pfValid;
+
+public:
+    CBanknodeSigCheck() : pfValid(NULL) {}
+    CBanknodeSigCheck(const CPubKey& pubkeyIn, const std::vector<unsigned char>& vchSigIn, const std::string& strMessageIn, bool* pfValidIn) :
+        pubkey(pubkeyIn), vchSig(vchSigIn), strMessage(strMessageIn), pfValid(pfValidIn) {}
+
+    bool operator()();
+
+    void swap(CBanknodeSigCheck& check)
+    {
+        std::swap(pubkey, check.pubkey);
+        vchSig.swap(check.vchSig);
+        strMessage.swap(check.strMessage);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/**
+ * Verifies the signatures of dsee, dseep, mnw and txlvote messages off the
+ * message handler thread.
+ *
+ * A handler asks Defer() before checking a signature. If the outcome is not
+ * known yet the message is parked and the handler returns; a worker pool
+ * verifies the parked signatures in batches, each one once however many peers
+ * relayed it, and remembers the outcome. The parked messages are then handed
+ * to the handlers again by ProcessReady() when their peer is next processed,
+ * and this time Verify() answers from the cache.
+ */
+class CBanknodeSigQueue
+{
+public:
+    struct CSigJob
+    {
+        NodeId nodeid;
+        std::string strCommand;
+        CDataStream vMsg;
+        int64_t nTime;      // when the signature was verified
+
+        CSigJob(NodeId nodeidIn, const std::string& strCommandIn, const CDataStream& vMsgIn) :
+            nodeid(nodeidIn), strCommand(strCommandIn), vMsg(vMsgIn), nTime(0) {}
+    };
+
+private:
+    struct CSigPending
+    {
+        CPubKey pubkey;
+        std::vector<unsigned char> vchSig;
+        std::string strMessage;
+        std::vector<CSigJob> vJobs;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condPending;
+
+    // outcome by signature hash, oldest first in dequeCache
+    std::map<uint256, bool> mapCache;
+    std::deque<uint256> dequeCache;
+    // signatures to verify and the messages waiting for them, in arrival order
+    std::map<uint256, CSigPending> mapPending;
+    std::deque<uint256> dequePending;
+    unsigned int nPendingJobs;
+    // signatures actually checked, as opposed to answered from mapCache
+    uint64_t nVerified;
+    // verified messages by the peer they came from
+    std::map<NodeId, std::vector<CSigJob> > mapReady;
+
+    CCheckQueue<CBanknodeSigCheck>* pcheckqueue;
+    bool fStarted;
+
+    static uint256 GetSigHash(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage);
+    void Remember(const uint256& hash, bool fValid);
+    void ProcessBatch();
+    void ThreadVerify();
+    static void ThreadCheck(CCheckQueue<CBanknodeSigCheck>* pqueue);
+
+public:
+    CBanknodeSigQueue();
+    ~CBanknodeSigQueue();
+
+    /** Start the worker pool, nThreads verifying in parallel (0 = auto) */
+    void Start(boost::thread_group& threadGroup, int nThreads);
+
+    /**
+     * Park strCommand from pfrom (vMsg being its whole payload) while its
+     * signature is verified; returns false when the outcome is known already
+     * or the queue is full or not running, the caller then goes on and Verify()s.
+     */
+    bool Defer(CNode* pfrom, const std::string& strCommand, const CDataStream& vMsg, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage);
+
+    /** Verify a signature, from the cache if it was seen before */
+    bool Verify(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage);
+
+    /** Take the verified messages of a peer out of the queue; returns false if there are none */
+    bool TakeReady(NodeId nodeid, std::vector<CSigJob>& vJobs);
+
+    /** Hand the verified messages of pfrom to the handlers again; requires LOCK(pfrom->cs_vRecvMsg) */
+    void ProcessReady(CNode* pfrom);
+
+    /** Number of signatures verified so far */
+    uint64_t GetVerifiedCount();
+};
+
+#endif
@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "banknode.h"
+#include "banknode-collateral.h"
+#include "banknode-sigqueue.h"
 #include "banknodeman.h"
 #include "darksend.h"
 #include "primitives/transaction.h"
@@ -43,6 +45,7 @@ void ProcessMessageBanknodePayments(CNode* pfrom, std::string& strCommand, CData
         LOCK(cs_banknodepayments);
 
         //this is required in litemode
+        CDataStream vMsg(vRecv.begin(), vRecv.end(), vRecv.GetType(), vRecv.GetVersion());
         CBanknodePaymentWinner winner;
         vRecv >> winner;
 
@@ -71,6 +74,8 @@ void ProcessMessageBanknodePayments(CNode* pfrom, std::string& strCommand, CData
 
         LogPrintf("mnw - winning vote - Vin %s Addr %s Height %d bestHeight %d\n", winner.vin.ToString().c_str(), address2.ToString().c_str(), winner.nBlockHeight, chainActive.Tip()->nHeight);
 
+        if(banknodePayments.DeferSignatureCheck(pfrom, strCommand, vMsg, winner)) return;
+
         if(!banknodePayments.CheckSignature(winner)){
             LogPrintf("mnw - invalid signature\n");
             Misbehaving(pfrom->GetId(), 100);
@@ -252,44 +257,39 @@ void CBanknode::Check()
         return;
     }
 
-    if(!unitTest){
-        CValidationState state;
-        CMutableTransaction tx = CTransaction();
-        if (chainActive.Tip()->nHeight<145000) {
-        CTxOut vout = CTxOut(249999.99*COIN, darkSendPool.collateralPubKey);
-                tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-		}else {
-        CTxOut vout = CTxOut(49999.99*COIN, darkSendPool.collateralPubKey);
-                tx.vin.push_back(vin);
-        tx.vout.push_back(vout);
-		}
-
-
-        if(!AcceptableInputs(mempool, state, tx)){
-            activeState = BANKNODE_VIN_SPENT;
-            return;
-        }
+    if(!unitTest && !mncollateral.IsValidCollateral(vin.prevout)){
+        activeState = BANKNODE_VIN_SPENT;
+        return;
     }
 
     activeState = BANKNODE_ENABLED; // OK
 }
 
+static std::string GetWinnerSignatureMessage(const CBanknodePaymentWinner& winner)
+{
+    return winner.vin.ToString().c_str() + boost::lexical_cast<std::string>(winner.nBlockHeight) + winner.payee.ToString();
+}
+
 bool CBanknodePayments::CheckSignature(CBanknodePaymentWinner& winner)
 {
     //note: need to investigate why this is failing
-    std::string strMessage = winner.vin.ToString().c_str() + boost::lexical_cast<std::string>(winner.nBlockHeight) + winner.payee.ToString();
+    std::string strMessage = GetWinnerSignatureMessage(winner);
     std::string strPubKey = strMainPubKey ;
     CPubKey pubkey(ParseHex(strPubKey));
 
-    std::string errorMessage = "";
-    if(!darkSendSigner.VerifyMessage(pubkey, winner.vchSig, strMessage, errorMessage)){
+    if(!mnsigqueue.Verify(pubkey, winner.vchSig, strMessage)){
         return false;
     }
 
     return true;
 }
 
+bool CBanknodePayments::DeferSignatureCheck(CNode* pfrom, const std::string& strCommand, const CDataStream& vMsg, CBanknodePaymentWinner& winner)
+{
+    CPubKey pubkey(ParseHex(strMainPubKey));
+    return mnsigqueue.Defer(pfrom, strCommand, vMsg, pubkey, winner.vchSig, GetWinnerSignatureMessage(winner));
+}
+
 bool CBanknodePayments::Sign(CBanknodePaymentWinner& winner)
 {
     std::string strMessage = winner.vin.ToString().c_str() + boost::lexical_cast<std::string>(winner.nBlockHeight) + winner.payee.ToString();
@@ -461,7 +461,7 @@ bool CBanknodePayments::ProcessBlock(int nBlockHeight)
             CBanknode* pmn = mnodeman.Find(vinLP);
             if(pmn != NULL)
             {
-                pmn->Check();
+                mnodeman.Check(*pmn);
                 if(!pmn->IsEnabled()) continue;
 
                 newWinner.score = 0;
@@ -310,6 +310,8 @@ public:
 
     bool SetPrivKey(std::string strPrivKey);
     bool CheckSignature(CBanknodePaymentWinner& winner);
+    // queue the signature of a received winner for verification, true when the message was parked
+    bool DeferSignatureCheck(CNode* pfrom, const std::string& strCommand, const CDataStream& vMsg, CBanknodePaymentWinner& winner);
     bool Sign(CBanknodePaymentWinner& winner);
 
     // Deterministically calculate a given "score" for a banknode depending on how close it's hash is
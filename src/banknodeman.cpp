@@ -4,6 +4,8 @@
 
 #include "banknodeman.h"
 #include "banknode.h"
+#include "banknode-collateral.h"
+#include "banknode-sigqueue.h"
 #include "activebanknode.h"
 #include "darksend.h"
 #include "core.h"
@@ -17,18 +19,10 @@ CCriticalSection cs_process_message;
 /** Banknode manager */
 CBanknodeMan mnodeman;
 
-struct CompareValueOnly
+struct CompareValueOnlyIndex
 {
-    bool operator()(const pair<int64_t, CTxIn>& t1,
-                    const pair<int64_t, CTxIn>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-struct CompareValueOnlyMN
-{
-    bool operator()(const pair<int64_t, CBanknode>& t1,
-                    const pair<int64_t, CBanknode>& t2) const
+    bool operator()(const pair<unsigned int, int>& t1,
+                    const pair<unsigned int, int>& t2) const
     {
         return t1.first < t2.first;
     }
@@ -52,7 +46,8 @@ bool CBanknodeDB::Write(const CBanknodeMan& mnodemanToSave)
     CDataStream ssBanknodes(SER_DISK, CLIENT_VERSION);
     ssBanknodes << strMagicMessage; // banknode cache file specific magic message
     ssBanknodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssBanknodes << mnodemanToSave;
+    ssBanknodes << (uint32_t)BANKNODES_CACHE_VERSION;
+    mnodemanToSave.WriteCache(ssBanknodes);
     uint256 hash = Hash(ssBanknodes.begin(), ssBanknodes.end());
     ssBanknodes << hash;
 
@@ -78,9 +73,8 @@ bool CBanknodeDB::Write(const CBanknodeMan& mnodemanToSave)
     return true;
 }
 
-CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
+CBanknodeDB::ReadResult CBanknodeDB::ReadHeader(CDataStream& ssBanknodes)
 {
-    int64_t nStart = GetTimeMillis();
     // open input file, and associate with CAutoFile
     FILE *file = fopen(pathMN.string().c_str(), "rb");
     CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
@@ -96,13 +90,12 @@ CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
     // Don't try to resize to a negative number if file is small
     if (dataSize < 0)
         dataSize = 0;
-    vector<unsigned char> vchData;
-    vchData.resize(dataSize);
+    ssBanknodes.resize(dataSize);
     uint256 hashIn;
 
     // read data and checksum from file
     try {
-        filein.read((char *)&vchData[0], dataSize);
+        filein.read(&ssBanknodes[0], dataSize);
         filein >> hashIn;
     }
     catch (std::exception &e) {
@@ -111,8 +104,6 @@ CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
     }
     filein.fclose();
 
-    CDataStream ssBanknodes(vchData, SER_DISK, CLIENT_VERSION);
-
     // verify stored checksum matches input data
     uint256 hashTmp = Hash(ssBanknodes.begin(), ssBanknodes.end());
     if (hashIn != hashTmp)
@@ -123,6 +114,7 @@ CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
 
     unsigned char pchMsgTmp[4];
     std::string strMagicMessageTmp;
+    uint32_t nVersionTmp;
     try {
         // de-serialize file header (banknode cache file specific magic message) and ..
 
@@ -144,8 +136,35 @@ CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
             error("%s : Invalid network magic number", __func__);
             return IncorrectMagicNumber;
         }
+
+        // files of other versions, older ones had none, are rebuilt from the network
+        ssBanknodes >> nVersionTmp;
+        if (nVersionTmp != BANKNODES_CACHE_VERSION)
+        {
+            error("%s : Unknown banknode cache version %u", __func__, nVersionTmp);
+            return IncorrectFormat;
+        }
+    }
+    catch (std::exception &e) {
+        error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return IncorrectFormat;
+    }
+
+    return Ok;
+}
+
+CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
+{
+    int64_t nStart = GetTimeMillis();
+
+    CDataStream ssBanknodes(SER_DISK, CLIENT_VERSION);
+    ReadResult result = ReadHeader(ssBanknodes);
+    if (result != Ok)
+        return result;
+
+    try {
         // de-serialize data into CBanknodeMan object
-        ssBanknodes >> mnodemanToLoad;
+        mnodemanToLoad.ReadCache(ssBanknodes);
     }
     catch (std::exception &e) {
         mnodemanToLoad.Clear();
@@ -153,22 +172,27 @@ CBanknodeDB::ReadResult CBanknodeDB::Read(CBanknodeMan& mnodemanToLoad)
         return IncorrectFormat;
     }
 
-    mnodemanToLoad.CheckAndRemove(); // clean out expired
+    // expired entries are cleaned out by CheckLoaded in the background
     LogPrintf("Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToLoad.ToString());
 
     return Ok;
 }
 
+CBanknodeDB::ReadResult CBanknodeDB::Verify()
+{
+    CDataStream ssBanknodes(SER_DISK, CLIENT_VERSION);
+    return ReadHeader(ssBanknodes);
+}
+
 void DumpBanknodes()
 {
     int64_t nStart = GetTimeMillis();
 
     CBanknodeDB mndb;
-    CBanknodeMan tempMnodeman;
 
     LogPrintf("Verifying mncache.dat format...\n");
-    CBanknodeDB::ReadResult readResult = mndb.Read(tempMnodeman);
+    CBanknodeDB::ReadResult readResult = mndb.Verify();
     // there was an error and it was not an error on file openning => do not proceed
     if (readResult == CBanknodeDB::FileError)
         LogPrintf("Missing banknode cache file - mncache.dat, will try to recreate\n");
@@ -205,7 +229,10 @@ bool CBanknodeMan::Add(CBanknode &mn)
     if (pmn == NULL)
     {
         if(fDebug) LogPrintf("CBanknodeMan: Adding new Banknode %s - %i now\n", mn.addr.ToString().c_str(), size() + 1);
-        vBanknodes.push_back(mn);
+        CBanknodePtr pmnNew(new CBanknode(mn));
+        vBanknodes.push_back(pmnNew);
+        IndexBanknode(pmnNew);
+        mapRankCache.clear();
         return true;
     }
 
@@ -216,8 +243,50 @@ void CBanknodeMan::Check()
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CBanknode& mn, vBanknodes)
-        mn.Check();
+    // entries loaded from mncache.dat are left to CheckLoaded, which paces their first check
+    std::set<const CBanknode*> setUnchecked;
+    BOOST_FOREACH(const CBanknodePtr& pmn, dequeUnchecked)
+        setUnchecked.insert(pmn.get());
+
+    BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes)
+        if(!setUnchecked.count(pmn.get()))
+            CheckBanknode(*pmn);
+}
+
+void CBanknodeMan::Check(CBanknode& mn)
+{
+    LOCK(cs);
+    CheckBanknode(mn);
+}
+
+void CBanknodeMan::IndexBanknode(const CBanknodePtr& pmn)
+{
+    mapBanknodesByOutPoint[pmn->vin.prevout] = pmn;
+    // Find(pubkey) returns the first entry added with a key
+    mapBanknodesByPubKey.insert(make_pair(pmn->pubkey2, pmn));
+}
+
+void CBanknodeMan::UnindexBanknode(const CBanknode& mn)
+{
+    mapBanknodesByOutPoint.erase(mn.vin.prevout);
+
+    boost::unordered_map<CPubKey, CBanknodePtr, CBanknodePubKeyHasher>::iterator it = mapBanknodesByPubKey.find(mn.pubkey2);
+    if(it == mapBanknodesByPubKey.end() || it->second.get() != &mn) return;
+    mapBanknodesByPubKey.erase(it);
+
+    // hand the key to the next entry sharing it, if any
+    BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes)
+        if(pmn.get() != &mn && pmn->pubkey2 == mn.pubkey2) {
+            mapBanknodesByPubKey.insert(make_pair(pmn->pubkey2, pmn));
+            break;
+        }
+}
+
+void CBanknodeMan::CheckBanknode(CBanknode& mn)
+{
+    int prevState = mn.activeState;
+    mn.Check();
+    if(mn.activeState != prevState) mapRankCache.clear();
 }
 
 void CBanknodeMan::CheckAndRemove()
@@ -227,11 +296,15 @@ void CBanknodeMan::CheckAndRemove()
     Check();
 
     //remove inactive
-    vector<CBanknode>::iterator it = vBanknodes.begin();
+    vector<CBanknodePtr>::iterator it = vBanknodes.begin();
     while(it != vBanknodes.end()){
-        if((*it).activeState == CBanknode::BANKNODE_REMOVE || (*it).activeState == CBanknode::BANKNODE_VIN_SPENT){
-            if(fDebug) LogPrintf("CBanknodeMan: Removing inactive Banknode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
+        if((*it)->activeState == CBanknode::BANKNODE_REMOVE || (*it)->activeState == CBanknode::BANKNODE_VIN_SPENT){
+            if(fDebug) LogPrintf("CBanknodeMan: Removing inactive Banknode %s - %i now\n", (*it)->addr.ToString().c_str(), size() - 1);
+            CBanknodePtr pmn = *it;
             it = vBanknodes.erase(it);
+            UnindexBanknode(*pmn);
+            mncollateral.Forget(pmn->vin.prevout);
+            mapRankCache.clear();
         } else {
             ++it;
         }
@@ -273,19 +346,112 @@ void CBanknodeMan::Clear()
 {
     LOCK(cs);
     vBanknodes.clear();
+    mapBanknodesByOutPoint.clear();
+    mapBanknodesByPubKey.clear();
     mAskedUsForBanknodeList.clear();
     mWeAskedForBanknodeList.clear();
     mWeAskedForBanknodeListEntry.clear();
+    mapRankCache.clear();
+    dequeUnchecked.clear();
     nDsqCount = 0;
 }
 
+void CBanknodeMan::CheckLoaded(unsigned int nMax)
+{
+    {
+        LOCK(cs);
+        if(dequeUnchecked.empty()) return;
+    }
+
+    // the first check of an entry looks its collateral up in the coins view
+    LOCK2(cs_main, cs);
+
+    for(unsigned int i = 0; i < nMax && !dequeUnchecked.empty(); i++){
+        CBanknodePtr pmn = dequeUnchecked.front();
+        dequeUnchecked.pop_front();
+
+        // gone or replaced since it was loaded
+        boost::unordered_map<COutPoint, CBanknodePtr, COutPointHasher>::iterator it = mapBanknodesByOutPoint.find(pmn->vin.prevout);
+        if(it == mapBanknodesByOutPoint.end() || it->second != pmn) continue;
+
+        CheckBanknode(*pmn);
+        if(pmn->activeState == CBanknode::BANKNODE_REMOVE || pmn->activeState == CBanknode::BANKNODE_VIN_SPENT){
+            if(fDebug) LogPrintf("CBanknodeMan: Removing inactive Banknode %s - %i now\n", pmn->addr.ToString().c_str(), size() - 1);
+            vBanknodes.erase(std::find(vBanknodes.begin(), vBanknodes.end(), pmn));
+            UnindexBanknode(*pmn);
+            mncollateral.Forget(pmn->vin.prevout);
+            mapRankCache.clear();
+        }
+    }
+
+    if(dequeUnchecked.empty())
+        LogPrintf("CBanknodeMan::CheckLoaded - checked the cached Banknodes, %d left\n", size());
+}
+
+void CBanknodeMan::WriteCache(CDataStream& ss) const
+{
+    LOCK(cs);
+
+    ss << mAskedUsForBanknodeList;
+    ss << mWeAskedForBanknodeList;
+    ss << mWeAskedForBanknodeListEntry;
+    ss << nDsqCount;
+
+    ss << (uint32_t)vBanknodes.size();
+    BOOST_FOREACH(const CBanknodePtr& pmn, vBanknodes){
+        ss << (uint32_t)::GetSerializeSize(*pmn, ss.GetType(), ss.GetVersion());
+        ss << *pmn;
+    }
+}
+
+void CBanknodeMan::ReadCache(CDataStream& ss)
+{
+    LOCK(cs);
+
+    Clear();
+    ss >> mAskedUsForBanknodeList;
+    ss >> mWeAskedForBanknodeList;
+    ss >> mWeAskedForBanknodeListEntry;
+    ss >> nDsqCount;
+
+    uint32_t nCount;
+    uint32_t nSize;
+    unsigned int nSkipped = 0;
+    ss >> nCount;
+    for(uint32_t i = 0; i < nCount; i++){
+        ss >> nSize;
+        if(nSize > ss.size())
+            throw std::ios_base::failure("CBanknodeMan::ReadCache() : entry past the end of the data");
+
+        CBanknodePtr pmn(new CBanknode());
+        try {
+            CDataStream ssEntry(ss.begin(), ss.begin() + nSize, ss.GetType(), ss.GetVersion());
+            ssEntry >> *pmn;
+        } catch (std::exception &e) {
+            pmn.reset();
+        }
+        ss.ignore(nSize);
+
+        // entries that would not survive their first check are not worth a lookup
+        if(!pmn || mapBanknodesByOutPoint.count(pmn->vin.prevout) || !pmn->UpdatedWithin(BANKNODE_REMOVAL_SECONDS)){
+            nSkipped++;
+            continue;
+        }
+        vBanknodes.push_back(pmn);
+        IndexBanknode(pmn);
+        dequeUnchecked.push_back(pmn);
+    }
+
+    if(nSkipped) LogPrintf("CBanknodeMan::ReadCache - skipped %u cached Banknodes\n", nSkipped);
+}
+
 int CBanknodeMan::CountEnabled()
 {
     int i = 0;
 
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
-        mn.Check();
-        if(mn.IsEnabled()) i++;
+    BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes) {
+        CheckBanknode(*pmn);
+        if(pmn->IsEnabled()) i++;
     }
 
     return i;
@@ -295,9 +461,9 @@ int CBanknodeMan::CountBanknodesAboveProtocol(int protocolVersion)
 {
     int i = 0;
 
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
-        mn.Check();
-        if(mn.protocolVersion < protocolVersion || !mn.IsEnabled()) continue;
+    BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes) {
+        CheckBanknode(*pmn);
+        if(pmn->protocolVersion < protocolVersion || !pmn->IsEnabled()) continue;
         i++;
     }
 
@@ -325,12 +491,9 @@ CBanknode *CBanknodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CBanknode& mn, vBanknodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<COutPoint, CBanknodePtr, COutPointHasher>::iterator it = mapBanknodesByOutPoint.find(vin.prevout);
+    if(it == mapBanknodesByOutPoint.end()) return NULL;
+    return it->second.get();
 }
 
 
@@ -338,12 +501,9 @@ CBanknode *CBanknodeMan::Find(const CPubKey &pubKeyBanknode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CBanknode& mn, vBanknodes)
-    {
-        if(mn.pubkey2 == pubKeyBanknode)
-            return &mn;
-    }
-    return NULL;
+    boost::unordered_map<CPubKey, CBanknodePtr, CBanknodePubKeyHasher>::iterator it = mapBanknodesByPubKey.find(pubKeyBanknode);
+    if(it == mapBanknodesByPubKey.end()) return NULL;
+    return it->second.get();
 }
 
 
@@ -353,9 +513,10 @@ CBanknode* CBanknodeMan::FindOldestNotInVec(const std::vector<CTxIn> &vVins, int
 
     CBanknode *pOldestBanknode = NULL;
 
-    BOOST_FOREACH(CBanknode &mn, vBanknodes)
+    BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes)
     {
-        mn.Check();
+        CBanknode& mn = *pmn;
+        CheckBanknode(mn);
         if(!mn.IsEnabled()) continue;
 
         
@@ -386,48 +547,41 @@ CBanknode *CBanknodeMan::FindRandom()
 
     if(size() == 0) return NULL;
 
-    return &vBanknodes[GetRandInt(vBanknodes.size())];
+    return vBanknodes[GetRandInt(vBanknodes.size())].get();
 }
 
 CBanknode* CBanknodeMan::GetCurrentBankNode(int mod, int64_t nBlockHeight, int minProtocol)
 {
-    unsigned int score = 0;
-    CBanknode* winner = NULL;
-
-    // scan for winner
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
-        mn.Check();
-        if(mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
-
-        // calculate the score for each Banknode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
+    LOCK(cs);
 
-        // determine the winner
-        if(n2 > score){
-            score = n2;
-            winner = &mn;
-        }
-    }
+    // the winner is the highest score, CalculateScore does not depend on mod
+    const CBanknodeRanks* pranks = GetRanks(nBlockHeight, minProtocol, true);
+    if(pranks == NULL || pranks->vRanked.empty()) return NULL;
 
-    return winner;
+    return vBanknodes[pranks->vRanked[0]].get();
 }
 
-int CBanknodeMan::GetBanknodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const CBanknodeRanks* CBanknodeMan::GetRanks(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CTxIn> > vecBanknodeScores;
+    AssertLockHeld(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    std::pair<int64_t, std::pair<int, bool> > key = make_pair(nBlockHeight, make_pair(minProtocol, fOnlyActive));
+    std::map<std::pair<int64_t, std::pair<int, bool> >, CBanknodeRanks>::iterator it = mapRankCache.find(key);
+    if(it != mapRankCache.end() && it->second.hashBlock == hash) return &it->second;
+
+    std::vector<pair<unsigned int, int> > vecBanknodeScores;
 
     // scan for winner
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
+    for(int i = 0; i < (int)vBanknodes.size(); i++) {
+        CBanknode& mn = *vBanknodes[i];
 
         if(mn.protocolVersion < minProtocol) continue;
         if(fOnlyActive) {
-            mn.Check();
+            CheckBanknode(mn);
             if(!mn.IsEnabled()) continue;
         }
 
@@ -435,90 +589,65 @@ int CBanknodeMan::GetBanknodeRank(const CTxIn& vin, int64_t nBlockHeight, int mi
         unsigned int n2 = 0;
         memcpy(&n2, &n, sizeof(n2));
 
-        vecBanknodeScores.push_back(make_pair(n2, mn.vin));
+        vecBanknodeScores.push_back(make_pair(n2, i));
     }
 
-    sort(vecBanknodeScores.rbegin(), vecBanknodeScores.rend(), CompareValueOnly());
+    sort(vecBanknodeScores.rbegin(), vecBanknodeScores.rend(), CompareValueOnlyIndex());
+
+    // oldest heights go first, the map is ordered by height
+    if(mapRankCache.size() >= BANKNODE_RANK_CACHE_SIZE) mapRankCache.erase(mapRankCache.begin());
+
+    CBanknodeRanks& ranks = mapRankCache[key];
+    ranks.hashBlock = hash;
+    ranks.vRanked.clear();
+    ranks.mapRank.clear();
 
     int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecBanknodeScores){
+    BOOST_FOREACH (PAIRTYPE(unsigned int, int)& s, vecBanknodeScores){
         rank++;
-        if(s.second == vin) {
-            return rank;
-        }
+        ranks.vRanked.push_back(s.second);
+        ranks.mapRank[vBanknodes[s.second]->vin.prevout] = rank;
     }
 
-    return -1;
+    return &ranks;
 }
 
-std::vector<pair<int, CBanknode> > CBanknodeMan::GetBanknodeRanks(int64_t nBlockHeight, int minProtocol)
+int CBanknodeMan::GetBanknodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CBanknode> > vecBanknodeScores;
-    std::vector<pair<int, CBanknode> > vecBanknodeRanks;
-
-    //make sure we know about this block
-    uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return vecBanknodeRanks;
+    LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
+    const CBanknodeRanks* pranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive);
+    if(pranks == NULL) return -1;
 
-        mn.Check();
+    std::map<COutPoint, int>::const_iterator it = pranks->mapRank.find(vin.prevout);
+    if(it == pranks->mapRank.end()) return -1;
 
-        if(mn.protocolVersion < minProtocol) continue;
-        if(!mn.IsEnabled()) {
-            continue;
-        }
+    return it->second;
+}
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
+std::vector<pair<int, CBanknode> > CBanknodeMan::GetBanknodeRanks(int64_t nBlockHeight, int minProtocol)
+{
+    LOCK(cs);
 
-        vecBanknodeScores.push_back(make_pair(n2, mn));
-    }
+    std::vector<pair<int, CBanknode> > vecBanknodeRanks;
 
-    sort(vecBanknodeScores.rbegin(), vecBanknodeScores.rend(), CompareValueOnlyMN());
+    const CBanknodeRanks* pranks = GetRanks(nBlockHeight, minProtocol, true);
+    if(pranks == NULL) return vecBanknodeRanks;
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CBanknode)& s, vecBanknodeScores){
-        rank++;
-        vecBanknodeRanks.push_back(make_pair(rank, s.second));
-    }
+    for(unsigned int i = 0; i < pranks->vRanked.size(); i++)
+        vecBanknodeRanks.push_back(make_pair(i + 1, *vBanknodes[pranks->vRanked[i]]));
 
     return vecBanknodeRanks;
 }
 
 CBanknode* CBanknodeMan::GetBanknodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CTxIn> > vecBanknodeScores;
-
-    // scan for winner
-    BOOST_FOREACH(CBanknode& mn, vBanknodes) {
-
-        if(mn.protocolVersion < minProtocol) continue;
-        if(fOnlyActive) {
-            mn.Check();
-            if(!mn.IsEnabled()) continue;
-        }
-
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        unsigned int n2 = 0;
-        memcpy(&n2, &n, sizeof(n2));
-
-        vecBanknodeScores.push_back(make_pair(n2, mn.vin));
-    }
-
-    sort(vecBanknodeScores.rbegin(), vecBanknodeScores.rend(), CompareValueOnly());
+    LOCK(cs);
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecBanknodeScores){
-        rank++;
-        if(rank == nRank) {
-            return Find(s.second);
-        }
-    }
+    const CBanknodeRanks* pranks = GetRanks(nBlockHeight, minProtocol, fOnlyActive);
+    if(pranks == NULL || nRank < 1 || nRank > (int)pranks->vRanked.size()) return NULL;
 
-    return NULL;
+    return vBanknodes[pranks->vRanked[nRank - 1]].get();
 }
 
 void CBanknodeMan::ProcessBanknodeConnections()
@@ -550,6 +679,7 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
 
     if (strCommand == "dsee") { //DarkSend Election Entry
 
+        CDataStream vMsg(vRecv.begin(), vRecv.end(), vRecv.GetType(), vRecv.GetVersion());
         CTxIn vin;
         CService addr;
         CPubKey pubkey;
@@ -606,8 +736,10 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
             return;
         }
 
-        std::string errorMessage = "";
-        if(!darkSendSigner.VerifyMessage(pubkey, vchSig, strMessage, errorMessage)){
+        // verified on the signature queue, which hands the message back here
+        if(mnsigqueue.Defer(pfrom, strCommand, vMsg, pubkey, vchSig, strMessage)) return;
+
+        if(!mnsigqueue.Verify(pubkey, vchSig, strMessage)){
             LogPrintf("dsee - Got bad Banknode address signature\n");
             Misbehaving(pfrom->GetId(), 100);
             return;
@@ -627,12 +759,18 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
 
                 if(pmn->sigTime < sigTime){ //take the newest entry
                     LogPrintf("dsee - Got updated entry for %s\n", addr.ToString().c_str());
-                    pmn->pubkey2 = pubkey2;
+                    if(pmn->pubkey2 != pubkey2) {
+                        CBanknodePtr pmnIndexed = mapBanknodesByOutPoint[pmn->vin.prevout];
+                        UnindexBanknode(*pmn);
+                        pmn->pubkey2 = pubkey2;
+                        IndexBanknode(pmnIndexed);
+                    }
                     pmn->sigTime = sigTime;
                     pmn->sig = vchSig;
                     pmn->protocolVersion = protocolVersion;
                     pmn->addr = addr;
-                    pmn->Check();
+                    mapRankCache.clear();
+                    CheckBanknode(*pmn);
                     if(pmn->IsEnabled())
                         mnodeman.RelayBanknodeEntry(vin, addr, vchSig, sigTime, pubkey, pubkey2, count, current, lastUpdated, protocolVersion);
                 }
@@ -728,6 +866,7 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
 
     else if (strCommand == "dseep") { //DarkSend Election Entry Ping
 
+        CDataStream vMsg(vRecv.begin(), vRecv.end(), vRecv.GetType(), vRecv.GetVersion());
         CTxIn vin;
         vector<unsigned char> vchSig;
         int64_t sigTime;
@@ -756,8 +895,9 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
             {
                 std::string strMessage = pmn->addr.ToString() + boost::lexical_cast<std::string>(sigTime) + boost::lexical_cast<std::string>(stop);
 
-                std::string errorMessage = "";
-                if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchSig, strMessage, errorMessage))
+                if(mnsigqueue.Defer(pfrom, strCommand, vMsg, pmn->pubkey2, vchSig, strMessage)) return;
+
+                if(!mnsigqueue.Verify(pmn->pubkey2, vchSig, strMessage))
                 {
                     LogPrintf("dseep - Got bad Banknode address signature %s \n", vin.ToString().c_str());
                     //Misbehaving(pfrom->GetId(), 100);
@@ -772,7 +912,7 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
                     else
                     {
                         pmn->UpdateLastSeen();
-                        pmn->Check();
+                        CheckBanknode(*pmn);
                         if(!pmn->IsEnabled()) return;
                     }
                     mnodeman.RelayBanknodeEntryPing(vin, vchSig, sigTime, stop);
@@ -858,7 +998,8 @@ void CBanknodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
         int count = this->size();
         int i = 0;
 
-        BOOST_FOREACH(CBanknode& mn, vBanknodes) {
+        BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes) {
+            CBanknode& mn = *pmn;
 
             if(mn.addr.IsRFC1918()) continue; //local network
 
@@ -899,13 +1040,20 @@ void CBanknodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    vector<CBanknode>::iterator it = vBanknodes.begin();
+    CBanknode* pmn = Find(vin);
+    if(pmn == NULL || pmn->vin != vin) return;
+
+    vector<CBanknodePtr>::iterator it = vBanknodes.begin();
     while(it != vBanknodes.end()){
-        if((*it).vin == vin){
-            if(fDebug) LogPrintf("CBanknodeMan: Removing Banknode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
+        if((*it).get() == pmn){
+            if(fDebug) LogPrintf("CBanknodeMan: Removing Banknode %s - %i now\n", pmn->addr.ToString().c_str(), size() - 1);
+            UnindexBanknode(*pmn);
+            mncollateral.Forget(pmn->vin.prevout);
             vBanknodes.erase(it);
+            mapRankCache.clear();
             break;
         }
+        ++it;
     }
 }
 
@@ -16,8 +16,16 @@
 #include "main.h"
 #include "banknode.h"
 
+#include <deque>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 #define BANKNODES_DUMP_SECONDS               (15*60)
 #define BANKNODES_DSEG_SECONDS               (3*60*60)
+#define BANKNODE_RANK_CACHE_SIZE             32
+#define BANKNODES_CACHE_VERSION              2
+#define BANKNODES_CHECK_LOADED               50
 
 using namespace std;
 
@@ -27,6 +35,11 @@ extern CBanknodeMan mnodeman;
 void DumpBanknodes();
 
 /** Access to the MN database (mncache.dat)
+ *
+ * Layout: magic message, network magic, BANKNODES_CACHE_VERSION as 4 bytes,
+ * the list bookkeeping of CBanknodeMan, the number of entries and then each
+ * entry behind its 4 byte length, so entries can be walked without parsing
+ * them. A double SHA256 of everything before it closes the file.
  */
 class CBanknodeDB
 {
@@ -46,7 +59,44 @@ public:
 
     CBanknodeDB();
     bool Write(const CBanknodeMan &mnodemanToSave);
+    /// Load the entries as they were saved, they are checked later by CBanknodeMan::CheckLoaded
     ReadResult Read(CBanknodeMan& mnodemanToLoad);
+    /// Whether the file can be read, without loading any entry
+    ReadResult Verify();
+
+private:
+    /// Read the file and check its checksum, header and version; ss is left at the CBanknodeMan data
+    ReadResult ReadHeader(CDataStream& ss);
+};
+
+/** Handle to a registered Banknode, stays valid after the entry is removed
+ */
+typedef boost::shared_ptr<CBanknode> CBanknodePtr;
+
+/** Hasher for the public key index, public keys are random enough
+ */
+struct CBanknodePubKeyHasher
+{
+    size_t operator()(const CPubKey& pubkey) const
+    {
+        // skip the prefix byte, the rest of a valid key is a curve coordinate
+        size_t n = 0;
+        if(pubkey.size() > sizeof(n)) memcpy(&n, pubkey.begin() + 1, sizeof(n));
+        return n;
+    }
+};
+
+/** Banknodes ordered by score for one block, as used by the rank lookups
+ */
+class CBanknodeRanks
+{
+public:
+    // block the scores were calculated from, the entry is stale once the height has another block
+    uint256 hashBlock;
+    // index into vBanknodes of rank 1, 2, ...
+    std::vector<int> vRanked;
+    // rank of each Banknode by collateral outpoint
+    std::map<COutPoint, int> mapRank;
 };
 
 class CBanknodeMan
@@ -55,7 +105,11 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
-    // map to hold all MNs
+    // all MNs, in the order they were added
+    std::vector<CBanknodePtr> vBanknodes;
+    // the same MNs by collateral outpoint and by pubkey2, for Find
+    boost::unordered_map<COutPoint, CBanknodePtr, COutPointHasher> mapBanknodesByOutPoint;
+    boost::unordered_map<CPubKey, CBanknodePtr, CBanknodePubKeyHasher> mapBanknodesByPubKey;
 
     // who's asked for the Banknode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForBanknodeList;
@@ -64,31 +118,26 @@ private:
     // which Banknodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForBanknodeListEntry;
 
-public:
-    // keep track of dsq count to prevent banknodes from gaming darksend queue
-    int64_t nDsqCount;
+    // ranks by (height, minProtocol, fOnlyActive), cleared whenever vBanknodes
+    // or the state of an entry changes
+    std::map<std::pair<int64_t, std::pair<int, bool> >, CBanknodeRanks> mapRankCache;
+
+    // entries loaded from mncache.dat that were not checked since
+    std::deque<CBanknodePtr> dequeUnchecked;
 
-    std::vector<CBanknode> vBanknodes;
+    /// Add to or take out of the outpoint and pubkey2 indexes
+    void IndexBanknode(const CBanknodePtr& pmn);
+    void UnindexBanknode(const CBanknode& mn);
 
-ADD_SERIALIZE_METHODS;
+    /// Check an entry, dropping the cached ranks if its state changed
+    void CheckBanknode(CBanknode& mn);
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+    /// Ranks for this block, calculated once and then served from mapRankCache; NULL if the block is unknown
+    const CBanknodeRanks* GetRanks(int64_t nBlockHeight, int minProtocol, bool fOnlyActive);
 
-        // serialized format:
-        // * version byte (currently 0)
-        // * banknodes vector
-        {
-                LOCK(cs);
-                unsigned char nVersion = 0;
-                READWRITE(nVersion);
-                READWRITE(vBanknodes);
-                READWRITE(mAskedUsForBanknodeList);
-                READWRITE(mWeAskedForBanknodeList);
-                READWRITE(mWeAskedForBanknodeListEntry);
-                READWRITE(nDsqCount);
-        }
- 	}
+public:
+    // keep track of dsq count to prevent banknodes from gaming darksend queue
+    int64_t nDsqCount;
 
     CBanknodeMan();
     CBanknodeMan(CBanknodeMan& other);
@@ -96,8 +145,10 @@ ADD_SERIALIZE_METHODS;
     /// Add an entry
     bool Add(CBanknode &mn);
 
-    /// Check all Banknodes
+    /// Check all Banknodes but those CheckLoaded has yet to check
     void Check();
+    /// Check one Banknode, dropping the cached ranks if its state changed
+    void Check(CBanknode& mn);
 
     /// Check all Banknodes and remove inactive
     void CheckAndRemove();
@@ -105,6 +156,14 @@ ADD_SERIALIZE_METHODS;
     /// Clear Banknode vector
     void Clear();
 
+    /// Check up to nMax of the entries loaded from mncache.dat and remove the inactive ones
+    void CheckLoaded(unsigned int nMax);
+
+    /// Write the list to the mncache.dat stream
+    void WriteCache(CDataStream& ss) const;
+    /// Read the list from the mncache.dat stream; entries that fail to parse are skipped
+    void ReadCache(CDataStream& ss);
+
     int CountEnabled();
 
     int CountBanknodesAboveProtocol(int protocolVersion);
@@ -124,7 +183,11 @@ ADD_SERIALIZE_METHODS;
     /// Get the current winner for this block
     CBanknode* GetCurrentBankNode(int mod=1, int64_t nBlockHeight=0, int minProtocol=0);
 
-    std::vector<CBanknode> GetFullBanknodeVector() { Check(); return vBanknodes; }
+    /// Handles to all Banknodes, after checking them; copies no entries
+    std::vector<CBanknodePtr> GetFullBanknodeVector() { Check(); LOCK(cs); return vBanknodes; }
+
+    /// Handles to all Banknodes as they are
+    std::vector<CBanknodePtr> GetBanknodes() { LOCK(cs); return vBanknodes; }
 
     std::vector<pair<int, CBanknode> > GetBanknodeRanks(int64_t nBlockHeight, int minProtocol=0);
     int GetBanknodeRank(const CTxIn &vin, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
@@ -0,0 +1,68 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "clientversion.h"
+
+#include <iostream>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+namespace benchmark {
+
+UniValue State::NewResult(const std::string& strCase) const
+{
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("benchmark", name);
+    result.pushKV("case", strCase);
+    result.pushKV("version", FormatFullVersion());
+    return result;
+}
+
+void State::Emit(const UniValue& result) const
+{
+    std::cout << result.write() << std::endl;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static std::map<std::string, BenchFunction> benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(const std::string& strFilter)
+{
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (it->first.find(strFilter) == std::string::npos)
+            continue;
+        State state(it->first);
+        it->second(state);
+    }
+}
+
+int64_t GetPeakRSS()
+{
+#ifdef WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef MAC_OSX
+    return usage.ru_maxrss;
+#else
+    return (int64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_BENCH_BENCH_H
+#define BITCREDIT_BENCH_BENCH_H
+
+#include "univalue/univalue.h"
+
+#include <map>
+#include <string>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/**
+ * Minimal benchmarking framework.
+ *
+ * A benchmark is a function registered with BENCHMARK(name). It does its own
+ * timing and fills in one or more result objects, each of which is printed as
+ * a single line of JSON so runs can be collected and compared by scripts:
+ *
+ *   static void MyBench(benchmark::State& state)
+ *   {
+ *       int64_t nStart = GetTimeMicros();
+ *       ...
+ *       UniValue result = state.NewResult("case");
+ *       result.pushKV("micros", GetTimeMicros() - nStart);
+ *       state.Emit(result);
+ *   }
+ *   BENCHMARK(MyBench);
+ *
+ * Options are read with GetArg() from the bench_bitcredit command line.
+ */
+namespace benchmark {
+
+    class State {
+    public:
+        State(const std::string& nameIn) : name(nameIn) {}
+
+        /** Start a result object tagged with the benchmark and case names */
+        UniValue NewResult(const std::string& strCase) const;
+        /** Print a result as one line of JSON on stdout */
+        void Emit(const UniValue& result) const;
+
+    private:
+        std::string name;
+    };
+
+    typedef void (*BenchFunction)(State&);
+
+    class BenchRunner
+    {
+        typedef std::map<std::string, BenchFunction> BenchmarkMap;
+        static BenchmarkMap& benchmarks();
+
+    public:
+        BenchRunner(const std::string& name, BenchFunction func);
+
+        /** Run every benchmark whose name contains strFilter */
+        static void RunAll(const std::string& strFilter);
+    };
+
+    /** Peak resident set size of this process in bytes, or 0 if unknown */
+    int64_t GetPeakRSS();
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCREDIT_BENCH_BENCH_H
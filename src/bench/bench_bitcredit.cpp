@@ -0,0 +1,33 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "util.h"
+
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+    fPrintToDebugLog = false;
+
+    if (mapArgs.count("-?") || mapArgs.count("-help")) {
+        std::cout << "Usage: bench_bitcredit [options]\n\n"
+                  << "Runs benchmarks and prints one JSON object per result line.\n\n"
+                  << "  -filter=<str>         Only run benchmarks whose name contains <str>\n"
+                  << "  -corpus=<n>           Number of fixed Momentum midHashes to search (default: 4)\n"
+                  << "  -threads=<n>          Momentum search threads (default: 1)\n"
+                  << "  -kernel=<name>        SHA-512 batch kernel: auto, scalar, sse2, avx2, avx512 (default: auto)\n"
+                  << "  -messages=<n>         Secure messages generated (default: 1000)\n"
+                  << "  -keys=<n>             Secure messaging keys the messages are sent between (default: 8)\n"
+                  << "  -buckets=<n>          Secure message buckets the messages are spread over (default: 8)\n"
+                  << "  -msgsize=<n>          Secure message plaintext size in bytes (default: 256)\n";
+        return 0;
+    }
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""));
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha512_batch.h"
+#include "hash.h"
+#include "momentum.h"
+#include "primitives/block.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <vector>
+
+//! Repetitions used to time a single proof verification
+static const int VERIFY_ROUNDS = 1000;
+
+/**
+ * Header number i of the fixed benchmark corpus. Only the midHash matters to
+ * the search, but going through CBlock keeps GetMidHash() and
+ * GetVerifiedHash() in the measured path.
+ */
+static CBlock CorpusBlock(uint32_t i)
+{
+    CBlock block;
+    block.nVersion = CBlockHeader::CURRENT_VERSION;
+    block.hashPrevBlock = Hash(BEGIN(i), END(i));
+    block.hashMerkleRoot = 0;
+    block.nTime = 1430784000;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = i;
+    return block;
+}
+
+static void MomentumSearch(benchmark::State& state)
+{
+    int nCorpus = GetArg("-corpus", 4);
+    int nThreads = GetArg("-threads", 1);
+    std::string strKernel = GetArg("-kernel", "auto");
+    if (!SHA512NonceBatchSelect(strKernel)) {
+        UniValue error = state.NewResult("error");
+        error.pushKV("error", "unsupported -kernel=" + strKernel);
+        state.Emit(error);
+        return;
+    }
+
+    int64_t nTotalMicros = 0;
+    uint64_t nTotalCollisions = 0;
+    double dTotalFill = 0;
+    for (int i = 0; i < nCorpus; i++) {
+        CBlock block = CorpusBlock(i);
+        uint256 midHash = block.GetMidHash();
+
+        bts::momentum_search_stats stats;
+        int64_t nStart = GetTimeMicros();
+        std::vector< std::pair<uint32_t,uint32_t> > results = bts::momentum_search(midHash, nThreads, &stats);
+        int64_t nMicros = GetTimeMicros() - nStart;
+
+        int nInvalid = 0;
+        for (size_t r = 0; r < results.size(); r++)
+            if (!bts::momentum_verify(midHash, results[r].first, results[r].second))
+                nInvalid++;
+
+        // Verify latency of the first proof found, or of a failing proof if
+        // this midHash yielded none; both cost the same two SHA-512s.
+        block.nBirthdayA = results.empty() ? 0 : results[0].first;
+        block.nBirthdayB = results.empty() ? 1 : results[0].second;
+        nStart = GetTimeMicros();
+        for (int r = 0; r < VERIFY_ROUNDS; r++)
+            bts::momentum_verify(midHash, block.nBirthdayA, block.nBirthdayB);
+        int64_t nVerifyMicros = GetTimeMicros() - nStart;
+        nStart = GetTimeMicros();
+        for (int r = 0; r < VERIFY_ROUNDS; r++)
+            block.GetVerifiedHash();
+        int64_t nHeaderMicros = GetTimeMicros() - nStart;
+
+        double dSeconds = nMicros / 1000000.0;
+        double dFill = (double)stats.nTableEntries / stats.nTableSlots;
+        UniValue result = state.NewResult(strprintf("midhash-%d", i));
+        result.pushKV("midhash", midHash.GetHex());
+        result.pushKV("kernel", SHA512NonceBatchKernel());
+        result.pushKV("threads", nThreads);
+        result.pushKV("search_micros", nMicros);
+        result.pushKV("sha512_per_sec", stats.nBirthdays / BIRTHDAYS_PER_HASH / dSeconds);
+        result.pushKV("birthdays_per_sec", stats.nBirthdays / dSeconds);
+        result.pushKV("table_fill", dFill);
+        result.pushKV("collisions", (uint64_t)results.size());
+        result.pushKV("invalid_proofs", nInvalid);
+        result.pushKV("verify_micros", (double)nVerifyMicros / VERIFY_ROUNDS);
+        result.pushKV("header_verify_micros", (double)nHeaderMicros / VERIFY_ROUNDS);
+        result.pushKV("peak_rss", benchmark::GetPeakRSS());
+        state.Emit(result);
+
+        nTotalMicros += nMicros;
+        nTotalCollisions += results.size();
+        dTotalFill += dFill;
+    }
+
+    if (nCorpus > 0) {
+        UniValue summary = state.NewResult("summary");
+        summary.pushKV("kernel", SHA512NonceBatchKernel());
+        summary.pushKV("threads", nThreads);
+        summary.pushKV("corpus", nCorpus);
+        summary.pushKV("search_micros_avg", (double)nTotalMicros / nCorpus);
+        summary.pushKV("birthdays_per_sec", (double)MAX_MOMENTUM_NONCE * nCorpus / (nTotalMicros / 1000000.0));
+        summary.pushKV("table_fill_avg", dTotalFill / nCorpus);
+        summary.pushKV("collisions", nTotalCollisions);
+        summary.pushKV("peak_rss", benchmark::GetPeakRSS());
+        state.Emit(summary);
+    }
+}
+
+BENCHMARK(MomentumSearch);
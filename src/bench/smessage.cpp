@@ -0,0 +1,250 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "init.h"
+#include "key.h"
+#include "random.h"
+#include "smessage.h"
+#include "util.h"
+#include "utiltime.h"
+#include "wallet.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <fcntl.h>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+//! Repetitions of the bucket hashing and inventory cases
+static const int SMSG_BENCH_ROUNDS = 100;
+
+/**
+ * The secure messaging code logs with printf, which would end up between the
+ * result lines. While in scope stdout goes to the null device instead.
+ */
+class CQuietStdout
+{
+public:
+    CQuietStdout()
+    {
+        fflush(stdout);
+        fdSaved = dup(fileno(stdout));
+#ifdef WIN32
+        int fdNull = open("NUL", O_WRONLY);
+#else
+        int fdNull = open("/dev/null", O_WRONLY);
+#endif
+        if (fdNull >= 0) {
+            dup2(fdNull, fileno(stdout));
+            close(fdNull);
+        }
+    }
+
+    ~CQuietStdout()
+    {
+        fflush(stdout);
+        if (fdSaved >= 0) {
+            dup2(fdSaved, fileno(stdout));
+            close(fdSaved);
+        }
+    }
+
+private:
+    int fdSaved;
+};
+
+static void EmitRate(benchmark::State& state, const std::string& strCase, uint64_t nCount, int64_t nMicros, int nFailed)
+{
+    UniValue result = state.NewResult(strCase);
+    result.pushKV("count", nCount);
+    result.pushKV("micros", nMicros);
+    result.pushKV("micros_avg", nCount ? (double)nMicros / nCount : 0.0);
+    result.pushKV("per_sec", nMicros ? nCount / (nMicros / 1000000.0) : 0.0);
+    result.pushKV("failed", nFailed);
+    result.pushKV("peak_rss", benchmark::GetPeakRSS());
+    state.Emit(result);
+}
+
+/**
+ * Synthetic secure messaging load: -messages messages of -msgsize bytes sent
+ * between -keys wallet keys and spread over -buckets buckets, run through
+ * encryption, decryption, the bucket store, bucket hashing and the smsgInv
+ * inventory. Everything happens in a temporary data dir, no peers involved.
+ */
+static void SecureMsgThroughput(benchmark::State& state)
+{
+    int nMessages = GetArg("-messages", 1000);
+    int nKeys = std::max(1, (int)GetArg("-keys", 8));
+    int nBuckets = std::max(1, (int)GetArg("-buckets", 8));
+    int nSize = std::min((int)SMSG_MAX_MSG_BYTES, std::max(1, (int)GetArg("-msgsize", 256)));
+    if (nBuckets * SMSG_BUCKET_LEN >= SMSG_RETENTION) {
+        UniValue error = state.NewResult("error");
+        error.pushKV("error", strprintf("-buckets must be below %u", SMSG_RETENTION / SMSG_BUCKET_LEN));
+        state.Emit(error);
+        return;
+    }
+
+    SelectParams(CBaseChainParams::MAIN);
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_smsg_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    // -- keys live in an in memory wallet, their public keys in the smsg db
+    pwalletMain = new CWallet();
+    std::vector<std::string> vAddresses;
+    {
+        CQuietStdout quiet;
+        SecureMsgEnable();
+        for (int i = 0; i < nKeys; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            CPubKey pubKey = key.GetPubKey();
+            {
+                LOCK(pwalletMain->cs_wallet);
+                pwalletMain->AddKeyPubKey(key, pubKey);
+            }
+            std::string strAddress = CBitcreditAddress(pubKey.GetID()).ToString();
+            std::string strPubKey = EncodeBase58(pubKey.begin(), pubKey.end());
+            SecureMsgAddAddress(strAddress, strPubKey);
+            vAddresses.push_back(strAddress);
+        }
+    }
+
+    std::string strText;
+    for (int i = 0; i < nSize; i++)
+        strText += (char)('a' + (i * 7) % 26);
+
+    // -- encrypt, each message timestamped into one of the buckets
+    std::vector<SecureMessage> vMessages(nMessages);
+    int nFailed = 0;
+    int64_t nNow = GetTime();
+    int64_t nMicros = 0;
+    {
+        CQuietStdout quiet;
+        for (int i = 0; i < nMessages; i++) {
+            std::string strFrom = vAddresses[i % nKeys];
+            std::string strTo = vAddresses[(i + 1) % nKeys];
+            SetMockTime(nNow - (i % nBuckets) * SMSG_BUCKET_LEN);
+            int64_t nStart = GetTimeMicros();
+            if (SecureMsgEncrypt(vMessages[i], strFrom, strTo, strText) != 0)
+                nFailed++;
+            nMicros += GetTimeMicros() - nStart;
+        }
+        SetMockTime(0);
+    }
+    EmitRate(state, "encrypt", nMessages, nMicros, nFailed);
+
+    nFailed = 0;
+    int64_t nStart;
+    {
+        CQuietStdout quiet;
+        nStart = GetTimeMicros();
+        for (int i = 0; i < nMessages; i++) {
+            MessageData msg;
+            if (SecureMsgDecrypt(false, vAddresses[(i + 1) % nKeys], vMessages[i], &vMessages[i].vchPayload[0], msg) != 0
+                || std::string(msg.sMessage.begin(), msg.sMessage.end()) != strText)
+                nFailed++;
+        }
+        nMicros = GetTimeMicros() - nStart;
+    }
+    EmitRate(state, "decrypt", nMessages, nMicros, nFailed);
+
+    // -- store as received from peers, the buckets are hashed separately
+    nFailed = 0;
+    {
+        CQuietStdout quiet;
+        nStart = GetTimeMicros();
+        for (int i = 0; i < nMessages; i++)
+            if (SecureMsgStore(vMessages[i], false) != 0)
+                nFailed++;
+        nMicros = GetTimeMicros() - nStart;
+    }
+    EmitRate(state, "store", nMessages, nMicros, nFailed);
+
+    std::vector<boost::shared_ptr<SecMsgBucket> > vBuckets;
+    {
+        LOCK(cs_smsgBuckets);
+        std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it;
+        for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
+            vBuckets.push_back(it->second);
+    }
+
+    uint64_t nHashed = 0;
+    nStart = GetTimeMicros();
+    for (int r = 0; r < SMSG_BENCH_ROUNDS; r++) {
+        for (size_t i = 0; i < vBuckets.size(); i++) {
+            LOCK(vBuckets[i]->cs);
+            vBuckets[i]->hashBucket();
+            nHashed += vBuckets[i]->setTokens.size();
+        }
+    }
+    nMicros = GetTimeMicros() - nStart;
+    {
+        UniValue result = state.NewResult("hash_bucket");
+        result.pushKV("buckets", (uint64_t)vBuckets.size());
+        result.pushKV("rounds", SMSG_BENCH_ROUNDS);
+        result.pushKV("micros_avg", (double)nMicros / (SMSG_BENCH_ROUNDS * std::max((size_t)1, vBuckets.size())));
+        result.pushKV("tokens_per_sec", nMicros ? nHashed / (nMicros / 1000000.0) : 0.0);
+        state.Emit(result);
+    }
+
+    // -- inventory as sent to peers with and without SMSG_PEER_DIGEST
+    for (int nLegacy = 0; nLegacy < 2; nLegacy++) {
+        uint32_t nListed = 0;
+        nStart = GetTimeMicros();
+        for (int r = 0; r < SMSG_BENCH_ROUNDS; r++) {
+            std::vector<unsigned char> vchData;
+            // a new message invalidates the cached legacy hashes, as on a live node
+            if (nLegacy && !vBuckets.empty()) {
+                LOCK(vBuckets[0]->cs);
+                vBuckets[0]->fLegacyHashValid = false;
+            }
+            nListed = SecureMsgBuildInventory(0, vchData, nLegacy);
+        }
+        nMicros = GetTimeMicros() - nStart;
+
+        UniValue result = state.NewResult(nLegacy ? "inventory_legacy" : "inventory");
+        result.pushKV("buckets", (uint64_t)nListed);
+        result.pushKV("rounds", SMSG_BENCH_ROUNDS);
+        result.pushKV("micros_avg", (double)nMicros / SMSG_BENCH_ROUNDS);
+        state.Emit(result);
+    }
+
+    std::vector<SecMsgToken> vTokens;
+    for (size_t i = 0; i < vBuckets.size(); i++) {
+        LOCK(vBuckets[i]->cs);
+        vTokens.insert(vTokens.end(), vBuckets[i]->setTokens.begin(), vBuckets[i]->setTokens.end());
+    }
+    nFailed = 0;
+    {
+        CQuietStdout quiet;
+        nStart = GetTimeMicros();
+        for (size_t i = 0; i < vTokens.size(); i++) {
+            SecureMessage smsg;
+            if (SecureMsgRetrieve(vTokens[i], smsg) != 0)
+                nFailed++;
+        }
+        nMicros = GetTimeMicros() - nStart;
+    }
+    EmitRate(state, "retrieve", vTokens.size(), nMicros, nFailed);
+
+    {
+        CQuietStdout quiet;
+        SecureMsgDisable();
+    }
+    delete pwalletMain;
+    pwalletMain = NULL;
+    boost::filesystem::remove_all(pathTemp);
+}
+
+BENCHMARK(SecureMsgThroughput);
@@ -0,0 +1,148 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bidtracker.h"
+
+#include "base58.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+CBidTracker bidtracker;
+
+CBidTracker::CBidTracker() : nLastWriteTime(0), nLastSize(0)
+{
+}
+
+void CBidTracker::Init(const boost::filesystem::path& pathIn)
+{
+    {
+        LOCK(cs);
+        path = pathIn;
+    }
+    Refresh(true);
+}
+
+boost::filesystem::path CBidTracker::GetPath() const
+{
+    LOCK(cs);
+    return path;
+}
+
+/**
+ * Parse one "address,amount" line. Blank lines are skipped silently, other
+ * lines that do not hold a valid address and a non-negative amount are
+ * logged and skipped.
+ */
+static bool ParseBidLine(const string& strLine, int nLine, string& strAddress, CAmount& nAmount)
+{
+    if (strLine.find_first_not_of(" \t\r") == string::npos)
+        return false;
+
+    size_t nComma = strLine.find(',');
+    if (nComma != string::npos) {
+        strAddress = strLine.substr(0, nComma);
+        string strAmount = strLine.substr(nComma + 1);
+        if (!strAmount.empty() && strAmount[strAmount.size() - 1] == '\r')
+            strAmount.erase(strAmount.size() - 1);
+        // ParseInt64 takes an empty string for 0
+        if (CBitcreditAddress(strAddress).IsValid() && !strAmount.empty() && ParseInt64(strAmount, &nAmount) && nAmount >= 0)
+            return true;
+    }
+    LogPrintf("CBidTracker : ignoring malformed line %d: %s\n", nLine, strLine);
+    return false;
+}
+
+bool CBidTracker::Refresh(bool fForce)
+{
+    LOCK(cs);
+    if (path.empty())
+        return false;
+
+    boost::system::error_code ec;
+    time_t nWriteTime = boost::filesystem::last_write_time(path, ec);
+    if (ec) {
+        // No file means no bids
+        if (!mapBids.empty() || fForce)
+            LogPrintf("CBidTracker : %s not found, no bids\n", path.string());
+        mapBids.clear();
+        nLastWriteTime = 0;
+        nLastSize = 0;
+        return true;
+    }
+    uintmax_t nSize = boost::filesystem::file_size(path, ec);
+    if (!fForce && nWriteTime == nLastWriteTime && nSize == nLastSize)
+        return false;
+
+    ifstream file(path.string().c_str());
+    if (!file.is_open()) {
+        LogPrintf("CBidTracker : cannot open %s, keeping %u bids\n", path.string(), mapBids.size());
+        return false;
+    }
+
+    map<string, CAmount> mapNew;
+    string strLine;
+    int nLine = 0;
+    while (getline(file, strLine)) {
+        string strAddress;
+        CAmount nAmount;
+        if (ParseBidLine(strLine, ++nLine, strAddress, nAmount))
+            mapNew[strAddress] = nAmount;
+    }
+
+    mapBids.swap(mapNew);
+    nLastWriteTime = nWriteTime;
+    nLastSize = nSize;
+    LogPrintf("CBidTracker : loaded %u bids from %s\n", mapBids.size(), path.string());
+    return true;
+}
+
+map<string, CAmount> CBidTracker::GetBids() const
+{
+    LOCK(cs);
+    return mapBids;
+}
+
+bool CBidTracker::SetBid(const string& strAddress, CAmount nAmount)
+{
+    LOCK(cs);
+    if (nAmount == 0)
+        mapBids.erase(strAddress);
+    else
+        mapBids[strAddress] = nAmount;
+    return Write();
+}
+
+bool CBidTracker::Write()
+{
+    AssertLockHeld(cs);
+    boost::filesystem::path pathTmp(path.string() + ".new");
+    {
+        ofstream file(pathTmp.string().c_str(), ios::out | ios::trunc);
+        if (!file.is_open())
+            return error("CBidTracker : cannot write %s", pathTmp.string());
+        for (map<string, CAmount>::const_iterator it = mapBids.begin(); it != mapBids.end(); ++it)
+            file << it->first << "," << it->second << "\n";
+        if (!file.good())
+            return error("CBidTracker : failed writing %s", pathTmp.string());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("CBidTracker : cannot replace %s", path.string());
+
+    // Our own write is already loaded
+    boost::system::error_code ec;
+    nLastWriteTime = boost::filesystem::last_write_time(path, ec);
+    nLastSize = boost::filesystem::file_size(path, ec);
+    return true;
+}
+
+void RefreshBidTracker()
+{
+    bidtracker.Refresh();
+}
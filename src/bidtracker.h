@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_BIDTRACKER_H
+#define BITCREDIT_BIDTRACKER_H
+
+#include "amount.h"
+#include "sync.h"
+
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+//! Seconds between checks whether the bid file changed on disk
+static const int BIDTRACKER_REFRESH_INTERVAL = 60;
+
+/**
+ * In-memory index of the bid file (-bidtracker, default bidtracker.txt),
+ * whose "address,amount" lines list the payouts added to the coinbase of
+ * every 400th block. The file is parsed once and then only reloaded when
+ * its size or modification time changes, so building a block template
+ * never touches the disk.
+ */
+class CBidTracker
+{
+public:
+    CBidTracker();
+
+    /** Set the bid file and load it */
+    void Init(const boost::filesystem::path& pathIn);
+
+    /** Reload the file if it changed since the last load; returns whether it was reloaded */
+    bool Refresh(bool fForce = false);
+
+    /** Snapshot of the current bids, in satoshis by address */
+    std::map<std::string, CAmount> GetBids() const;
+
+    /** Set (or with nAmount 0, remove) the bid of an address and rewrite the file */
+    bool SetBid(const std::string& strAddress, CAmount nAmount);
+
+    boost::filesystem::path GetPath() const;
+
+private:
+    mutable CCriticalSection cs;
+    boost::filesystem::path path;
+    std::map<std::string, CAmount> mapBids;
+    std::time_t nLastWriteTime;
+    uintmax_t nLastSize;
+
+    bool Write();
+};
+
+extern CBidTracker bidtracker;
+
+/** Reload check run every BIDTRACKER_REFRESH_INTERVAL seconds by its own thread */
+void RefreshBidTracker();
+
+#endif // BITCREDIT_BIDTRACKER_H
@@ -0,0 +1,82 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "birthdaytable.h"
+
+#include <vector>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace {
+
+//! Alignment of the slot array, so that a bucket never straddles cache lines
+//! it does not need to
+const size_t BUCKET_ALIGN = sizeof(uint64_t) << CBirthdayTable::BUCKET_BITS;
+
+boost::mutex csPool;
+std::vector<CBirthdayTable*> vPool;
+
+}
+
+CBirthdayTable::CBirthdayTable() : nEpochTag(0)
+{
+    const size_t nPad = BUCKET_ALIGN / sizeof(uint64_t);
+    pallocation = new boost::atomic<uint64_t>[SLOT_COUNT + nPad];
+    size_t nMisalign = (size_t)pallocation % BUCKET_ALIGN;
+    pslots = pallocation + (nMisalign ? (BUCKET_ALIGN - nMisalign) / sizeof(uint64_t) : 0);
+    Wipe();
+}
+
+CBirthdayTable::~CBirthdayTable()
+{
+    delete [] pallocation;
+}
+
+void CBirthdayTable::Wipe()
+{
+    for (uint64_t i = 0; i < SLOT_COUNT; i++)
+        pslots[i].store(0, boost::memory_order_relaxed);
+}
+
+void CBirthdayTable::NewSearch()
+{
+    uint64_t nEpoch = ((nEpochTag >> EPOCH_SHIFT) + 1) & 0xff;
+    if (nEpoch == 0) {
+        // Epoch counter wrapped: slots tagged with any epoch could look
+        // current again, so clear them once and restart from epoch 1.
+        Wipe();
+        nEpoch = 1;
+    }
+    nEpochTag = nEpoch << EPOCH_SHIFT;
+    boost::atomic_thread_fence(boost::memory_order_release);
+}
+
+uint64_t CBirthdayTable::CountEntries() const
+{
+    uint64_t nEntries = 0;
+    for (uint64_t i = 0; i < SLOT_COUNT; i++)
+        if ((pslots[i].load(boost::memory_order_relaxed) & EPOCH_MASK) == nEpochTag)
+            nEntries++;
+    return nEntries;
+}
+
+CBirthdayTable* CBirthdayTable::Acquire()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csPool);
+        if (!vPool.empty()) {
+            CBirthdayTable* ptable = vPool.back();
+            vPool.pop_back();
+            return ptable;
+        }
+    }
+    return new CBirthdayTable();
+}
+
+void CBirthdayTable::Release(CBirthdayTable* ptable)
+{
+    boost::lock_guard<boost::mutex> lock(csPool);
+    vPool.push_back(ptable);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_BIRTHDAYTABLE_H
+#define BITCREDIT_BIRTHDAYTABLE_H
+
+#include "momentum.h"
+
+#include <stdint.h>
+
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
+
+/**
+ * Bucketed hash table for the Momentum birthday search.
+ *
+ * Each entry is a single 64-bit slot holding the birthday bits not implied by
+ * the bucket index together with the nonce, so one lookup touches one bucket
+ * in one array. The table is filled lock-free by any number of search workers.
+ *
+ * Tables are large, so they are not freed after a search: Acquire() hands out
+ * a pooled table and Release() returns it. Instead of wiping the whole table
+ * between searches every slot is tagged with the epoch it was written in, and
+ * slots from older epochs count as empty.
+ */
+class CBirthdayTable
+{
+public:
+    //! Slots per bucket; 16 slots of 8 bytes keep a bucket within 128 bytes
+    static const int BUCKET_BITS = 4;
+    static const int NONCE_BITS = MOMENTUM_NONCE_BITS;
+    static const int BUCKET_INDEX_BITS = NONCE_BITS - BUCKET_BITS;
+    //! Birthday bits not implied by the bucket index
+    static const int KEY_BITS = SEARCH_SPACE_BITS - BUCKET_INDEX_BITS;
+    static const int EPOCH_SHIFT = 56;
+    static const uint64_t SLOT_COUNT = (uint64_t)1 << NONCE_BITS;
+
+    BOOST_STATIC_ASSERT(((uint64_t)1 << NONCE_BITS) == MAX_MOMENTUM_NONCE);
+    BOOST_STATIC_ASSERT(KEY_BITS + NONCE_BITS <= EPOCH_SHIFT);
+
+    /** Start a new search: all slots written before this call become empty. */
+    void NewSearch();
+
+    /**
+     * Insert (birthday, nonce). If an entry with the same birthday is already
+     * present, return its nonce instead; return 0 if there was none or the
+     * bucket is full.
+     */
+    uint32_t checkAdd(uint64_t birthday, uint32_t nonce)
+    {
+        const uint64_t nBucket = birthday >> KEY_BITS;
+        const uint64_t nKey = birthday & (((uint64_t)1 << KEY_BITS) - 1);
+        const uint64_t nEntry = nEpochTag | (nKey << NONCE_BITS) | nonce;
+        boost::atomic<uint64_t>* pbucket = pslots + (nBucket << BUCKET_BITS);
+
+        for (int i = 0; i < (1 << BUCKET_BITS); i++) {
+            uint64_t nSlot = pbucket[i].load(boost::memory_order_relaxed);
+            while ((nSlot & EPOCH_MASK) != nEpochTag) {
+                // Stale slot from an earlier search; claim it
+                if (pbucket[i].compare_exchange_weak(nSlot, nEntry, boost::memory_order_relaxed))
+                    return 0;
+            }
+            if (((nSlot >> NONCE_BITS) & (((uint64_t)1 << KEY_BITS) - 1)) == nKey)
+                return (uint32_t)(nSlot & NONCE_MASK);
+        }
+        return 0;
+    }
+
+    /** Number of slots filled during the current search (scans the table) */
+    uint64_t CountEntries() const;
+
+    /** Memory held by one table, in bytes */
+    static size_t DynamicMemoryUsage() { return SLOT_COUNT * sizeof(uint64_t); }
+
+    /** Take a table from the pool, allocating one if none is free */
+    static CBirthdayTable* Acquire();
+    /** Return a table obtained from Acquire() to the pool */
+    static void Release(CBirthdayTable* ptable);
+
+private:
+    static const uint64_t EPOCH_MASK = (uint64_t)0xff << EPOCH_SHIFT;
+    static const uint64_t NONCE_MASK = ((uint64_t)1 << NONCE_BITS) - 1;
+
+    boost::atomic<uint64_t>* pslots;
+    boost::atomic<uint64_t>* pallocation;
+    uint64_t nEpochTag;
+
+    CBirthdayTable();
+    ~CBirthdayTable();
+    CBirthdayTable(const CBirthdayTable&);
+    CBirthdayTable& operator=(const CBirthdayTable&);
+
+    void Wipe();
+};
+
+#endif // BITCREDIT_BIRTHDAYTABLE_H
@@ -276,6 +276,12 @@ public:
     }
 };
 
+/** Hasher for unordered maps keyed by outpoint, txids are random enough to need no salt */
+struct COutPointHasher
+{
+    size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetLow64() + outpoint.n; }
+};
+
 struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
@@ -0,0 +1,295 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/sha512_batch.h"
+
+#include "crypto/common.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+// Compilers that accept per-function target attributes can build every kernel
+// into the same binary; the one to run is chosen from cpuid at startup.
+#define USE_SHA512_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Internal implementation code.
+namespace
+{
+namespace sha512_batch
+{
+const uint64_t IV[8] = {
+    0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull,
+    0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull};
+
+const uint64_t K[80] = {
+    0x428a2f98d728ae22ull, 0x7137449123ef65cdull, 0xb5c0fbcfec4d3b2full, 0xe9b5dba58189dbbcull,
+    0x3956c25bf348b538ull, 0x59f111f1b605d019ull, 0x923f82a4af194f9bull, 0xab1c5ed5da6d8118ull,
+    0xd807aa98a3030242ull, 0x12835b0145706fbeull, 0x243185be4ee4b28cull, 0x550c7dc3d5ffb4e2ull,
+    0x72be5d74f27b896full, 0x80deb1fe3b1696b1ull, 0x9bdc06a725c71235ull, 0xc19bf174cf692694ull,
+    0xe49b69c19ef14ad2ull, 0xefbe4786384f25e3ull, 0x0fc19dc68b8cd5b5ull, 0x240ca1cc77ac9c65ull,
+    0x2de92c6f592b0275ull, 0x4a7484aa6ea6e483ull, 0x5cb0a9dcbd41fbd4ull, 0x76f988da831153b5ull,
+    0x983e5152ee66dfabull, 0xa831c66d2db43210ull, 0xb00327c898fb213full, 0xbf597fc7beef0ee4ull,
+    0xc6e00bf33da88fc2ull, 0xd5a79147930aa725ull, 0x06ca6351e003826full, 0x142929670a0e6e70ull,
+    0x27b70a8546d22ffcull, 0x2e1b21385c26c926ull, 0x4d2c6dfc5ac42aedull, 0x53380d139d95b3dfull,
+    0x650a73548baf63deull, 0x766a0abb3c77b2a8ull, 0x81c2c92e47edaee6ull, 0x92722c851482353bull,
+    0xa2bfe8a14cf10364ull, 0xa81a664bbc423001ull, 0xc24b8b70d0f89791ull, 0xc76c51a30654be30ull,
+    0xd192e819d6ef5218ull, 0xd69906245565a910ull, 0xf40e35855771202aull, 0x106aa07032bbd1b8ull,
+    0x19a4c116b8d2d0c8ull, 0x1e376c085141ab53ull, 0x2748774cdf8eeb99ull, 0x34b0bcb5e19b48a8ull,
+    0x391c0cb3c5c95a63ull, 0x4ed8aa4ae3418acbull, 0x5b9cca4f7763e373ull, 0x682e6ff3d6b2b8a3ull,
+    0x748f82ee5defb2fcull, 0x78a5636f43172f60ull, 0x84c87814a1f0ab72ull, 0x8cc702081a6439ecull,
+    0x90befffa23631e28ull, 0xa4506cebde82bde9ull, 0xbef9a3f7b2c67915ull, 0xc67178f2e372532bull,
+    0xca273eceea26619cull, 0xd186b8c721c0c207ull, 0xeada7dd6cde0eb1eull, 0xf57d4f7fee6ed178ull,
+    0x06f067aa72176fbaull, 0x0a637dc5a2c898a6ull, 0x113f9804bef90daeull, 0x1b710b35131c471bull,
+    0x28db77f523047d84ull, 0x32caab7b40c72493ull, 0x3c9ebe0a15c9bebcull, 0x431d67c49c100d4cull,
+    0x4cc5d4becb3e42b6ull, 0x597f299cfc657e2aull, 0x5fcb6fab3ad6faecull, 0x6c44198c4a475817ull};
+} // namespace sha512_batch
+
+//! Scalar kernel, one message at a time
+#define SHA512_LANES_FUNC TransformScalar
+#define SHA512_LANES_TARGET
+#define SHA512_LANES 1
+#define V_TYPE uint64_t
+#define V_SET1(x) ((uint64_t)(x))
+#define V_LOADU(p) (*(p))
+#define V_STOREU(p, v) (*(p) = (v))
+#define V_ADD(a, b) ((a) + (b))
+#define V_XOR(a, b) ((a) ^ (b))
+#define V_AND(a, b) ((a) & (b))
+#define V_OR(a, b) ((a) | (b))
+#define V_ANDNOT(a, b) (~(a) & (b))
+#define V_SHR(x, n) ((x) >> (n))
+#define V_ROR(x, n) ((x) >> (n) | (x) << (64 - (n)))
+#include "crypto/sha512_batch_lanes.h"
+#undef SHA512_LANES_FUNC
+#undef SHA512_LANES_TARGET
+#undef SHA512_LANES
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDNOT
+#undef V_SHR
+#undef V_ROR
+
+#ifdef USE_SHA512_BATCH_X86
+//! SSE2 kernel, two messages per 128-bit vector
+#define SHA512_LANES_FUNC TransformSSE2
+#define SHA512_LANES_TARGET __attribute__((target("sse2")))
+#define SHA512_LANES 2
+#define V_TYPE __m128i
+#define V_SET1(x) _mm_set1_epi64x((long long)(x))
+#define V_LOADU(p) _mm_loadu_si128((const __m128i*)(p))
+#define V_STOREU(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define V_ADD(a, b) _mm_add_epi64(a, b)
+#define V_XOR(a, b) _mm_xor_si128(a, b)
+#define V_AND(a, b) _mm_and_si128(a, b)
+#define V_OR(a, b) _mm_or_si128(a, b)
+#define V_ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define V_SHR(x, n) _mm_srli_epi64(x, n)
+#define V_ROR(x, n) _mm_or_si128(_mm_srli_epi64(x, n), _mm_slli_epi64(x, 64 - (n)))
+#include "crypto/sha512_batch_lanes.h"
+#undef SHA512_LANES_FUNC
+#undef SHA512_LANES_TARGET
+#undef SHA512_LANES
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDNOT
+#undef V_SHR
+#undef V_ROR
+
+//! AVX2 kernel, four messages per 256-bit vector
+#define SHA512_LANES_FUNC TransformAVX2
+#define SHA512_LANES_TARGET __attribute__((target("avx2")))
+#define SHA512_LANES 4
+#define V_TYPE __m256i
+#define V_SET1(x) _mm256_set1_epi64x((long long)(x))
+#define V_LOADU(p) _mm256_loadu_si256((const __m256i*)(p))
+#define V_STOREU(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define V_ADD(a, b) _mm256_add_epi64(a, b)
+#define V_XOR(a, b) _mm256_xor_si256(a, b)
+#define V_AND(a, b) _mm256_and_si256(a, b)
+#define V_OR(a, b) _mm256_or_si256(a, b)
+#define V_ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define V_SHR(x, n) _mm256_srli_epi64(x, n)
+#define V_ROR(x, n) _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+#include "crypto/sha512_batch_lanes.h"
+#undef SHA512_LANES_FUNC
+#undef SHA512_LANES_TARGET
+#undef SHA512_LANES
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDNOT
+#undef V_SHR
+#undef V_ROR
+
+//! AVX-512 kernel, eight messages per 512-bit vector, with native rotates
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC's own avx512fintrin.h trips -Wuninitialized on its undefined-vector idiom
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#define SHA512_LANES_FUNC TransformAVX512
+#define SHA512_LANES_TARGET __attribute__((target("avx512f")))
+#define SHA512_LANES 8
+#define V_TYPE __m512i
+#define V_SET1(x) _mm512_set1_epi64((long long)(x))
+#define V_LOADU(p) _mm512_loadu_si512((const void*)(p))
+#define V_STOREU(p, v) _mm512_storeu_si512((void*)(p), v)
+#define V_ADD(a, b) _mm512_add_epi64(a, b)
+#define V_XOR(a, b) _mm512_xor_si512(a, b)
+#define V_AND(a, b) _mm512_and_si512(a, b)
+#define V_OR(a, b) _mm512_or_si512(a, b)
+#define V_ANDNOT(a, b) _mm512_andnot_si512(a, b)
+#define V_SHR(x, n) _mm512_srli_epi64(x, n)
+#define V_ROR(x, n) _mm512_ror_epi64(x, n)
+#include "crypto/sha512_batch_lanes.h"
+#undef SHA512_LANES_FUNC
+#undef SHA512_LANES_TARGET
+#undef SHA512_LANES
+#undef V_TYPE
+#undef V_SET1
+#undef V_LOADU
+#undef V_STOREU
+#undef V_ADD
+#undef V_XOR
+#undef V_AND
+#undef V_OR
+#undef V_ANDNOT
+#undef V_SHR
+#undef V_ROR
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // USE_SHA512_BATCH_X86
+
+typedef void (*TransformLanes)(const uint64_t* pw0, const uint64_t* pwords, uint64_t* pstate);
+
+struct Kernel
+{
+    const char* name;
+    int nLanes;
+    TransformLanes transform;
+};
+
+//! Largest lane count of any kernel
+const int MAX_LANES = 8;
+
+const Kernel kernels[] = {
+    {"scalar", 1, TransformScalar},
+#ifdef USE_SHA512_BATCH_X86
+    {"sse2", 2, TransformSSE2},
+    {"avx2", 4, TransformAVX2},
+    {"avx512", 8, TransformAVX512},
+#endif
+};
+
+bool IsSupported(const Kernel& kernel)
+{
+#ifdef USE_SHA512_BATCH_X86
+    __builtin_cpu_init();
+    if (strcmp(kernel.name, "sse2") == 0)
+        return __builtin_cpu_supports("sse2");
+    if (strcmp(kernel.name, "avx2") == 0)
+        return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel.name, "avx512") == 0)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return strcmp(kernel.name, "scalar") == 0;
+}
+
+const Kernel* SelectWidest()
+{
+    const Kernel* pbest = &kernels[0];
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+        if (IsSupported(kernels[i]) && kernels[i].nLanes > pbest->nLanes)
+            pbest = &kernels[i];
+    return pbest;
+}
+
+const Kernel* pkernel = SelectWidest();
+
+} // namespace
+
+void SHA512NonceBatch(const unsigned char* suffix, uint32_t nNonce, uint32_t nStride, size_t count, unsigned char* out)
+{
+    const Kernel& kernel = *pkernel;
+
+    // Padded single-block message: nonce (4 bytes) || suffix (32) || 0x80 ||
+    // zeros || 128-bit bit length. Only the first word differs between lanes.
+    uint64_t words[16] = {0};
+    uint32_t nSuffixHead = ReadBE32(suffix);
+    words[1] = ReadBE64(suffix + 4);
+    words[2] = ReadBE64(suffix + 12);
+    words[3] = ReadBE64(suffix + 20);
+    words[4] = ((uint64_t)ReadBE32(suffix + 28) << 32) | 0x80000000ull;
+    words[15] = (4 + SHA512_BATCH_SUFFIX_SIZE) * 8;
+
+    uint64_t w0[MAX_LANES];
+    uint64_t state[8 * MAX_LANES];
+    for (size_t nDone = 0; nDone < count; nDone += kernel.nLanes) {
+        int nLanes = count - nDone < (size_t)kernel.nLanes ? count - nDone : kernel.nLanes;
+        for (int i = 0; i < kernel.nLanes; i++) {
+            // The nonce is serialized little-endian, but read back big-endian
+            // as the high half of the first message word.
+            unsigned char vchNonce[4];
+            WriteLE32(vchNonce, nNonce + (uint32_t)(nDone + i) * nStride);
+            w0[i] = ((uint64_t)ReadBE32(vchNonce) << 32) | nSuffixHead;
+        }
+        kernel.transform(w0, words, state);
+        for (int i = 0; i < nLanes; i++)
+            for (int j = 0; j < 8; j++)
+                WriteBE64(out + (nDone + i) * 64 + j * 8, state[j * kernel.nLanes + i]);
+    }
+}
+
+std::string SHA512NonceBatchKernel()
+{
+    return pkernel->name;
+}
+
+std::vector<std::string> SHA512NonceBatchKernels()
+{
+    std::vector<std::string> vNames;
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+        if (IsSupported(kernels[i]))
+            vNames.push_back(kernels[i].name);
+    return vNames;
+}
+
+bool SHA512NonceBatchSelect(const std::string& strKernel)
+{
+    if (strKernel == "auto") {
+        pkernel = SelectWidest();
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strKernel == kernels[i].name) {
+            if (!IsSupported(kernels[i]))
+                return false;
+            pkernel = &kernels[i];
+            return true;
+        }
+    }
+    return false;
+}
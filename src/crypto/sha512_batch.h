@@ -0,0 +1,41 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_CRYPTO_SHA512_BATCH_H
+#define BITCREDIT_CRYPTO_SHA512_BATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+/** Size of the fixed part of a batch message, in bytes */
+static const size_t SHA512_BATCH_SUFFIX_SIZE = 32;
+
+/**
+ * Compute SHA-512 of count 36-byte messages, the i-th being the little-endian
+ * 32-bit value nNonce + i * nStride followed by the 32 bytes at suffix. This is
+ * the Momentum birthday preimage. The 64-byte digests are written one after
+ * another to out.
+ *
+ * Messages are hashed several at a time by a multi-buffer SIMD kernel chosen
+ * at startup from what the CPU supports; results are identical to CSHA512.
+ */
+void SHA512NonceBatch(const unsigned char* suffix, uint32_t nNonce, uint32_t nStride, size_t count, unsigned char* out);
+
+/** Name of the kernel SHA512NonceBatch currently uses */
+std::string SHA512NonceBatchKernel();
+
+/** Names of all kernels usable on this CPU, narrowest first */
+std::vector<std::string> SHA512NonceBatchKernels();
+
+/**
+ * Force SHA512NonceBatch to use the named kernel, or the widest supported one
+ * for "auto". Returns false, leaving the selection unchanged, if the kernel is
+ * unknown or not supported by this CPU. Meant for tests and benchmarks.
+ */
+bool SHA512NonceBatchSelect(const std::string& strKernel);
+
+#endif // BITCREDIT_CRYPTO_SHA512_BATCH_H
@@ -0,0 +1,71 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Multi-buffer SHA-512 compression of a single 128-byte block, written once
+// against a small set of vector operations. This file is included by
+// crypto/sha512_batch.cpp once per instruction set, with these defined:
+//
+//   SHA512_LANES_FUNC    name of the kernel function to define
+//   SHA512_LANES_TARGET  function attributes (e.g. the target ISA), may be empty
+//   SHA512_LANES         number of messages per vector
+//   V_TYPE               vector type holding SHA512_LANES 64-bit words
+//   V_SET1(x), V_LOADU(p), V_STOREU(p, v), V_ADD(a, b), V_XOR(a, b),
+//   V_AND(a, b), V_OR(a, b), V_ANDNOT(a, b) (= ~a & b), V_SHR(x, n), V_ROR(x, n)
+//
+// The kernel takes the per-lane first message word, the 15 remaining message
+// words (identical in every lane) and writes the final state, word-major.
+
+#define V_Ch(x, y, z) V_XOR(z, V_AND(x, V_XOR(y, z)))
+#define V_Maj(x, y, z) V_OR(V_AND(x, y), V_AND(z, V_OR(x, y)))
+#define V_Sigma0(x) V_XOR(V_XOR(V_ROR(x, 28), V_ROR(x, 34)), V_ROR(x, 39))
+#define V_Sigma1(x) V_XOR(V_XOR(V_ROR(x, 14), V_ROR(x, 18)), V_ROR(x, 41))
+#define V_sigma0(x) V_XOR(V_XOR(V_ROR(x, 1), V_ROR(x, 8)), V_SHR(x, 7))
+#define V_sigma1(x) V_XOR(V_XOR(V_ROR(x, 19), V_ROR(x, 61)), V_SHR(x, 6))
+
+SHA512_LANES_TARGET
+static void SHA512_LANES_FUNC(const uint64_t* pw0, const uint64_t* pwords, uint64_t* pstate)
+{
+    V_TYPE w[16];
+    w[0] = V_LOADU(pw0);
+    for (int i = 1; i < 16; i++)
+        w[i] = V_SET1(pwords[i]);
+
+    V_TYPE a = V_SET1(sha512_batch::IV[0]), b = V_SET1(sha512_batch::IV[1]);
+    V_TYPE c = V_SET1(sha512_batch::IV[2]), d = V_SET1(sha512_batch::IV[3]);
+    V_TYPE e = V_SET1(sha512_batch::IV[4]), f = V_SET1(sha512_batch::IV[5]);
+    V_TYPE g = V_SET1(sha512_batch::IV[6]), h = V_SET1(sha512_batch::IV[7]);
+
+    for (int i = 0; i < 80; i++) {
+        if (i >= 16) {
+            w[i & 15] = V_ADD(V_ADD(w[i & 15], V_sigma1(w[(i - 2) & 15])),
+                              V_ADD(w[(i - 7) & 15], V_sigma0(w[(i - 15) & 15])));
+        }
+        V_TYPE t1 = V_ADD(V_ADD(V_ADD(h, V_Sigma1(e)), V_ADD(V_Ch(e, f, g), V_SET1(sha512_batch::K[i]))), w[i & 15]);
+        V_TYPE t2 = V_ADD(V_Sigma0(a), V_Maj(a, b, c));
+        h = g;
+        g = f;
+        f = e;
+        e = V_ADD(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = V_ADD(t1, t2);
+    }
+
+    V_STOREU(pstate + 0 * SHA512_LANES, V_ADD(a, V_SET1(sha512_batch::IV[0])));
+    V_STOREU(pstate + 1 * SHA512_LANES, V_ADD(b, V_SET1(sha512_batch::IV[1])));
+    V_STOREU(pstate + 2 * SHA512_LANES, V_ADD(c, V_SET1(sha512_batch::IV[2])));
+    V_STOREU(pstate + 3 * SHA512_LANES, V_ADD(d, V_SET1(sha512_batch::IV[3])));
+    V_STOREU(pstate + 4 * SHA512_LANES, V_ADD(e, V_SET1(sha512_batch::IV[4])));
+    V_STOREU(pstate + 5 * SHA512_LANES, V_ADD(f, V_SET1(sha512_batch::IV[5])));
+    V_STOREU(pstate + 6 * SHA512_LANES, V_ADD(g, V_SET1(sha512_batch::IV[6])));
+    V_STOREU(pstate + 7 * SHA512_LANES, V_ADD(h, V_SET1(sha512_batch::IV[7])));
+}
+
+#undef V_Ch
+#undef V_Maj
+#undef V_Sigma0
+#undef V_Sigma1
+#undef V_sigma0
+#undef V_sigma1
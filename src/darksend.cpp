@@ -2227,6 +2227,9 @@ void ThreadCheckDarkSendPool()
         darkSendPool.CheckTimeout();
         darkSendPool.CheckForCompleteQueue();
 
+        // entries loaded from mncache.dat are checked a few at a time
+        mnodeman.CheckLoaded(BANKNODES_CHECK_LOADED);
+
         if(c % 60 == 0)
         {
             LOCK(cs_main);
@@ -0,0 +1,148 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iblt.h"
+
+#include "hash.h"
+
+#include <limits>
+#include <string.h>
+
+using namespace std;
+
+bool CIBLT::Cell::IsEmpty() const
+{
+    if (nCount != 0 || nHashSum != 0)
+        return false;
+    for (unsigned int i = 0; i < IBLT_KEY_SIZE; i++)
+        if (keySum[i] != 0)
+            return false;
+    return true;
+}
+
+CIBLT::CIBLT(unsigned int nCells, unsigned int nTweakIn) :
+    vCells(max(1u, (nCells + IBLT_HASH_FUNCS - 1) / IBLT_HASH_FUNCS) * IBLT_HASH_FUNCS),
+    nTweak(nTweakIn)
+{
+}
+
+unsigned int CIBLT::Hash(unsigned int nHashNum, const unsigned char* pKey) const
+{
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vector<unsigned char>(pKey, pKey + IBLT_KEY_SIZE));
+}
+
+bool CIBLT::IsPure(const vector<Cell>& vTable, unsigned int nIndex) const
+{
+    const Cell& cell = vTable[nIndex];
+    if ((cell.nCount != 1 && cell.nCount != -1) || cell.nHashSum != Hash(IBLT_HASH_FUNCS, cell.keySum))
+        return false;
+
+    // The key must also hash to this very cell, otherwise peeling it
+    // wouldn't clear the cell (a forged table or a hash sum collision)
+    unsigned int nSubCells = vTable.size() / IBLT_HASH_FUNCS;
+    unsigned int nHashNum = nIndex / nSubCells;
+    return nIndex == nHashNum * nSubCells + Hash(nHashNum, cell.keySum) % nSubCells;
+}
+
+void CIBLT::update(vector<Cell>& vTable, const unsigned char* pKey, int32_t nDelta) const
+{
+    // Each hash function has its own share of the cells, so a key always
+    // lands in IBLT_HASH_FUNCS different cells
+    unsigned int nSubCells = vTable.size() / IBLT_HASH_FUNCS;
+    uint32_t nHashSum = Hash(IBLT_HASH_FUNCS, pKey);
+    for (unsigned int i = 0; i < IBLT_HASH_FUNCS; i++) {
+        Cell& cell = vTable[i * nSubCells + Hash(i, pKey) % nSubCells];
+        cell.nCount += nDelta;
+        for (unsigned int j = 0; j < IBLT_KEY_SIZE; j++)
+            cell.keySum[j] ^= pKey[j];
+        cell.nHashSum ^= nHashSum;
+    }
+}
+
+void CIBLT::insert(const unsigned char* pKey)
+{
+    update(vCells, pKey, 1);
+}
+
+void CIBLT::erase(const unsigned char* pKey)
+{
+    update(vCells, pKey, -1);
+}
+
+bool CIBLT::subtract(const CIBLT& other)
+{
+    if (other.vCells.size() != vCells.size() || other.nTweak != nTweak)
+        return false;
+
+    // A forged table may hold any count, check for overflow before changing anything
+    for (unsigned int i = 0; i < vCells.size(); i++) {
+        int64_t nCount = (int64_t)vCells[i].nCount - other.vCells[i].nCount;
+        if (nCount < numeric_limits<int32_t>::min() || nCount > numeric_limits<int32_t>::max())
+            return false;
+    }
+
+    for (unsigned int i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        for (unsigned int j = 0; j < IBLT_KEY_SIZE; j++)
+            vCells[i].keySum[j] ^= other.vCells[i].keySum[j];
+        vCells[i].nHashSum ^= other.vCells[i].nHashSum;
+    }
+    return true;
+}
+
+bool CIBLT::list(vector<vector<unsigned char> >& vPositive, vector<vector<unsigned char> >& vNegative) const
+{
+    vPositive.clear();
+    vNegative.clear();
+    if (vCells.empty())
+        return true;
+    if (vCells.size() % IBLT_HASH_FUNCS != 0)
+        return false;
+
+    // No more keys can be listed than there are cells, so a larger count
+    // means the table can't be listed anyway. Refusing it up front also
+    // keeps the counts from overflowing while peeling
+    int64_t nMaxCount = vCells.size();
+    for (unsigned int i = 0; i < vCells.size(); i++)
+        if (vCells[i].nCount > nMaxCount || vCells[i].nCount < -nMaxCount)
+            return false;
+
+    // Peel off pure cells (holding a single key) until none are left;
+    // removing a key from its other cells may make those pure in turn.
+    // Every peel empties a cell of an honest table, so more peels than
+    // cells means the table is inconsistent
+    vector<Cell> vTable(vCells);
+    unsigned int nPeels = 0;
+    bool fPeeled = true;
+    while (fPeeled) {
+        fPeeled = false;
+        for (unsigned int i = 0; i < vTable.size(); i++) {
+            if (!IsPure(vTable, i))
+                continue;
+            if (++nPeels > vTable.size())
+                return false;
+
+            vector<unsigned char> vKey(vTable[i].keySum, vTable[i].keySum + IBLT_KEY_SIZE);
+            int32_t nCount = vTable[i].nCount;
+            if (nCount > 0)
+                vPositive.push_back(vKey);
+            else
+                vNegative.push_back(vKey);
+            update(vTable, &vKey[0], -nCount);
+            fPeeled = true;
+        }
+    }
+
+    for (unsigned int i = 0; i < vTable.size(); i++)
+        if (!vTable[i].IsEmpty())
+            return false;
+    return true;
+}
+
+bool CIBLT::IsWithinSizeConstraints(unsigned int nMaxCells) const
+{
+    return !vCells.empty()
+        && vCells.size() <= nMaxCells
+        && vCells.size() % IBLT_HASH_FUNCS == 0;
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_IBLT_H
+#define BITCREDIT_IBLT_H
+
+#include "serialize.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+//! Size of the keys stored, a secure message token (timestamp and sample)
+static const unsigned int IBLT_KEY_SIZE = 16;
+//! Cells each key is added to
+static const unsigned int IBLT_HASH_FUNCS = 3;
+//! Serialized size of a cell
+static const unsigned int IBLT_CELL_SIZE = 4 + IBLT_KEY_SIZE + 4;
+
+/**
+ * Invertible Bloom lookup table of fixed size keys, as described in
+ * Eppstein et al. "What's the Difference? Efficient Set Reconciliation
+ * without Prior Context".
+ *
+ * Two parties each insert their set into a table of the same size and
+ * tweak. Subtracting one table from the other cancels out the keys both
+ * have, and the keys that are left (the symmetric difference) can be listed
+ * as long as there are not many more of them than half the number of cells,
+ * whatever the size of the sets themselves.
+ */
+class CIBLT
+{
+public:
+    class Cell
+    {
+    public:
+        int32_t nCount;
+        unsigned char keySum[IBLT_KEY_SIZE];
+        uint32_t nHashSum;
+
+        Cell() : nCount(0), nHashSum(0) { memset(keySum, 0, sizeof(keySum)); }
+
+        bool IsEmpty() const;
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+            READWRITE(nCount);
+            READWRITE(FLATDATA(keySum));
+            READWRITE(nHashSum);
+        }
+    };
+
+    CIBLT() : nTweak(0) {}
+    /** nCells is rounded up to a multiple of IBLT_HASH_FUNCS */
+    CIBLT(unsigned int nCells, unsigned int nTweakIn);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vCells);
+        READWRITE(nTweak);
+    }
+
+    void insert(const unsigned char* pKey);
+    void erase(const unsigned char* pKey);
+
+    /** Subtract the keys of other, which must have the same size and tweak */
+    bool subtract(const CIBLT& other);
+
+    /**
+     * List the keys left: vPositive were inserted more often than erased
+     * (or subtracted), vNegative the other way round. Returns false if the
+     * table holds too many keys to list them all.
+     */
+    bool list(std::vector<std::vector<unsigned char> >& vPositive, std::vector<std::vector<unsigned char> >& vNegative) const;
+
+    unsigned int size() const { return vCells.size(); }
+    unsigned int GetTweak() const { return nTweak; }
+
+    //! False for a deserialized table that is empty, too large or of a size no table is created with
+    bool IsWithinSizeConstraints(unsigned int nMaxCells) const;
+
+private:
+    std::vector<Cell> vCells;
+    unsigned int nTweak;
+
+    unsigned int Hash(unsigned int nHashNum, const unsigned char* pKey) const;
+    bool IsPure(const std::vector<Cell>& vTable, unsigned int nIndex) const;
+    void update(std::vector<Cell>& vTable, const unsigned char* pKey, int32_t nDelta) const;
+};
+
+#endif // BITCREDIT_IBLT_H
@@ -11,6 +11,7 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "bidtracker.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "key.h"
@@ -23,6 +24,8 @@
 #include "ui_interface.h"
 #include "util.h"
 #include "activebanknode.h"
+#include "banknode-collateral.h"
+#include "banknode-sigqueue.h"
 #include "banknodeman.h"
 #include "banknodeconfig.h"
 #include "spork.h"
@@ -33,6 +36,7 @@
 #include "walletdb.h"
 #include "keepass.h"
 #include "smessage.h"
+#include "stratum.h"
 #endif
 
 #include <stdint.h>
@@ -138,6 +142,7 @@ void Shutdown()
     SecureMsgDisable();
     StopRPCThreads();
 #ifdef ENABLE_WALLET
+    StopStratumServer();
     if (pwalletMain)
         bitdb.Flush(false);
     GenerateBitcredits(false, NULL, 0);
@@ -326,7 +331,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -debug=<category>      " + strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, miner, net, stratum"; // Don't translate these and qt below
     if (mode == HMM_BITCREDIT_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -367,6 +372,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -banknodeprivkey=<n>     " + _("Set the banknode private key") + "\n";
     strUsage += "  -banknodeaddr=<n>        " + _("Set external address:port to get to this banknode (example: address:port)") + "\n";
     strUsage += "  -banknodeminprotocol=<n> " + _("Ignore banknodes less than version (example: 70007; default : 0)") + "\n";
+    strUsage += "  -mnsigthreads=<n>        " + strprintf(_("Set the number of threads verifying banknode message signatures (0 = auto, max: %u)"), BANKNODE_SIGQUEUE_MAX_THREADS) + "\n";
 
     strUsage += "\n" + _("Darksend options:") + "\n";
     strUsage += "  -enabledarksend=<n>          " + _("Enable use of automated darksend for funds stored in this wallet (0-1, default: 0)") + "\n";
@@ -382,6 +388,15 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -blockminsize=<n>      " + strprintf(_("Set minimum block size in bytes (default: %u)"), 0) + "\n";
     strUsage += "  -blockmaxsize=<n>      " + strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE) + "\n";
     strUsage += "  -blockprioritysize=<n> " + strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE) + "\n";
+    strUsage += "  -bidtracker=<file>     " + strprintf(_("Pay the bids listed in <file> in the coinbase of every 400th block, reloaded when it changes (default: %s)"), "bidtracker.txt") + "\n";
+
+#ifdef ENABLE_WALLET
+    strUsage += "\n" + _("Mining server options:") + "\n";
+    strUsage += "  -stratum               " + strprintf(_("Push work to external miners over persistent connections (default: %u)"), 0) + "\n";
+    strUsage += "  -stratumbind=<addr>    " + _("Bind to given address to listen for mining server connections (default: 127.0.0.1)") + "\n";
+    strUsage += "  -stratumport=<port>    " + strprintf(_("Listen for mining server connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT) + "\n";
+    strUsage += "                         " + _("Connections are restricted like JSON-RPC connections, see -rpcallowip") + "\n";
+#endif
 
     strUsage += "\n" + _("RPC server options:") + "\n";
     strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
@@ -402,7 +417,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "\n" + _("Secure messaging options:") + "\n";
     strUsage += "  -nosmsg                                  " + _("Disable secure messaging.") + "\n";
     strUsage += "  -debugsmsg                               " + _("Log extra debug messages.") + "\n";
-    strUsage += "  -smsgscanchain                           " + _("Scan the block chain for public key addresses on startup.") + "\n";
+    strUsage += "  -smsgscanchain                           " + _("Scan the block chain for public key addresses on startup, continuing from the last block scanned.") + "\n";
+    strUsage += "  -smsgreconcile                           " + _("Sync secure message buckets by set reconciliation with peers that support it (default: 1)") + "\n";
+    strUsage += "  -smsgrequirestamp                        " + _("Only relay secure messages carrying a valid proof of work stamp (default: 0)") + "\n";
+    strUsage += "  -smsgpeerrate=<n>                        " + _("Accept at most <n> secure messages per minute from each peer, 0 for no limit (default: 0)") + "\n";
+    strUsage += "  -smsgscanthreads=<n>                     " + strprintf(_("Set the number of threads trial decrypting incoming messages and scanning the block chain (0 = auto, max: %u)"), SMSG_MAX_SCAN_THREADS) + "\n";
 
 
     return strUsage;
@@ -839,6 +858,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
     }
 
     /* Start the RPC server already.  It will be started in "warmup" mode
@@ -1367,6 +1388,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif // !ENABLE_WALLET
     // ********************************************************* Step 9: import blocks
 
+    // keep the state of banknode collaterals current from here on
+    RegisterValidationInterface(&mncollateral);
+
     if (mapArgs.count("-blocknotify"))
         uiInterface.NotifyBlockTip.connect(BlockNotifyCallback);
 
@@ -1505,6 +1529,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     darkSendPool.InitCollateralAddress();
 
     threadGroup.create_thread(boost::bind(&ThreadCheckDarkSendPool));
+    mnsigqueue.Start(threadGroup, GetArg("-mnsigthreads", 0));
 
   //  SecureMsgStart(fNoSmsg, GetBoolArg("-smsgscanchain", false));
 
@@ -1527,10 +1552,19 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    // Parse the bid file once, then only reload it when it changes on disk
+    bidtracker.Init(GetArg("-bidtracker", "bidtracker.txt"));
+    threadGroup.create_thread(boost::bind(&LoopForever<void (*)()>, "bidtracker", &RefreshBidTracker, BIDTRACKER_REFRESH_INTERVAL * 1000));
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (pwalletMain)
         GenerateBitcredits(GetBoolArg("-gen", false), pwalletMain, GetArg("-genproclimit", 1));
+
+    // Push work to external miners
+    std::string strStratumError;
+    if (!StartStratumServer(pwalletMain, strStratumError))
+        return InitError(strStratumError);
 #endif
 
     // ********************************************************* Step 11: finished
@@ -11,6 +11,7 @@
 #include "instantx.h"
 #include "activebanknode.h"
 #include "banknodeman.h"
+#include "banknode-sigqueue.h"
 #include "darksend.h"
 #include "spork.h"
 #include <boost/lexical_cast.hpp>
@@ -123,6 +124,7 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
     }
     else if (strCommand == "txlvote") //InstantX Lock Consensus Votes
     {
+        CDataStream vMsg(vRecv.begin(), vRecv.end(), vRecv.GetType(), vRecv.GetVersion());
         CConsensusVote ctx;
         vRecv >> ctx;
 
@@ -133,6 +135,12 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
             return;
         }
 
+        // the vote is only recorded once the signature queue handed it back
+        CBanknode* pmn = mnodeman.Find(ctx.vinBanknode);
+        if(pmn != NULL && mnsigqueue.Defer(pfrom, strCommand, vMsg, pmn->pubkey2, ctx.vchBankNodeSignature, ctx.GetSignatureMessage())){
+            return;
+        }
+
         mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
 
         if(ProcessConsensusVote(ctx)){
@@ -497,10 +505,14 @@ uint256 CConsensusVote::GetHash() const
 }
 
 
+std::string CConsensusVote::GetSignatureMessage() const
+{
+    return txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+}
+
 bool CConsensusVote::SignatureValid()
 {
-    std::string errorMessage;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+    std::string strMessage = GetSignatureMessage();
     //LogPrintf("verify strMessage %s \n", strMessage.c_str());
 
     CBanknode* pmn = mnodeman.Find(vinBanknode);
@@ -522,7 +534,7 @@ bool CConsensusVote::SignatureValid()
     CBitcreditAddress address2(address1);
     //LogPrintf("verify pubkey2 %s \n", address2.ToString().c_str());
 
-    if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchBankNodeSignature, strMessage, errorMessage)) {
+    if(!mnsigqueue.Verify(pmn->pubkey2, vchBankNodeSignature, strMessage)) {
         LogPrintf("InstantX::CConsensusVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -536,7 +548,7 @@ bool CConsensusVote::Sign()
 
     CKey key2;
     CPubKey pubkey2;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+    std::string strMessage = GetSignatureMessage();
     //LogPrintf("signing strMessage %s \n", strMessage.c_str());
     //LogPrintf("signing privkey %s \n", strBankNodePrivKey.c_str());
 
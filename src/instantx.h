@@ -59,6 +59,7 @@ public:
     std::vector<unsigned char> vchBankNodeSignature;
 
     uint256 GetHash() const;
+    std::string GetSignatureMessage() const;
 
     bool SignatureValid();
     bool Sign();
@@ -15,6 +15,7 @@
 #include "instantx.h"
 #include "darksend.h"
 #include "banknodeman.h"
+#include "banknode-sigqueue.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
@@ -1868,6 +1869,40 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(128);
+
+void ThreadHeaderCheck() {
+    RenameThread("bitcredit-headerch");
+    headercheckqueue.Thread();
+}
+
+bool CHeaderPoWCheck::operator()() {
+    return CheckProofOfWork(pheader->GetHash(), pheader->nBits);
+}
+
+/**
+ * Check the proof of work of every header in a headers message. With
+ * verification threads the headers are spread over them, otherwise they are
+ * checked in order on the calling thread. Does not need cs_main.
+ */
+static bool CheckHeadersPoW(const std::vector<CBlockHeader>& headers)
+{
+    if (!nScriptCheckThreads) {
+        BOOST_FOREACH(const CBlockHeader& header, headers)
+            if (!CheckProofOfWork(header.GetHash(), header.nBits))
+                return false;
+        return true;
+    }
+
+    std::vector<CHeaderPoWCheck> vChecks;
+    vChecks.reserve(headers.size());
+    BOOST_FOREACH(const CBlockHeader& header, headers)
+        vChecks.push_back(CHeaderPoWCheck(header));
+    CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1900,7 +1935,7 @@ void static BuildAddrIndex(const CScript &script, const CExtDiskTxPos &pos, std:
     }
 }
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fCheckScripts)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
@@ -1917,7 +1952,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         view.SetBestBlock(Params().HashGenesisBlock());
         return true;
     }
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = fCheckScripts && pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -3042,7 +3077,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3059,7 +3094,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -3172,7 +3207,7 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
     return true;
 }
 
-bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex * const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
+bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex * const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckScripts)
 {
     AssertLockHeld(cs_main);
     assert(pindexPrev == chainActive.Tip());
@@ -3189,7 +3224,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
         return false;
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return false;
-    if (!ConnectBlock(block, state, &indexDummy, viewNew, true))
+    if (!ConnectBlock(block, state, &indexDummy, viewNew, true, fCheckScripts))
         return false;
     assert(state.IsValid());
 
@@ -4466,6 +4501,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Proof of work is context-free, so check the whole batch up front
+        // and off cs_main; AcceptBlockHeader below then skips it.
+        bool fPoWValid = CheckHeadersPoW(headers);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4473,6 +4512,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        if (!fPoWValid) {
+            Misbehaving(pfrom->GetId(), 50);
+            return error("invalid header received: proof of work failed");
+        }
+
         CBlockIndex *pindexLast = NULL;
         BOOST_FOREACH(const CBlockHeader& header, headers) {
             CValidationState state;
@@ -4480,7 +4524,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, false)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -4786,6 +4830,9 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    // banknode messages whose signatures were verified meanwhile
+    mnsigqueue.ProcessReady(pfrom);
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
@@ -7,13 +7,16 @@
 #include "activebanknode.h"
 #include "amount.h"
 #include "base58.h"
+#include "bidtracker.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "hash.h"
 #include "main.h"
+#include "momentum.h"
 #include "net.h"
 #include "pow.h"
 #include "timedata.h"
+#include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #ifdef ENABLE_WALLET
@@ -25,8 +28,6 @@
 
 #include <map>
 #include <iostream>
-#include <fstream>
-#include <boost/algorithm/string.hpp>
 #include <sys/stat.h>
 #include <stdio.h>
 
@@ -48,12 +49,12 @@ using namespace std;
 class COrphan
 {
 public:
-    const CTransaction* ptx;
+    CTxMemPoolEntry* pentry;
     set<uint256> setDependsOn;
     CFeeRate feeRate;
     double dPriority;
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    COrphan(CTxMemPoolEntry* pentryIn) : pentry(pentryIn), feeRate(0), dPriority(0)
     {
     }
 };
@@ -62,7 +63,7 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, CTxMemPoolEntry*> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -102,24 +103,6 @@ int static FormatHashBlocks(void* pbuffer, unsigned int len)
     return blocks;
 }
 
-std::map<std::string,int64_t> getbidtracker(){
-	std::map<std::string,int64_t> bidtracker;
-	
-	ifstream myfile ("bidtracker.txt");
-	char * pEnd;
-	std::string line;
-	if (myfile.is_open()){
-		while ( myfile.good() ){
-			getline (myfile,line);
-			std::vector<std::string> strs;
-			boost::split(strs, line, boost::is_any_of(","));
-			bidtracker[strs[0]]=strtoll(strs[1].c_str(),&pEnd,10);
-		}
-		myfile.close();
-	}	
-	return bidtracker;
-}
-
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
@@ -142,6 +125,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     if (Params().MineBlocksOnDemand())
         pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 	int payments = 0;
+
+    // Bids paid out in the coinbase of every 400th block; one snapshot so
+    // all outputs below agree even if the file is reloaded meanwhile
+    std::map<std::string,int64_t> mapBids = bidtracker.GetBids();
 	
 	// start banknode payments
     bool bBankNodePayment = false;
@@ -166,8 +153,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     else if (chainActive.Tip()->nHeight>199999 ){
 		
 			if (chainActive.Tip()->nHeight%400==0){
-				std::map<std::string,int64_t> bidtracker = getbidtracker();
-				txNew.vout.resize(bidtracker.size()+1);				
+				txNew.vout.resize(mapBids.size()+1);				
 			}
 			else {			
 				txNew.vout.resize(1);
@@ -200,12 +186,11 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 		
 			if (chainActive.Tip()->nHeight%400==0){
 
-				std::map<std::string,int64_t> bidtracker = getbidtracker();
 				std::map<std::string,int64_t>::iterator balit;
 				int i=1;
 				int64_t total=0;
 				
-				for( balit = bidtracker.begin(); balit != bidtracker.end();++balit)
+				for( balit = mapBids.begin(); balit != mapBids.end();++balit)
 				{
 					CBitcreditAddress address(balit->first);
 					txNew.vout[i].scriptPubKey= GetScriptForDestination( address.Get() );
@@ -235,9 +220,8 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                 payments++;
                 if (chainActive.Tip()->nHeight>149999 ){
 					if (chainActive.Tip()->nHeight%400==0){
-						std::map<std::string,int64_t> bidtracker = getbidtracker();
-						txNew.vout.resize(bidtracker.size()+ payments+1);
-						txNew.vout[bidtracker.size()+ payments].scriptPubKey = pblock->payee;								
+						txNew.vout.resize(mapBids.size()+ payments+1);
+						txNew.vout[mapBids.size()+ payments].scriptPubKey = pblock->payee;								
 					}				
 					else{
 						txNew.vout.resize(1+ payments);
@@ -267,7 +251,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         CBlockIndex* pindexPrev = chainActive.Tip();
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
-        
+
         UpdateTime(pblock, pindexPrev);
 		uint64_t nBlockTime = pblock->GetBlockTime();
 
@@ -300,67 +284,39 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         // This vector will be sorted into a priority queue:
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size());
+        // Fee, size and priority were worked out when each transaction entered
+        // the pool, so this pass needs no coins lookups: it only finds the
+        // in-pool parents a transaction has to wait for.
         for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
              mi != mempool.mapTx.end(); ++mi)
         {
-            const CTransaction& tx = mi->second.GetTx();
+            CTxMemPoolEntry& entry = mi->second;
+            const CTransaction& tx = entry.GetTx();
             if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
                 continue;
 
             COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
+                if (!mempool.mapTx.count(txin.prevout.hash))
                     continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
 
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
+                // Has to wait for dependencies
+                if (!porphan)
+                {
+                    // Use list for automatic deletion
+                    vOrphan.push_back(COrphan(&entry));
+                    porphan = &vOrphan.back();
+                }
+                mapDependers[txin.prevout.hash].push_back(porphan);
+                porphan->setDependsOn.insert(txin.prevout.hash);
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+            double dPriority = entry.GetPriority(nHeight);
+            CAmount nFee = entry.GetFee();
+            mempool.ApplyDeltas(mi->first, dPriority, nFee);
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+            CFeeRate feeRate(nFee, entry.GetTxSize());
 
             if (porphan)
             {
@@ -368,7 +324,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                 porphan->feeRate = feeRate;
             }
             else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+                vecPriority.push_back(TxPriority(dPriority, feeRate, &entry));
         }
 
         // Collect transactions into block
@@ -385,18 +341,21 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             // Take highest priority transaction off the priority queue:
             double dPriority = vecPriority.front().get<0>();
             CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
+            CTxMemPoolEntry& entry = *(vecPriority.front().get<2>());
+            const CTransaction& tx = entry.GetTx();
 
             std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
             vecPriority.pop_back();
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            unsigned int nTxSize = entry.GetTxSize();
             if (nBlockSize + nTxSize >= nBlockMaxSize)
                 continue;
 
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+            // Legacy limits on sigOps (all of them, if an earlier template
+            // already counted the P2SH ones):
+            bool fScriptChecked = entry.IsScriptChecked();
+            unsigned int nTxSigOps = fScriptChecked ? entry.GetSigOpsChecked() : GetLegacySigOpCount(tx);
             if (nBlockSigOps + nTxSigOps >= MaxBlockSigops(nBlockTime))
                 continue;
 
@@ -422,17 +381,21 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                 continue;
 
             CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
-			
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MaxBlockSigops(nBlockTime))
-                continue;
+
+            if (!fScriptChecked) {
+                nTxSigOps += GetP2SHSigOpCount(tx, view);
+                if (nBlockSigOps + nTxSigOps >= MaxBlockSigops(nBlockTime))
+                    continue;
+            }
 
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
+            // Scripts verified for an earlier template are not run again.
             CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+            if (!CheckInputs(tx, state, view, !fScriptChecked, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
                 continue;
+            entry.SetScriptChecked(nTxSigOps);
 
             CTxUndo txundo;
             UpdateCoins(tx, state, view, txundo, nHeight);
@@ -462,7 +425,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
                         porphan->setDependsOn.erase(hash);
                         if (porphan->setDependsOn.empty())
                         {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
+                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->pentry));
                             std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
                         }
                     }
@@ -501,11 +464,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 		}
         else if (chainActive.Tip()->nHeight>199999 ){
 					if (chainActive.Tip()->nHeight%400==0){
-						std::map<std::string,int64_t> bidtracker = getbidtracker();
 						std::map<std::string,int64_t>::iterator balit;
 						int i=1;
 				
-						for( balit = bidtracker.begin(); balit != bidtracker.end();++balit)
+						for( balit = mapBids.begin(); balit != mapBids.end();++balit)
 						{
 							txNew.vout[i].nValue = balit->second;
 							blockValue -= balit->second;
@@ -514,7 +476,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 						
 					if(payments > 0){	
 					 
-						txNew.vout[bidtracker.size()+ payments].nValue = banknodePayment;
+						txNew.vout[mapBids.size()+ payments].nValue = banknodePayment;
 						blockValue -= banknodePayment;			           
 					}
 					txNew.vout[0].nValue = blockValue;			
@@ -540,8 +502,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->nNonce         = 0;
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+        // The scripts of every transaction were verified above, or for an
+        // earlier template, with at least the flags ConnectBlock uses
         CValidationState state;
-        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
+        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false, false))
             throw std::runtime_error("CreateNewBlock() : TestBlockValidity failed");
     }
 
@@ -575,6 +539,82 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 double dHashesPerMin = 0.0;
 int64_t nHPSTimerStart = 0;
 
+static CCriticalSection cs_minerstats;
+static CMinerStats minerstats;
+//! When the tip last changed, to measure how long a search ran on the old tip
+static int64_t nMinerTipChangeMicros = 0;
+
+CMinerStats::CMinerStats() :
+    nSearches(0), nSearchesAborted(0), nBlocksFound(0),
+    nBirthdays(0), nCollisions(0), nSearchMicros(0),
+    dBirthdaysPerSec(0), dSha512PerSec(0),
+    nTemplates(0), nTemplateMicros(0), nLastTemplateMicros(0),
+    nStaleEvents(0), nStaleMicros(0), nLastStaleMicros(0)
+{
+}
+
+double CMinerStats::CollisionsPerMidHash() const
+{
+    if (nBirthdays == 0)
+        return 0;
+    return (double)nCollisions * MAX_MOMENTUM_NONCE / nBirthdays;
+}
+
+CMinerStats GetMinerStats()
+{
+    LOCK(cs_minerstats);
+    return minerstats;
+}
+
+static void MinerBlockTip(const uint256& hash)
+{
+    LOCK(cs_minerstats);
+    nMinerTipChangeMicros = GetTimeMicros();
+}
+
+static void RecordMinerTemplate(int64_t nMicros)
+{
+    LOCK(cs_minerstats);
+    minerstats.nTemplates++;
+    minerstats.nTemplateMicros += nMicros;
+    minerstats.nLastTemplateMicros = nMicros;
+}
+
+/**
+ * Account one birthday search. nTemplateStart is when the template being
+ * searched was started; if the tip changed after that, the search ran stale
+ * from the tip change until it returned.
+ */
+static void RecordMinerSearch(const bts::momentum_search_stats& stats, int64_t nMicros, bool fFound, bool fTipChanged, int64_t nTemplateStart)
+{
+    int64_t nNow = GetTimeMicros();
+    LOCK(cs_minerstats);
+    minerstats.nSearches++;
+    if (fFound)
+        minerstats.nBlocksFound++;
+    else if (stats.nBirthdays < MAX_MOMENTUM_NONCE)
+        minerstats.nSearchesAborted++;
+    minerstats.nBirthdays += stats.nBirthdays;
+    minerstats.nCollisions += stats.nCollisions;
+    minerstats.nSearchMicros += nMicros;
+
+    minerstats.dBirthdaysPerSec = nMicros > 0 ? stats.nBirthdays * 1000000.0 / nMicros : 0;
+    minerstats.dSha512PerSec = minerstats.dBirthdaysPerSec / BIRTHDAYS_PER_HASH;
+    minerstats.vThreadBirthdaysPerSec.clear();
+    BOOST_FOREACH(const bts::momentum_worker_stats& worker, stats.vWorkers)
+        minerstats.vThreadBirthdaysPerSec.push_back(worker.nMicros > 0 ? worker.nBirthdays * 1000000.0 / worker.nMicros : 0);
+
+    if (fTipChanged && nMinerTipChangeMicros > nTemplateStart) {
+        minerstats.nStaleEvents++;
+        minerstats.nLastStaleMicros = nNow - nMinerTipChangeMicros;
+        minerstats.nStaleMicros += minerstats.nLastStaleMicros;
+    }
+
+    // Full-search equivalents per minute, as reported by gethashespermin
+    dHashesPerMin = minerstats.dBirthdaysPerSec * 60 / MAX_MOMENTUM_NONCE;
+    nHPSTimerStart = GetTimeMillis();
+}
+
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
 // The nonce is usually preserved between calls, but periodically or if the
@@ -695,7 +735,19 @@ bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     return true;
 }
 
-void static BitcreditMiner(CWallet *pwallet)
+/**
+ * Polled during a birthday search: true once the block being searched is
+ * outdated, i.e. the tip moved or the mempool changed and the template is
+ * old enough that the main loop would rebuild it.
+ */
+static bool MinerTemplateStale(CBlockIndex* pindexPrev, unsigned int nTransactionsUpdatedLast, int64_t nStart)
+{
+    if (pindexPrev != chainActive.Tip())
+        return true;
+    return mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60;
+}
+
+void static BitcreditMiner(CWallet *pwallet, int nSearchThreads)
 {
     LogPrintf("BitcreditMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
@@ -717,6 +769,7 @@ void static BitcreditMiner(CWallet *pwallet)
             //
             // Create new block
             //
+            int64_t nTemplateStart = GetTimeMicros();
             unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
             CBlockIndex* pindexPrev = chainActive.Tip();
 
@@ -728,6 +781,7 @@ void static BitcreditMiner(CWallet *pwallet)
             }
             CBlock *pblock = &pblocktemplate->block;
             IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+            RecordMinerTemplate(GetTimeMicros() - nTemplateStart);
 
             LogPrintf("Running BitcreditMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -740,19 +794,23 @@ void static BitcreditMiner(CWallet *pwallet)
             uint256 testHash;
         for (;;)
         {
-            unsigned int nHashesDone = 0;
             unsigned int nNonceFound = (unsigned int) -1;
 
         for(int i=0;i<1;i++){
             pblock->nNonce=pblock->nNonce+1;
-            testHash=pblock->CalculateBestBirthdayHash();
-            nHashesDone++;
-            printf("testHash %s\n", testHash.ToString().c_str());
-            printf("Hash Target %s\n", hashTarget.ToString().c_str());
-
-            if(testHash<hashTarget){
+            bts::momentum_search_stats stats;
+            int64_t nSearchStart = GetTimeMicros();
+            bool fFound = pblock->SearchBirthdayHash(hashTarget, nSearchThreads,
+                boost::bind(&MinerTemplateStale, pindexPrev, nTransactionsUpdatedLast, nStart), &stats);
+            int64_t nSearchMicros = GetTimeMicros() - nSearchStart;
+            RecordMinerSearch(stats, nSearchMicros, fFound, pindexPrev != chainActive.Tip(), nTemplateStart);
+            LogPrint("miner", "BitcreditMiner : nonce %u, %u birthdays in %dms, %u collisions\n",
+                pblock->nNonce, stats.nBirthdays, nSearchMicros / 1000, stats.nCollisions);
+
+            if(fFound){
+                testHash=pblock->GetHash();
                 nNonceFound=pblock->nNonce;
-                printf("Found Hash %s\n", testHash.ToString().c_str());
+                LogPrint("miner", "BitcreditMiner : found hash %s\n", testHash.ToString());
                 break;
             }
         }
@@ -763,9 +821,6 @@ void static BitcreditMiner(CWallet *pwallet)
                 if (testHash <= hashTarget)
                 {
                     // Found a solution
-
-                    printf("hash %s\n", testHash.ToString().c_str());
-                    printf("hash2 %s\n", pblock->GetHash().ToString().c_str());
                     assert(testHash == pblock->GetHash());
 
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
@@ -775,35 +830,6 @@ void static BitcreditMiner(CWallet *pwallet)
                 }
             }
 
-                // Meter hashes/sec
-                static int64_t nHashCounter;
-                if (nHPSTimerStart == 0)
-                {
-                    nHPSTimerStart = GetTimeMillis();
-                    nHashCounter = 0;
-                }
-                else
-                    nHashCounter += nHashesDone;
-                if (GetTimeMillis() - nHPSTimerStart > 4000*60)
-                {
-                    static CCriticalSection cs;
-                    {
-                        LOCK(cs);
-                        if (GetTimeMillis() - nHPSTimerStart > 4000*60)
-                        {
-                            dHashesPerMin = 1000.0 * nHashCounter *60 / (GetTimeMillis() - nHPSTimerStart);
-                            nHPSTimerStart = GetTimeMillis();
-                            nHashCounter = 0;
-                            static int64_t nLogTime;
-                            if (GetTime() - nLogTime > 30 * 60)
-                            {
-                                nLogTime = GetTime();
-                                LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerMin/1000.0);
-                            }
-                        }
-                    }
-                }
-
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
                 // Regtest mode doesn't require peers
@@ -855,9 +881,16 @@ void GenerateBitcredits(bool fGenerate, CWallet* pwallet, int nThreads)
     if (nThreads == 0 || !fGenerate)
         return;
 
+    static bool fTipConnected = false;
+    if (!fTipConnected) {
+        uiInterface.NotifyBlockTip.connect(&MinerBlockTip);
+        fTipConnected = true;
+    }
+
+    // A single miner thread drives the Momentum search; the nonce space of
+    // every midHash is split across nThreads workers sharing one table.
     minerThreads = new boost::thread_group();
-    for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcreditMiner, pwallet));
+    minerThreads->create_thread(boost::bind(&BitcreditMiner, pwallet, nThreads));
 }
 
 #endif // ENABLE_WALLET
@@ -7,6 +7,7 @@
 #define BITCREDIT_MINER_H
 
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -31,4 +32,37 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
 extern double dHashesPerMin;
 extern int64_t nHPSTimerStart;
 
+/** Telemetry of the internal miner, updated after every birthday search */
+struct CMinerStats
+{
+    //! Searches run, and how many of them were abandoned as stale
+    uint64_t nSearches;
+    uint64_t nSearchesAborted;
+    uint64_t nBlocksFound;
+    //! Totals over all searches
+    uint64_t nBirthdays;
+    uint64_t nCollisions;
+    int64_t nSearchMicros;
+    //! Rates of the most recent search; one birthday is one table insert
+    double dBirthdaysPerSec;
+    double dSha512PerSec;
+    std::vector<double> vThreadBirthdaysPerSec;
+    //! Templates built, and time spent building them
+    uint64_t nTemplates;
+    int64_t nTemplateMicros;
+    int64_t nLastTemplateMicros;
+    //! Time from a tip change until the search on the old tip was abandoned
+    uint64_t nStaleEvents;
+    int64_t nStaleMicros;
+    int64_t nLastStaleMicros;
+
+    CMinerStats();
+
+    /** Collisions per full 2^26-nonce search, extrapolated from all searches */
+    double CollisionsPerMidHash() const;
+};
+
+/** Snapshot of the internal miner telemetry */
+CMinerStats GetMinerStats();
+
 #endif // BITCREDIT_MINER_H
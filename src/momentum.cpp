@@ -1,69 +1,228 @@
 #include <iostream>
-#include <openssl/sha.h>
 #include "momentum.h"
+#include "birthdaytable.h"
+#include "crypto/sha512_batch.h"
+#include "utiltime.h"
+#include <algorithm>
+
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
-namespace bts 
+namespace bts
 {
-    #define MAX_MOMENTUM_NONCE  (1<<26)
-    #define SEARCH_SPACE_BITS 50
-    #define BIRTHDAYS_PER_HASH 8
-   
-    std::vector< std::pair<uint32_t,uint32_t> > momentum_search( uint256 midHash )
+    typedef std::vector< std::pair<uint32_t,uint32_t> > momentum_results;
+
+    // Borrows a pooled birthday table for the duration of one search
+    class birthday_table_lease
+    {
+    public:
+       birthday_table_lease() : table(CBirthdayTable::Acquire()) { table->NewSearch(); }
+       ~birthday_table_lease() { CBirthdayTable::Release(table); }
+       CBirthdayTable* table;
+    };
+
+    // SHA-512 outputs computed per SHA512NonceBatch call; enough to fill the
+    // widest multi-buffer kernel
+    #define HASHES_PER_BATCH 8
+    #define NONCES_PER_BATCH (HASHES_PER_BATCH*BIRTHDAYS_PER_HASH)
+
+    // Nonces hashed between two checks of the abort callback and of the
+    // thread's interruption state
+    #define NONCES_PER_POLL 1048576
+
+    // State shared by all workers of one search
+    struct momentum_search_context
     {
-       semiOrderedMap somap;
-       somap.allocate(4);
-       std::vector< std::pair<uint32_t,uint32_t> > results;
-       char  hash_tmp[sizeof(midHash)+4];
-       memcpy((char*)&hash_tmp[4], (char*)&midHash, sizeof(midHash) );
-       uint32_t* index = (uint32_t*)hash_tmp;
-
-       for( uint32_t i = 0; i < MAX_MOMENTUM_NONCE;  )
+       uint256 midHash;
+       CBirthdayTable* table;
+       momentum_candidate_fn fnCandidate;
+       momentum_abort_fn fnAbort;
+       boost::atomic<bool> fStop;
+    };
+
+    // Hash the nonces [nBegin, nEnd) into the shared table and pass every
+    // collision to the candidate callback. nBegin and nEnd must be multiples
+    // of NONCES_PER_BATCH. The work done is counted into nBirthdays and
+    // nCollisions.
+    static void momentum_search_nonces( momentum_search_context* ctx, uint32_t nBegin, uint32_t nEnd, uint64_t& nBirthdays, uint64_t& nCollisions )
+    {
+       uint64_t  result_hashes[HASHES_PER_BATCH*8];
+
+       for( uint32_t i = nBegin; i < nEnd;  )
        {
-         if(i%1048576==0)
+         if( ctx->fStop.load( boost::memory_order_relaxed ) )
+            return;
+         if(i%NONCES_PER_POLL==0)
          {
             boost::this_thread::interruption_point();
+            if( ctx->fnAbort && ctx->fnAbort() )
+            {
+               ctx->fStop.store( true, boost::memory_order_relaxed );
+               return;
+            }
          }
-         
-         *index = i;
-         uint64_t  result_hash[8];
-         
-         SHA512((unsigned char*)hash_tmp, sizeof(hash_tmp), (unsigned char*)&result_hash);
-             
-         for( uint32_t x = 0; x < BIRTHDAYS_PER_HASH; ++x )
-         { 
-            uint64_t birthday = result_hash[x] >> (64-SEARCH_SPACE_BITS);           
-            uint32_t nonce = i+x;   
-            uint64_t foundMatch=somap.checkAdd( birthday, nonce );
-              if( foundMatch != 0 )
-              {
-                   results.push_back( std::make_pair( foundMatch, nonce ) );
-              }
+
+         SHA512NonceBatch(ctx->midHash.begin(), i, BIRTHDAYS_PER_HASH, HASHES_PER_BATCH, (unsigned char*)result_hashes);
+         nBirthdays += NONCES_PER_BATCH;
+
+         for( uint32_t h = 0; h < HASHES_PER_BATCH; ++h )
+         {
+            uint64_t* result_hash = &result_hashes[h*8];
+            for( uint32_t x = 0; x < BIRTHDAYS_PER_HASH; ++x )
+            {
+               uint64_t birthday = result_hash[x] >> (64-SEARCH_SPACE_BITS);
+               uint32_t nonce = i+x;
+               uint64_t foundMatch=ctx->table->checkAdd( birthday, nonce );
+                 if( foundMatch != 0 )
+                 {
+                      nCollisions++;
+                      if( ctx->fnCandidate( foundMatch, nonce ) )
+                      {
+                         ctx->fStop.store( true, boost::memory_order_relaxed );
+                         return;
+                      }
+                 }
+            }
+            i += BIRTHDAYS_PER_HASH;
          }
-         i += BIRTHDAYS_PER_HASH;
-       }        
-           return results;
-    }   
-     
+       }
+    }
+
+    // One search worker. Counts into locals so that workers do not share
+    // cache lines while hashing.
+    static void momentum_search_range( momentum_search_context* ctx, uint32_t nBegin, uint32_t nEnd, momentum_worker_stats* pworker )
+    {
+       uint64_t nBirthdays = 0, nCollisions = 0;
+       int64_t nStart = GetTimeMicros();
+       momentum_search_nonces( ctx, nBegin, nEnd, nBirthdays, nCollisions );
+       pworker->nMicros = GetTimeMicros() - nStart;
+       pworker->nBirthdays = nBirthdays;
+       pworker->nCollisions = nCollisions;
+    }
+
+    static void momentum_fill_stats( const std::vector<momentum_worker_stats>& vWorkers, momentum_search_stats* pstats )
+    {
+       if( !pstats )
+          return;
+       pstats->nBirthdays = 0;
+       pstats->nCollisions = 0;
+       for( size_t t = 0; t < vWorkers.size(); ++t )
+       {
+          pstats->nBirthdays += vWorkers[t].nBirthdays;
+          pstats->nCollisions += vWorkers[t].nCollisions;
+       }
+       pstats->vWorkers = vWorkers;
+    }
+
+    static void momentum_fill_table_stats( const CBirthdayTable* table, momentum_search_stats* pstats )
+    {
+       if( !pstats )
+          return;
+       pstats->nTableEntries = table->CountEntries();
+       pstats->nTableSlots = CBirthdayTable::SLOT_COUNT;
+    }
+
+    static void momentum_search_run( momentum_search_context* ctx, int nThreads, std::vector<momentum_worker_stats>& vWorkers )
+    {
+       vWorkers.assign( std::max( nThreads, 1 ), momentum_worker_stats() );
+       if( nThreads <= 1 )
+       {
+          momentum_search_range( ctx, 0, MAX_MOMENTUM_NONCE, &vWorkers[0] );
+          return;
+       }
+
+       // Split the nonce space into one contiguous slice per worker; every
+       // slice boundary stays aligned to a whole batch of SHA-512 outputs.
+       uint32_t nSlice = (MAX_MOMENTUM_NONCE / nThreads) & ~(NONCES_PER_BATCH - 1);
+       boost::thread_group workers;
+       for( int t = 0; t < nThreads; ++t )
+       {
+          uint32_t nBegin = t * nSlice;
+          uint32_t nEnd = (t == nThreads - 1) ? MAX_MOMENTUM_NONCE : nBegin + nSlice;
+          workers.create_thread( boost::bind( &momentum_search_range, ctx, nBegin, nEnd, &vWorkers[t] ) );
+       }
+
+       try
+       {
+          workers.join_all();
+       }
+       catch( const boost::thread_interrupted& )
+       {
+          // The calling miner thread was interrupted: stop the workers before
+          // the table they share goes back to the pool.
+          workers.interrupt_all();
+          workers.join_all();
+          throw;
+       }
+    }
+
+    // Candidate callback of momentum_search(): keep every collision
+    static bool momentum_collect( boost::mutex* pcs, momentum_results* results, uint32_t a, uint32_t b )
+    {
+       boost::lock_guard<boost::mutex> lock( *pcs );
+       results->push_back( std::make_pair( a, b ) );
+       return false;
+    }
+
+    std::vector< std::pair<uint32_t,uint32_t> > momentum_search( uint256 midHash, int nThreads, momentum_search_stats* pstats )
+    {
+       birthday_table_lease lease;
+       momentum_results results;
+       boost::mutex csResults;
+
+       momentum_search_context ctx;
+       ctx.midHash = midHash;
+       ctx.table = lease.table;
+       ctx.fnCandidate = boost::bind( &momentum_collect, &csResults, &results, _1, _2 );
+       ctx.fStop.store( false );
+       std::vector<momentum_worker_stats> vWorkers;
+       momentum_search_run( &ctx, nThreads, vWorkers );
+
+       momentum_fill_stats( vWorkers, pstats );
+       momentum_fill_table_stats( lease.table, pstats );
+       return results;
+    }
+
+    bool momentum_search_stream( uint256 midHash, int nThreads, const momentum_candidate_fn& fnCandidate, const momentum_abort_fn& fnAbort, momentum_search_stats* pstats )
+    {
+       birthday_table_lease lease;
+
+       momentum_search_context ctx;
+       ctx.midHash = midHash;
+       ctx.table = lease.table;
+       ctx.fnCandidate = fnCandidate;
+       ctx.fnAbort = fnAbort;
+       ctx.fStop.store( false );
+       std::vector<momentum_worker_stats> vWorkers;
+       momentum_search_run( &ctx, nThreads, vWorkers );
+
+       momentum_fill_stats( vWorkers, pstats );
+       return ctx.fStop.load();
+    }
+
     uint64_t getBirthdayHash(const uint256& midHash, uint32_t a)
     {
        uint32_t index = a - (a%8);
-       char  hash_tmp[sizeof(midHash)+4];
-       memcpy(&hash_tmp[4], (char*)&midHash, sizeof(midHash) );
-       memcpy(&hash_tmp[0], (char*)&index, sizeof(index) ); 
        uint64_t  result_hash[8];
-       SHA512((unsigned char*)hash_tmp, sizeof(hash_tmp), (unsigned char*)&result_hash);
+       SHA512NonceBatch(midHash.begin(), index, 0, 1, (unsigned char*)result_hash);
        uint64_t r = result_hash[a%BIRTHDAYS_PER_HASH]>>(64-SEARCH_SPACE_BITS);
        return r;
     }
-    
+
     bool momentum_verify( uint256 head, uint32_t a, uint32_t b )
     {
        if( a == b ) return false;
        if( a > MAX_MOMENTUM_NONCE ) return false;
-       if( b > MAX_MOMENTUM_NONCE ) return false;      
+       if( b > MAX_MOMENTUM_NONCE ) return false;
 
-       bool r = (getBirthdayHash(head,a) == getBirthdayHash(head,b));
+       // Both birthdays in one two-lane batch: the second hash is at a
+       // (possibly wrapping) stride from the first
+       uint32_t indexA = a - (a%8);
+       uint32_t indexB = b - (b%8);
+       uint64_t result_hash[2][8];
+       SHA512NonceBatch(head.begin(), indexA, indexB - indexA, 2, (unsigned char*)result_hash);
+       uint64_t birthdayA = result_hash[0][a%BIRTHDAYS_PER_HASH]>>(64-SEARCH_SPACE_BITS);
+       uint64_t birthdayB = result_hash[1][b%BIRTHDAYS_PER_HASH]>>(64-SEARCH_SPACE_BITS);
 
-       return r;
+       return birthdayA == birthdayB;
     }
 }
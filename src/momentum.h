@@ -1,9 +1,61 @@
+#ifndef BITCREDIT_MOMENTUM_H
+#define BITCREDIT_MOMENTUM_H
+
 #include "uint256.h"
-#include "semiOrderedMap.h"
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#define MOMENTUM_NONCE_BITS 26
+#define MAX_MOMENTUM_NONCE  (1<<MOMENTUM_NONCE_BITS)
+#define SEARCH_SPACE_BITS 50
+#define BIRTHDAYS_PER_HASH 8
 
 namespace bts 
 {
-    std::vector< std::pair<uint32_t,uint32_t> > momentum_search( uint256 midHash );
+    /** Work done by one search worker */
+    struct momentum_worker_stats
+    {
+        uint64_t nBirthdays;
+        uint64_t nCollisions;
+        int64_t nMicros;
+
+        momentum_worker_stats() : nBirthdays(0), nCollisions(0), nMicros(0) {}
+    };
+
+    /** Work done and birthday table usage of one search. Each birthday hashed
+     *  is one table insert, and BIRTHDAYS_PER_HASH of them one SHA-512. */
+    struct momentum_search_stats
+    {
+        uint64_t nBirthdays;
+        uint64_t nCollisions;
+        //! Filled in by momentum_search() only, as it needs a table scan
+        uint64_t nTableEntries;
+        uint64_t nTableSlots;
+        std::vector<momentum_worker_stats> vWorkers;
+
+        momentum_search_stats() : nBirthdays(0), nCollisions(0), nTableEntries(0), nTableSlots(0) {}
+    };
+
+    /** Search all 2^26 nonces of midHash for birthday collisions, splitting the
+     *  nonce space across nThreads workers that share one birthday table.
+     *  If pstats is given the table is scanned afterwards to fill it in. */
+    std::vector< std::pair<uint32_t,uint32_t> > momentum_search( uint256 midHash, int nThreads = 1, momentum_search_stats* pstats = NULL );
+
+    /** Called with each collision (a, b) as soon as it is found; returning
+     *  true ends the search. Called concurrently from every search worker. */
+    typedef boost::function<bool (uint32_t, uint32_t)> momentum_candidate_fn;
+    /** Polled by every search worker about every 2^20 nonces; returning true
+     *  abandons the search. */
+    typedef boost::function<bool ()> momentum_abort_fn;
+
+    /** Like momentum_search(), but streams collisions to fnCandidate instead of
+     *  collecting them, and stops early once fnCandidate or fnAbort returns
+     *  true. Returns whether the search was stopped early. If pstats is given
+     *  it receives the work done, without scanning the table. */
+    bool momentum_search_stream( uint256 midHash, int nThreads, const momentum_candidate_fn& fnCandidate, const momentum_abort_fn& fnAbort = momentum_abort_fn(), momentum_search_stats* pstats = NULL );
     bool momentum_verify( uint256 midHash, uint32_t a, uint32_t b );
 }
- 
+
+#endif // BITCREDIT_MOMENTUM_H
@@ -225,6 +225,9 @@ public:
         ignoreUntil     = 0;
         nWakeCounter    = 0;
         nPeerId         = 0;
+        nFlags          = 0;
+        nRateTime       = 0;
+        dRateAllowance  = 0;
         fEnabled        = false;
     };
     
@@ -235,6 +238,9 @@ public:
     int64_t                     ignoreUntil;
     uint32_t                    nWakeCounter;
     uint32_t                    nPeerId;
+    uint32_t                    nFlags;         // SMSG_PEER_* flags sent with the peer's smsgPing/smsgPong
+    int64_t                     nRateTime;      // last refill of dRateAllowance, in ms
+    double                      dRateAllowance; // messages the peer may still send, with -smsgpeerrate
     bool                        fEnabled;
     
 };
@@ -10,6 +10,10 @@
 #include "momentum.h"
 #include "utilstrencodings.h"
 
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
 uint256 CBlockHeader::GetHash() const
 {
     return Hash(BEGIN(nVersion), END(nBirthdayB));
@@ -34,10 +38,10 @@ uint256 CBlock::GetVerifiedHash() const
      return r;
 }
  
-uint256 CBlock::CalculateBestBirthdayHash() {
+uint256 CBlock::CalculateBestBirthdayHash(int nThreads) {
  				
 	uint256 midHash = GetMidHash();		
-	std::vector< std::pair<uint32_t,uint32_t> > results =bts::momentum_search( midHash );
+	std::vector< std::pair<uint32_t,uint32_t> > results =bts::momentum_search( midHash, nThreads );
 	uint32_t candidateBirthdayA=0;
 	uint32_t candidateBirthdayB=0;
 	uint256 smallestHashSoFar("0xfffffffffffffffffffffffffffffffffffffffffffffffffffffffffffdddd");
@@ -58,6 +62,48 @@ uint256 CBlock::CalculateBestBirthdayHash() {
  		return GetHash();
 }
 
+/** Winning birthday pair shared by the workers of one SearchBirthdayHash() */
+struct CBirthdayWinner
+{
+    boost::mutex cs;
+    bool fFound;
+    uint32_t nBirthdayA;
+    uint32_t nBirthdayB;
+
+    CBirthdayWinner() : fFound(false), nBirthdayA(0), nBirthdayB(0) {}
+};
+
+static bool CheckBirthdayCandidate(const CBlockHeader& header, const uint256& hashTarget, CBirthdayWinner* pwinner, uint32_t a, uint32_t b)
+{
+    CBlockHeader candidate(header);
+    candidate.nBirthdayA = a;
+    candidate.nBirthdayB = b;
+    if (candidate.GetHash() > hashTarget)
+        return false;
+
+    boost::lock_guard<boost::mutex> lock(pwinner->cs);
+    if (!pwinner->fFound) {
+        pwinner->fFound = true;
+        pwinner->nBirthdayA = a;
+        pwinner->nBirthdayB = b;
+    }
+    return true;
+}
+
+bool CBlock::SearchBirthdayHash(const uint256& hashTarget, int nThreads, const boost::function<bool ()>& fnAbort, bts::momentum_search_stats* pstats)
+{
+    CBirthdayWinner winner;
+    bts::momentum_search_stream(GetMidHash(), nThreads,
+                                boost::bind(&CheckBirthdayCandidate, GetBlockHeader(), hashTarget, &winner, _1, _2),
+                                fnAbort, pstats);
+    if (!winner.fFound)
+        return false;
+
+    nBirthdayA = winner.nBirthdayA;
+    nBirthdayB = winner.nBirthdayB;
+    return true;
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
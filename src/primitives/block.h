@@ -10,6 +10,10 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <boost/function.hpp>
+
+namespace bts { struct momentum_search_stats; }
+
 /** The maximum allowed size for a serialized block, in bytes (network rule) */
 static const uint64_t TWENTY_MEG_FORK_TIME = 1430784000;
 
@@ -139,7 +143,18 @@ public:
 	
     uint256 GetVerifiedHash() const;
 
-    uint256 CalculateBestBirthdayHash();
+    uint256 CalculateBestBirthdayHash(int nThreads = 1);
+
+    /**
+     * Search the birthdays of the current nonce, checking each collision
+     * against hashTarget as it is found. Stops at the first pair that meets
+     * the target, which is stored in nBirthdayA/nBirthdayB, or when fnAbort
+     * returns true. Returns whether a winning pair was found. If pstats is
+     * given it receives the work done by the search.
+     */
+    bool SearchBirthdayHash(const uint256& hashTarget, int nThreads = 1,
+                            const boost::function<bool ()>& fnAbort = boost::function<bool ()>(),
+                            bts::momentum_search_stats* pstats = NULL);
 
     uint256 GetMidHash() const;
     
@@ -155,8 +155,9 @@ void BanknodeManager::updateNodeList()
     ui->countLabel->setText("Updating...");
     ui->tableWidget->clearContents();
     ui->tableWidget->setRowCount(0);
-    BOOST_FOREACH(CBanknode mn, mnodeman.vBanknodes) 
+    BOOST_FOREACH(CBanknodePtr pmn, mnodeman.GetBanknodes())
     {
+        CBanknode& mn = *pmn;
         int mnRow = 0;
         ui->tableWidget->insertRow(0);
 
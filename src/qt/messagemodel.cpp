@@ -812,7 +812,9 @@ static void NotifySecMsgOutbox(MessageModel *messageModel, SecMsgStored outboxHd
 
 static void NotifySecMsgWallet(MessageModel *messageModel)
 {
-    messageModel->setEncryptionStatus(WalletModel::Unlocked);
+    // -- fired by the unlock scan thread
+    QMetaObject::invokeMethod(messageModel, "setEncryptionStatus", Qt::QueuedConnection,
+                              Q_ARG(int, WalletModel::Unlocked));
 }
 
 void MessageModel::subscribeToCoreSignals()
@@ -89,11 +89,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
+    { "setbid", 1 },
     
     { "smsginbox", 1 },
     { "smsgsend", 3 },
     { "smsgsendanon", 2 },
     { "smsgoutbox", 1 },
+    { "smsgscanchain", 0 },
 };
 
 class CRPCConvertTable
@@ -750,8 +750,9 @@ Value banknodelist(const Array& params, bool fHelp)
             obj.push_back(Pair(strAddr,       s.first));
         }
     } else {
-        std::vector<CBanknode> vBanknodes = mnodeman.GetFullBanknodeVector();
-        BOOST_FOREACH(CBanknode& mn, vBanknodes) {
+        std::vector<CBanknodePtr> vBanknodes = mnodeman.GetFullBanknodeVector();
+        BOOST_FOREACH(CBanknodePtr& pmn, vBanknodes) {
+            CBanknode& mn = *pmn;
             std::string strAddr = mn.addr.ToString();
             if (strMode == "activeseconds") {
                 if(strFilter !="" && strAddr.find(strFilter) == string::npos) continue;
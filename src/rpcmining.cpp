@@ -4,6 +4,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "base58.h"
+#include "bidtracker.h"
 #include "chainparams.h"
 #include "core_io.h"
 #include "init.h"
@@ -219,6 +221,61 @@ Value gethashespermin(const Array& params, bool fHelp)
         return (int64_t)0;
     return (int64_t)dHashesPerMin;
 }
+
+Value getminerstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getminerstats\n"
+            "\nReturns telemetry of the internal miner, see setgenerate.\n"
+            "Rates are of the most recent birthday search, totals are since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"searches\": n,               (numeric) Birthday searches run, one per nonce\n"
+            "  \"searchesaborted\": n,        (numeric) Searches abandoned because the block became outdated\n"
+            "  \"blocksfound\": n,            (numeric) Searches that found a block\n"
+            "  \"birthdayspersec\": x.x,      (numeric) Birthdays hashed per second, all threads\n"
+            "  \"sha512persec\": x.x,         (numeric) SHA-512 hashes per second, all threads\n"
+            "  \"threads\": [ x.x, ... ],     (array) Birthdays hashed per second by each search thread\n"
+            "  \"collisionspermidhash\": x.x, (numeric) Birthday collisions per full search of a midHash\n"
+            "  \"birthdays\": n,              (numeric) Total birthdays hashed\n"
+            "  \"collisions\": n,             (numeric) Total birthday collisions found\n"
+            "  \"searchmillis\": n,           (numeric) Total time spent searching\n"
+            "  \"templates\": n,              (numeric) Block templates built\n"
+            "  \"templatemillis\": x.x,       (numeric) Time to build the most recent template\n"
+            "  \"templatemillisavg\": x.x,    (numeric) Average time to build a template\n"
+            "  \"stale\": n,                  (numeric) Searches still running on the old tip after a tip change\n"
+            "  \"stalemillis\": x.x,          (numeric) Time the most recent of those ran past the tip change\n"
+            "  \"stalemillisavg\": x.x        (numeric) Average time searches ran past a tip change\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getminerstats", "")
+            + HelpExampleRpc("getminerstats", "")
+        );
+
+    CMinerStats stats = GetMinerStats();
+    Object obj;
+    obj.push_back(Pair("searches",             (uint64_t)stats.nSearches));
+    obj.push_back(Pair("searchesaborted",      (uint64_t)stats.nSearchesAborted));
+    obj.push_back(Pair("blocksfound",          (uint64_t)stats.nBlocksFound));
+    obj.push_back(Pair("birthdayspersec",      stats.dBirthdaysPerSec));
+    obj.push_back(Pair("sha512persec",         stats.dSha512PerSec));
+    Array threads;
+    BOOST_FOREACH(double dRate, stats.vThreadBirthdaysPerSec)
+        threads.push_back(dRate);
+    obj.push_back(Pair("threads",              threads));
+    obj.push_back(Pair("collisionspermidhash", stats.CollisionsPerMidHash()));
+    obj.push_back(Pair("birthdays",            (uint64_t)stats.nBirthdays));
+    obj.push_back(Pair("collisions",           (uint64_t)stats.nCollisions));
+    obj.push_back(Pair("searchmillis",         stats.nSearchMicros / 1000));
+    obj.push_back(Pair("templates",            (uint64_t)stats.nTemplates));
+    obj.push_back(Pair("templatemillis",       stats.nLastTemplateMicros / 1000.0));
+    obj.push_back(Pair("templatemillisavg",    stats.nTemplates ? stats.nTemplateMicros / 1000.0 / stats.nTemplates : 0.0));
+    obj.push_back(Pair("stale",                (uint64_t)stats.nStaleEvents));
+    obj.push_back(Pair("stalemillis",          stats.nLastStaleMicros / 1000.0));
+    obj.push_back(Pair("stalemillisavg",       stats.nStaleEvents ? stats.nStaleMicros / 1000.0 / stats.nStaleEvents : 0.0));
+    return obj;
+}
 #endif
 
 
@@ -238,6 +295,9 @@ Value getmininginfo(const Array& params, bool fHelp)
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"hashespermin\": n          (numeric) The hashes per second of the generation, or 0 if no generation.\n"
+            "  \"birthdayspersec\": x.x     (numeric) Birthdays hashed per second by the generation, see getminerstats\n"
+            "  \"collisionspermidhash\": x.x (numeric) Birthday collisions per full search of a midHash\n"
+            "  \"templatemillis\": x.x      (numeric) Time to build the most recent block template\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -261,6 +321,10 @@ Value getmininginfo(const Array& params, bool fHelp)
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate",         getgenerate(params, false)));
     obj.push_back(Pair("hashespermin",     gethashespermin(params, false)));
+    CMinerStats stats = GetMinerStats();
+    obj.push_back(Pair("birthdayspersec",  stats.dBirthdaysPerSec));
+    obj.push_back(Pair("collisionspermidhash", stats.CollisionsPerMidHash()));
+    obj.push_back(Pair("templatemillis",   stats.nLastTemplateMicros / 1000.0));
 #endif
     return obj;
 }
@@ -297,6 +361,73 @@ Value prioritisetransaction(const Array& params, bool fHelp)
     return true;
 }
 
+// Bids are kept in satoshis, like the bid file itself
+Value getbids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getbids\n"
+            "\nReturns the bids paid in the coinbase of every 400th block, as currently loaded from the bid file.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"address\": n,     (numeric) The bid of the address in satoshis\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getbids", "")
+            + HelpExampleRpc("getbids", "")
+        );
+
+    Object obj;
+    std::map<std::string, CAmount> mapBids = bidtracker.GetBids();
+    for (std::map<std::string, CAmount>::const_iterator it = mapBids.begin(); it != mapBids.end(); ++it)
+        obj.push_back(Pair(it->first, it->second));
+    return obj;
+}
+
+Value setbid(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "setbid \"address\" amount\n"
+            "\nSets the bid of an address and rewrites the bid file.\n"
+            "\nArguments:\n"
+            "1. \"address\"   (string, required) The bitcredit address to pay\n"
+            "2. amount        (numeric, required) The bid in satoshis, 0 removes the address\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setbid", "\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\" 100000000")
+            + HelpExampleRpc("setbid", "\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\", 100000000")
+        );
+
+    std::string strAddress = params[0].get_str();
+    if (!CBitcreditAddress(strAddress).IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcredit address");
+    CAmount nAmount = params[1].get_int64();
+    if (!MoneyRange(nAmount))
+        throw JSONRPCError(RPC_TYPE_ERROR, "Invalid amount");
+
+    if (!bidtracker.SetBid(strAddress, nAmount))
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot write " + bidtracker.GetPath().string());
+    return Value::null;
+}
+
+Value reloadbids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "reloadbids\n"
+            "\nRe-reads the bid file now instead of waiting for the next change check.\n"
+            "\nResult:\n"
+            "n    (numeric) The number of bids loaded\n"
+            "\nExamples:\n"
+            + HelpExampleCli("reloadbids", "")
+            + HelpExampleRpc("reloadbids", "")
+        );
+
+    bidtracker.Refresh(true);
+    return (int)bidtracker.GetBids().size();
+}
+
 Value getwork(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
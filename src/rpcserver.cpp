@@ -276,17 +276,21 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
 
     /* Mining */
+    { "mining",             "getbids",                &getbids,                true,      false,      false },
     { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
     { "mining",             "getwork",      		  &getwork,    			   true,      false,      false },
     { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
     { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
     { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false },
+    { "mining",             "reloadbids",             &reloadbids,             true,      false,      false },
+    { "mining",             "setbid",                 &setbid,                 true,      false,      false },
     { "mining",             "submitblock",            &submitblock,            true,      true,       false },
 
 #ifdef ENABLE_WALLET
     /* Coin generation */
     { "generating",         "getgenerate",            &getgenerate,            true,      false,      false },
     { "generating",         "gethashespermin",        &gethashespermin,        true,      false,      false },
+    { "generating",         "getminerstats",          &getminerstats,          true,      false,      false },
     { "generating",         "setgenerate",            &setgenerate,            true,      true,       false },
 #endif
 
@@ -376,6 +380,7 @@ static const CRPCCommand vRPCCommands[] =
     { "secureMsg" ,         "smsgoptions",            &smsgoptions,            true,      false,	  false},
     { "secureMsg" ,         "smsgscanchain",          &smsgscanchain,          true,      false,	  false},
     { "secureMsg" ,         "smsgscanbuckets",        &smsgscanbuckets,        true,      false,	  false},
+    { "secureMsg" ,         "smsgscanstatus",         &smsgscanstatus,         true,      false,	  false},
     { "secureMsg" ,         "smsgaddkey",             &smsgaddkey,             true,      false,	  false},
     { "secureMsg" ,         "smsggetpubkey",          &smsggetpubkey,          true,      false,	  false},
     { "secureMsg" ,         "smsgsend",               &smsgsend,               true,      false,	  true },
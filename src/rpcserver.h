@@ -82,6 +82,8 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 
 //! Convert boost::asio address to CNetAddr
 extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
+//! Whether -rpcallowip lets the given address connect (loopback always can)
+extern bool ClientAllowed(const boost::asio::ip::address& address);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
 
@@ -159,9 +161,13 @@ extern json_spirit::Value getgenerate(const json_spirit::Array& params, bool fHe
 extern json_spirit::Value setgenerate(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnetworkhashps(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gethashespermin(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getminerstats(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmininginfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value prioritisetransaction(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getbids(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value setbid(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value reloadbids(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value submitblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value estimatefee(const json_spirit::Array& params, bool fHelp);
@@ -248,6 +254,7 @@ extern json_spirit::Value smsglocalkeys(const json_spirit::Array& params, bool f
 extern json_spirit::Value smsgoptions(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsgscanchain(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsgscanbuckets(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value smsgscanstatus(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsgaddkey(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsggetpubkey(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsgsend(const json_spirit::Array& params, bool fHelp);
@@ -308,16 +308,19 @@ Value smsglocalkeys(const Array& params, bool fHelp) {
 
 Value smsgscanchain(const Array& params, bool fHelp) {
 
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "smsgscanchain \n"
-            "Look for public keys in the block chain.");
+            "smsgscanchain [rescan]\n"
+            "Look for public keys in the block chain.\n"
+            "Continues from the last block scanned, unless rescan is true.");
     
     if (!fSecMsgEnabled)
         throw runtime_error("Secure messaging is disabled.");
     
+    bool fRescan = params.size() > 0 && params[0].get_bool();
+    
     Object result;
-    if (!SecureMsgScanBlockChain()) {
+    if (!SecureMsgScanBlockChain(fRescan)) {
         result.push_back(Pair("result", "Scan Chain Failed."));
     }
     else {
@@ -345,6 +348,33 @@ Value smsgscanbuckets(const Array& params, bool fHelp) {
     return result;
 }
 
+Value smsgscanstatus(const Array& params, bool fHelp) {
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "smsgscanstatus \n"
+            "Show the progress of the scan of messages received while the wallet was locked.");
+    
+    if (!fSecMsgEnabled)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Secure messaging is disabled.");
+    
+    SecMsgUnlockScanStatus status;
+    SecureMsgGetUnlockScanStatus(status);
+    
+    Object result;
+    result.push_back(Pair("running",        status.fRunning));
+    if (status.nStartTime)
+        result.push_back(Pair("started",    GetTimeString(status.nStartTime)));
+    result.push_back(Pair("files",          (uint64_t)status.nFiles));
+    result.push_back(Pair("files_done",     (uint64_t)status.nFilesDone));
+    result.push_back(Pair("bytes",          status.nBytes));
+    result.push_back(Pair("bytes_done",     status.nBytesDone));
+    result.push_back(Pair("progress",       status.nBytes ? (double)status.nBytesDone / status.nBytes : 1.0));
+    result.push_back(Pair("messages",       (uint64_t)status.nMessages));
+    result.push_back(Pair("received",       (uint64_t)status.nReceived));
+    return result;
+}
+
 Value smsgaddkey(const Array& params, bool fHelp) {
 
     if (fHelp || params.size() != 2)
@@ -716,14 +746,18 @@ Value smsgbuckets(const Array& params, bool fHelp)
         uint64_t nBuckets = 0;
         uint64_t nMessages = 0;
         uint64_t nBytes = 0;
+        std::map<int64_t, boost::shared_ptr<SecMsgBucket> > mapBuckets;
+        {
+            LOCK(cs_smsgBuckets);
+            mapBuckets = smsgBuckets;
+        }
         {
-            LOCK(cs_smsg);
-            std::map<int64_t, SecMsgBucket>::iterator it;
-            it = smsgBuckets.begin();
+            std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it;
             
-            for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
+            for (it = mapBuckets.begin(); it != mapBuckets.end(); ++it)
             {
-                std::set<SecMsgToken>& tokenSet = it->second.setTokens;
+                LOCK(it->second->cs);
+                std::set<SecMsgToken>& tokenSet = it->second->setTokens;
                 
                 std::string sBucket = boost::lexical_cast<std::string>(it->first);
                 std::string sFile = sBucket + "_01.dat";
@@ -735,8 +769,8 @@ Value smsgbuckets(const Array& params, bool fHelp)
                 objM.push_back(Pair("bucket", (uint64_t) it->first));
                 objM.push_back(Pair("time", GetTimeString(it->first)));
                 objM.push_back(Pair("no. messages", (uint64_t)tokenSet.size()));
-                objM.push_back(Pair("hash", (uint64_t) it->second.hash));
-                objM.push_back(Pair("last changed", GetTimeString(it->second.timeChanged)));
+                objM.push_back(Pair("hash", (uint64_t) it->second->hash));
+                objM.push_back(Pair("last changed", GetTimeString(it->second->timeChanged)));
                 
                 boost::filesystem::path fullPath = GetDataDir() / "smsgStore" / sFile;
 
@@ -764,7 +798,7 @@ Value smsgbuckets(const Array& params, bool fHelp)
                 
                 result.push_back(objM);
             };
-        }; // LOCK(cs_smsg);
+        };
         
         Object objM;
         objM.push_back(Pair("buckets", result));
@@ -775,25 +809,20 @@ Value smsgbuckets(const Array& params, bool fHelp)
         return objM;
     }
     else if (mode == "dump") {
+        std::map<int64_t, boost::shared_ptr<SecMsgBucket> > mapBuckets;
+        {
+            LOCK(cs_smsgBuckets);
+            mapBuckets.swap(smsgBuckets);
+        }
         {
-            LOCK(cs_smsg);
-            std::map<int64_t, SecMsgBucket>::iterator it;
-            it = smsgBuckets.begin();
+            std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it;
             
-            for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it) {
-                std::string sFile = boost::lexical_cast<std::string>(it->first) + "_01.dat";
-                
-                try {
-                    boost::filesystem::path fullPath = GetDataDir() / "smsgStore" / sFile;
-                    boost::filesystem::remove(fullPath);
-                }
-                catch (const boost::filesystem::filesystem_error& ex) {
-                    //objM.push_back(Pair("file size, error", ex.what()));
-                    printf("Error removing bucket file %s.\n", ex.what());
-                }
+            for (it = mapBuckets.begin(); it != mapBuckets.end(); ++it)
+            {
+                LOCK(it->second->cs);
+                SecureMsgRemoveBucketFiles(it->first, *it->second);
             }
-            smsgBuckets.clear();
-        } // LOCK(cs_smsg);
+        }
         
         return Value::null;
     }
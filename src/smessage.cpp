@@ -10,7 +10,10 @@ Notes:
     parameters:
         -nosmsg             Disable secure messaging (fNoSmsg)
         -debugsmsg          Show extra debug messages (fDebugSmsg)
-        -smsgscanchain      Scan the block chain for public key addresses on startup
+        -smsgscanchain      Scan the block chain for public key addresses on startup, from the last checkpoint
+        -smsgreconcile      Reconcile buckets with peers using IBLTs (default: 1)
+        -smsgrequirestamp   Drop relayed messages without a valid proof of work stamp (default: 0)
+        -smsgpeerrate=<n>   Messages accepted per minute from each peer, 0 for no limit (default: 0)
 
 
     Wallet Locked
@@ -31,6 +34,8 @@ Notes:
 
 #include <stdint.h>
 #include <time.h>
+#include <deque>
+#include <limits>
 #include <map>
 #include <stdexcept>
 #include <sstream>
@@ -43,14 +48,21 @@ Notes:
 #include "crypto/hmac_sha256.h"
 
 #include <boost/atomic.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/static_assert.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
 
 #include "base58.h"
+#include "checkqueue.h"
 #include "crypter.h"
+#include "iblt.h"
 #include "db.h"
 #include "init.h" // pwalletMain
 #include "rpcprotocol.h"
@@ -92,15 +104,19 @@ boost::signals2::signal<void (SecMsgStored& outboxHdr)> NotifySecMsgOutboxChange
 boost::signals2::signal<void ()> NotifySecMsgWalletUnlocked;
 
 bool fSecMsgEnabled = false;
+static uint32_t nSmsgLocalFlags = 0;    // SMSG_PEER_* flags sent to peers
+static bool fSmsgRequireStamp = false;  // -smsgrequirestamp, drop relayed messages without a valid stamp
+static int nSmsgPeerRate = 0;           // -smsgpeerrate, messages accepted per peer per SMSG_RATE_PERIOD, 0 for no limit
 boost::thread secureMsgThread;
 
-std::map<int64_t, SecMsgBucket> smsgBuckets;
+std::map<int64_t, boost::shared_ptr<SecMsgBucket> > smsgBuckets;
 std::vector<SecMsgAddress>      smsgAddresses;
 SecMsgOptions                   smsgOptions;
 
 uint32_t nPeerIdCounter = 1;
 
 CCriticalSection cs_smsg;
+CCriticalSection cs_smsgBuckets;
 CCriticalSection cs_smsgDB;
 CCriticalSection cs_smsgThreads;
 
@@ -110,26 +126,78 @@ leveldb::DB *smsgDB = NULL;
 namespace fs = boost::filesystem;
 
 
+static uint32_t SecureMsgTokenDigest(const SecMsgToken& token)
+{
+    unsigned char vch[16];
+    memcpy(&vch[0], &token.timestamp, 8);
+    memcpy(&vch[8], token.sample, 8);
+    return XXH32(vch, sizeof(vch), 1);
+}
+
+bool SecMsgBucket::addToken(const SecMsgToken& token)
+{
+    AssertLockHeld(cs);
+
+    if (!setTokens.insert(token).second)
+        return false;
+
+    nDigest += SecureMsgTokenDigest(token);
+    fLegacyHashValid = false;
+    return true;
+}
+
+bool SecMsgBucket::addRejected(const SecMsgToken& token)
+{
+    AssertLockHeld(cs);
+
+    if (!setRejected.insert(token).second)
+        return false;
+
+    nRejectedDigest += SecureMsgTokenDigest(token);
+    return true;
+}
+
 void SecMsgBucket::hashBucket()
 {
+    /*
+        Publish the bucket's inventory entry, nDigest is already up to date
+    */
+
+    AssertLockHeld(cs);
+
+    {
+        LOCK(cs_smsgBuckets);
+        timeChanged = GetTime();
+        hash = nDigest;
+        nMessages = setTokens.size();
+    }
+
     if (fDebugSmsg)
-        printf("SecMsgBucket::hashBucket()\n");
-    
-    timeChanged = GetTime();
-    
+        printf("SecMsgBucket::hashBucket() %d messages, digest %u\n", (int) setTokens.size(), hash);
+}
+
+uint32_t SecMsgBucket::legacyHash()
+{
+    AssertLockHeld(cs);
+
+    if (fLegacyHashValid)
+        return nLegacyHash;
+
     std::set<SecMsgToken>::iterator it;
-    
+
     void* state = XXH32_init(1);
-    
+
     for (it = setTokens.begin(); it != setTokens.end(); ++it)
     {
         XXH32_update(state, it->sample, 8);
     }
-    
-    hash = XXH32_digest(state);
-    
+
+    nLegacyHash = XXH32_digest(state);
+    fLegacyHashValid = true;
+
     if (fDebugSmsg)
-        printf("Hashed %d messages, hash %u\n", (int) setTokens.size(), hash);
+        printf("Hashed %d messages, legacy hash %u\n", (int) setTokens.size(), nLegacyHash);
+    return nLegacyHash;
 }
 
 
@@ -361,6 +429,65 @@ bool SecMsgDB::ExistsPK(CKeyID& addr)
     return s.IsNotFound() == false;
 }
 
+bool SecMsgDB::ReadScanCheckpoint(CBlockLocator& locator)
+{
+    // -- last block ScanChainForPublicKeys finished, read from the db only
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 's';
+    ssKey << 'c';
+    std::string strValue;
+
+    leveldb::Status s = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue);
+    if (!s.ok())
+    {
+        if (!s.IsNotFound())
+            printf("LevelDB read failure: %s\n", s.ToString().c_str());
+        return false;
+    }
+
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> locator;
+    } catch (std::exception& e) {
+        printf("SecMsgDB::ReadScanCheckpoint() unserialize threw: %s.\n", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool SecMsgDB::WriteScanCheckpoint(const CBlockLocator& locator)
+{
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 's';
+    ssKey << 'c';
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << locator;
+
+    if (activeBatch)
+    {
+        activeBatch->Put(ssKey.str(), ssValue.str());
+        return true;
+    }
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pdb->Put(writeOptions, ssKey.str(), ssValue.str());
+    if (!s.ok())
+    {
+        printf("SecMsgDB write failure: %s\n", s.ToString().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 
 bool SecMsgDB::NextSmesg(leveldb::Iterator* it, std::string& prefix, unsigned char* chKey, SecMsgStored& smsgStored)
 {
@@ -544,76 +671,84 @@ void ThreadSecureMsg(void* parg)
         int64_t now = GetTime();
 
         int64_t cutoffTime = now - SMSG_RETENTION;
+
+        // -- take expired buckets out of the map, then work on each bucket under its own lock
+        std::vector<std::pair<int64_t, boost::shared_ptr<SecMsgBucket> > > vBuckets, vExpired;
         {
+            LOCK(cs_smsgBuckets);
+            std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it = smsgBuckets.begin();
+            while (it != smsgBuckets.end()) {
+                if (it->first < cutoffTime) {
+                    vExpired.push_back(*it);
+                    smsgBuckets.erase(it++);
+                } else {
+                    vBuckets.push_back(*it);
+                    ++it;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < vExpired.size(); ++i) {
+            if (fDebugSmsg)
+                printf("Removing bucket %d\n", (int) vExpired[i].first);
+
+            {
+                LOCK(vExpired[i].second->cs);
+                SecureMsgRemoveBucketFiles(vExpired[i].first, *vExpired[i].second);
+            }
+
+            // -- look for a wl file, it stores incoming messages when wallet is locked
             LOCK(cs_smsg);
+            fs::path fullPath = GetDataDir() / "smsgStore" / (boost::lexical_cast<std::string>(vExpired[i].first) + "_01_wl.dat");
+            if (fs::exists(fullPath)) {
+                try {
+                    fs::remove(fullPath);
+                }
+                catch (const fs::filesystem_error& ex) {
+                    printf("Error removing wallet locked file %s.\n", ex.what());
+                }
+            }
+        }
 
-            for (std::map<int64_t, SecMsgBucket>::iterator it(smsgBuckets.begin()); it != smsgBuckets.end(); it++) {
-                //if (fDebugSmsg)
-                //    printf("Checking bucket %"PRId64", size %"PRIszu" \n", it->first, it->second.setTokens.size());
-                if (it->first < cutoffTime) {
-                    if (fDebugSmsg)
-                        printf("Removing bucket %d\n", (int) it->first);
-
-                    std::string fileName = boost::lexical_cast<std::string>(it->first);
-
-                    fs::path fullPath = GetDataDir() / "smsgStore" / (fileName + "_01.dat");
-                    if (fs::exists(fullPath)) {
-                        try {
-                            fs::remove(fullPath);
-                        }
-                        catch (const fs::filesystem_error& ex) {
-                            printf("Error removing bucket file %s.\n", ex.what());
-                        }
-                    }
-                    else {
-                        printf("Path %s does not exist\n", fullPath.string().c_str());
-                    }
-                    
-                    // -- look for a wl file, it stores incoming messages when wallet is locked
-                    fullPath = GetDataDir() / "smsgStore" / (fileName + "_01_wl.dat");
-                    if (fs::exists(fullPath)) {
-                        try {
-                            fs::remove(fullPath);
-                        }
-                        catch (const fs::filesystem_error& ex) {
-                            printf("Error removing wallet locked file %s.\n", ex.what());
-                        }
-                    }
+        std::vector<std::pair<int64_t, uint32_t> > vTimedOut;
+        for (size_t i = 0; i < vBuckets.size(); ++i) {
+            SecMsgBucket& bkt = *vBuckets[i].second;
+            LOCK(bkt.cs);
+            if (bkt.nLockCount > 0) { // -- tick down nLockCount, so will eventually expire if peer never sends data
+                bkt.nLockCount--;
 
-                    smsgBuckets.erase(it);
+                if (bkt.nLockCount == 0) {    // lock timed out
+                    vTimedOut.push_back(std::make_pair(vBuckets[i].first, bkt.nLockPeerId));
+                    bkt.nLockPeerId = 0;
                 }
-                else if (it->second.nLockCount > 0) { // -- tick down nLockCount, so will eventually expire if peer never sends data
-                    it->second.nLockCount--;
+            }
+        }
 
-                    if (it->second.nLockCount == 0) {    // lock timed out
-                        uint32_t nPeerId     = it->second.nLockPeerId;
-                        int64_t  ignoreUntil = GetTime() + SMSG_TIME_IGNORE;
+        for (size_t i = 0; i < vTimedOut.size(); ++i) {
+            uint32_t nPeerId     = vTimedOut[i].second;
+            int64_t  ignoreUntil = GetTime() + SMSG_TIME_IGNORE;
 
-                        if (fDebugSmsg)
-                            printf("Lock on bucket %d for peer %u timed out.\n", (int) it->first, nPeerId);
-
-                        // -- look through the nodes for the peer that locked this bucket
-                        LOCK(cs_vNodes);
-                        BOOST_FOREACH(CNode* pnode, vNodes) {
-                            if (pnode->smsgData.nPeerId != nPeerId)
-                                continue;
-                            pnode->smsgData.ignoreUntil = ignoreUntil;
-
-                            // -- alert peer that they are being ignored
-                            std::vector<unsigned char> vchData;
-                            vchData.resize(8);
-                            memcpy(&vchData[0], &ignoreUntil, 8);
-                            pnode->PushMessage("smsgIgnore", vchData);
-
-                            if (fDebugSmsg)
-                                printf("Lock on bucket %d for peer %u timed out.\n", (int) it->first, nPeerId);
-                            break;
-                        }
-                        it->second.nLockPeerId = 0;
-                    } // if (it->second.nLockCount == 0)
-                } // ! if (it->first < cutoffTime)
+            if (fDebugSmsg)
+                printf("Lock on bucket %d for peer %u timed out.\n", (int) vTimedOut[i].first, nPeerId);
+
+            // -- look through the nodes for the peer that locked this bucket
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->smsgData.nPeerId != nPeerId)
+                    continue;
+                pnode->smsgData.ignoreUntil = ignoreUntil;
+
+                // -- alert peer that they are being ignored
+                std::vector<unsigned char> vchData;
+                vchData.resize(8);
+                memcpy(&vchData[0], &ignoreUntil, 8);
+                pnode->PushMessage("smsgIgnore", vchData);
+
+                if (fDebugSmsg)
+                    printf("Lock on bucket %d for peer %u timed out.\n", (int) vTimedOut[i].first, nPeerId);
+                break;
             }
-        } // LOCK(cs_smsg);
+        }
 
 
         SecMsgDB dbOutbox;
@@ -647,12 +782,9 @@ void ThreadSecureMsg(void* parg)
             }
 
             // -- add to message store
-            {
-                LOCK(cs_smsg);
-                if (SecureMsgStore(smsg, pPayload, true) != 0) {
-                    printf("SecMsgPow: Could not place message in buckets, message removed.\n");
-                    continue;
-                }
+            if (SecureMsgStore(smsg, pPayload, true) != 0) {
+                printf("SecMsgPow: Could not place message in buckets, message removed.\n");
+                continue;
             }
 
             // -- test if message was sent to self
@@ -680,128 +812,1224 @@ void ThreadSecureMsg(void* parg)
 }
 
 
-int SecureMsgBuildBucketSet()
-{
-    /*
-        Build the bucket set by scanning the files in the smsgStore dir.
+/*
+    Trial decryption pipeline
 
-        smsgBuckets should be empty
-    */
+    Every incoming message has to be tried against each owned receiving
+    address. Only the MAC check is needed to find the recipient, so workers
+    run nothing but ECDH + SHA512 + HMAC per (message, key) pair, with the
+    private keys fetched from the wallet once per batch. The full decrypt
+    runs once, for the key that matched.
 
-    if (fDebugSmsg)
-        printf("SecureMsgBuildBucketSet()\n");
+    SecureMsgReceive() queues each bunch (one bucket) it stores and returns;
+    ThreadSecureMsgScan() takes the batches off the queue and spreads their
+    checks over the ThreadSecureMsgTrial() workers, joining in itself.
+*/
 
-    int64_t  now            = GetTime();
-    uint32_t nFiles         = 0;
-    uint32_t nMessages      = 0;
+class SecMsgScanKey
+{
+public:
+    std::string     sAddress;
+    CKey            key;
+    bool            fReceiveAnon;
+};
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-    fs::directory_iterator itend;
+class SecMsgScanItem
+{
+public:
+    SecureMessageHeader             header;     // header.hash holds the payload hash
+    std::vector<unsigned char>      vchPayload;
+};
 
+/** Tries the keys [nBegin, nEnd) on one message, records the first match in *pnMatch */
+class CSecMsgTrialCheck
+{
+private:
+    const SecMsgScanItem* pitem;
+    const std::vector<SecMsgScanKey>* pvKeys;
+    size_t nBegin;
+    size_t nEnd;
+    int* pnMatch;
 
-    if (!fs::exists(pathSmsgDir)
-        || !fs::is_directory(pathSmsgDir))
+public:
+    CSecMsgTrialCheck() : pitem(NULL), pvKeys(NULL), nBegin(0), nEnd(0), pnMatch(NULL) {}
+    CSecMsgTrialCheck(const SecMsgScanItem* pitemIn, const std::vector<SecMsgScanKey>* pvKeysIn, size_t nBeginIn, size_t nEndIn, int* pnMatchIn) :
+        pitem(pitemIn), pvKeys(pvKeysIn), nBegin(nBeginIn), nEnd(nEndIn), pnMatch(pnMatchIn) {}
+
+    bool operator()();
+
+    void swap(CSecMsgTrialCheck& check)
     {
-        if (!fs::create_directory(pathSmsgDir)) {
-            printf("Message store directory does not exist and could not be created.\n");
-            return 1;
-        }
+        std::swap(pitem, check.pitem);
+        std::swap(pvKeys, check.pvKeys);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pnMatch, check.pnMatch);
     }
+};
 
-    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd) {
-        if (!fs::is_regular_file(itd->status()))
-            continue;
-
-        std::string fileType = (*itd).path().extension().string();
+static boost::thread_group* psmsgScanThreads = NULL;
+// -- NULL when running single threaded; only one thread at a time may drive it
+static CCheckQueue<CSecMsgTrialCheck>* psmsgTrialQueue = NULL;
+static boost::mutex cs_smsgTrialMaster;
 
-        if (fileType.compare(".dat") != 0)
-            continue;
+static boost::mutex cs_smsgScanQueue;
+static boost::condition_variable condSmsgScanQueue;
+static std::deque<std::vector<SecMsgScanItem> > smsgScanQueue;
 
-        std::string fileName = (*itd).path().filename().string();
 
+static bool SecureMsgCheckMac(const CKey& keyDest, const SecureMessageHeader& smsg, secure_buffer& vchHashedDec)
+{
+    /*  Derive the shared secret for keyDest and check the header MAC with it.
+        smsg.hash must hold the hash of the payload.
+        On success vchHashedDec holds key_e followed by key_m.
+    */
 
-        if (fDebugSmsg)
-            printf("Processing file: %s.\n", fileName.c_str());
+    CPubKey keyR(smsg.cpkR, smsg.cpkR+33);
+    if (!keyR.IsValid())
+        return false;
 
-        nFiles++;
+    // -- Do an EC point multiply with private key k and public key R. This gives you public EC key P.
+    secure_buffer vchP;
+    if (!DeriveKey(vchP, keyDest, keyR))
+        return false;
 
-        // TODO files must be split if > 2GB
-        // time_noFile.dat
-        size_t sep = fileName.find_first_of("_");
-        if (sep == std::string::npos)
-            continue;
+    // -- Use public key P to calculate the SHA512 hash H.
+    //    The first 32 bytes of H are called key_e and the last 32 bytes are called key_m.
+    vchHashedDec.resize(64); // 512 bits
+    secure_buffer sha512_mem(sizeof(CSHA512), 0);
+    CSHA512 &sha512 = *new (&sha512_mem[0]) CSHA512();
+    sha512.Write(&vchP[0], vchP.size());
+    sha512.Finalize(&vchHashedDec[0]);
+    sha512.~CSHA512();
 
-        std::string stime = fileName.substr(0, sep);
+    // -- Message authentication code of header
+    SecureMessageHeader smsg_(smsg.begin());
+    memcpy(smsg_.mac, smsg.hash, 32);
+    unsigned char mac[32];
+    CHMAC_SHA256 hmac(&vchHashedDec[32], 32);
+    hmac.Write((const unsigned char*) smsg_.begin(), SMSG_HDR_LEN);
+    hmac.Finalize(mac);
 
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
+    return memcmp(mac, smsg.mac, 32) == 0;
+}
 
-        if (fileTime < now - SMSG_RETENTION) {
-            printf("Dropping file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            }
-            catch (const fs::filesystem_error& ex) {
-                printf("Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
-            }
-            continue;
+bool CSecMsgTrialCheck::operator()()
+{
+    secure_buffer vchHashedDec;
+    for (size_t i = nBegin; i < nEnd; ++i)
+    {
+        if (SecureMsgCheckMac((*pvKeys)[i].key, pitem->header, vchHashedDec))
+        {
+            *pnMatch = i;
+            break;
         }
+    }
+    // -- never fail, that would make the queue skip the remaining checks
+    return true;
+}
 
-        if (boost::algorithm::ends_with(fileName, "_wl.dat")) {
-            if (fDebugSmsg)
-                printf("Skipping wallet locked file: %s.\n", fileName.c_str());
-            continue;
-        }
+static bool SecureMsgMakeInbox(const SecureMessageHeader &smsg, const unsigned char *pPayload, const std::string& addressTo, unsigned char* chKey, SecMsgStored& smsgInbox)
+{
+    /*
+    Fill in the inbox db key (18 bytes) and record of a received message
+    */
 
-        SecureMessageHeader smsg;
-        std::set<SecMsgToken>& tokenSet = smsgBuckets[fileTime].setTokens;
+    std::string sPrefix("im");
+    memcpy(&chKey[0],  sPrefix.data(),  2);
+    memcpy(&chKey[2],  &smsg.timestamp, 8);
+    memcpy(&chKey[10], pPayload,        8);
 
-        {
-            LOCK(cs_smsg);
-            FILE *fp;
+    smsgInbox.timeReceived  = GetTime();
+    smsgInbox.status        = (SMSG_MASK_UNREAD) & 0xFF;
+    smsgInbox.sAddrTo       = addressTo;
 
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb"))) {
-                printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
-                continue;
-            }
+    // -- data may not be contiguous
+    try {
+        smsgInbox.vchMessage.resize(SMSG_HDR_LEN + smsg.nPayload);
+    } catch (std::exception& e) {
+        printf("SecureMsgMakeInbox(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
+        return false;
+    }
+    memcpy(&smsgInbox.vchMessage[0], smsg.begin(), SMSG_HDR_LEN);
+    memcpy(&smsgInbox.vchMessage[SMSG_HDR_LEN], pPayload, smsg.nPayload);
+    return true;
+}
 
-            for (;;) {
-                long int ofs = ftell(fp);
-                SecMsgToken token;
-                token.offset = ofs;
-                if (fread(&smsg, sizeof(unsigned char), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
-                    if (!feof(fp)) {
-                        printf("fread header failed\n");
-                    }
-                    break;
-                }
-                token.timestamp = smsg.timestamp;
-                if (smsg.nPayload < 8)
-                    continue;
-                
-                if (fread(token.sample, sizeof(unsigned char), 8, fp) != 8) {
-                    printf("fread data failed: %s\n", strerror(errno));
-                    break;
-                }
+static int SecureMsgSaveInbox(const SecureMessageHeader &smsg, const unsigned char *pPayload, const std::string& addressTo, bool reportToGui)
+{
+    unsigned char chKey[18];
+    SecMsgStored smsgInbox;
+    if (!SecureMsgMakeInbox(smsg, pPayload, addressTo, chKey, smsgInbox))
+        return 1;
 
-                if (fseek(fp, smsg.nPayload-8, SEEK_CUR) != 0) {
-                    printf("fseek, strerror: %s.\n", strerror(errno));
-                    break;
-                }
+    {
+        LOCK(cs_smsgDB);
+        SecMsgDB dbInbox;
 
-                tokenSet.insert(token);
-            }
+        if (dbInbox.Open("cw"))
+        {
+            if (dbInbox.ExistsSmesg(chKey))
+            {
+                if (fDebugSmsg)
+                    printf("Message already exists in inbox db.\n");
+            } else
+            {
+                dbInbox.WriteSmesg(chKey, smsgInbox);
 
-            fclose(fp);
+                if (reportToGui)
+                    NotifySecMsgInboxChanged(smsgInbox);
+                printf("SecureMsg saved to inbox, received with %s.\n", addressTo.c_str());
+            }
         }
-        smsgBuckets[fileTime].hashBucket();
-
-        nMessages += tokenSet.size();
-
-        if (fDebugSmsg)
-            printf("Bucket %d contains %d messages.\n", (int) fileTime, (int) tokenSet.size());
+    }
+    return 0;
+}
+
+static bool SecureMsgTrialBatch(std::vector<SecMsgScanItem>& vItems, std::vector<std::pair<size_t, std::string> >& vReceived)
+{
+    /*
+    Find the messages of vItems that belong to this node.
+    vItems should be messages of one bucket.
+    vReceived gets the index in vItems and receiving address of each.
+
+    returns false if the wallet is (or became) locked, the keys were not all available
+    */
+
+    if (vItems.empty())
+        return true;
+
+    // -- fetch each receiving key once for the whole batch
+    std::vector<SecMsgAddress> vAddresses;
+    {
+        LOCK(cs_smsg);
+        vAddresses = smsgAddresses;
+    }
+
+    std::vector<SecMsgScanKey> vKeys;
+    vKeys.reserve(vAddresses.size());
+    BOOST_FOREACH(const SecMsgAddress& address, vAddresses)
+    {
+        if (!address.fReceiveEnabled)
+            continue;
+
+        CBitcreditAddress coinAddress(address.sAddress);
+        CKeyID ckid;
+        SecMsgScanKey scanKey;
+        if (!coinAddress.GetKeyID(ckid) || !pwalletMain->GetKey(ckid, scanKey.key))
+            continue;
+        scanKey.sAddress = coinAddress.ToString();
+        scanKey.fReceiveAnon = address.fReceiveAnon;
+        vKeys.push_back(scanKey);
+    }
+
+    if (pwalletMain->IsLocked())
+        return false;
+
+    if (vKeys.empty())
+        return true;
+
+    // -- Calculate hash of payload and enable verification of the HMAC
+    BOOST_FOREACH(SecMsgScanItem& item, vItems)
+        memcpy(item.header.hash, Hash(item.vchPayload.begin(), item.vchPayload.end()).begin(), 32);
+
+    size_t nChunks = (vKeys.size() + SMSG_SCAN_KEYS_PER_CHECK - 1) / SMSG_SCAN_KEYS_PER_CHECK;
+    std::vector<int> vMatch(vItems.size() * nChunks, -1);
+    std::vector<CSecMsgTrialCheck> vChecks;
+    vChecks.reserve(vMatch.size());
+    for (size_t i = 0; i < vItems.size(); ++i)
+        for (size_t c = 0; c < nChunks; ++c)
+            vChecks.push_back(CSecMsgTrialCheck(&vItems[i], &vKeys, c * SMSG_SCAN_KEYS_PER_CHECK,
+                std::min(vKeys.size(), (c + 1) * SMSG_SCAN_KEYS_PER_CHECK), &vMatch[i * nChunks + c]));
+
+    {
+        boost::lock_guard<boost::mutex> lock(cs_smsgTrialMaster);
+        if (psmsgTrialQueue)
+        {
+            CCheckQueueControl<CSecMsgTrialCheck> control(psmsgTrialQueue);
+            control.Add(vChecks);
+            control.Wait();
+        } else
+        {
+            BOOST_FOREACH(CSecMsgTrialCheck& check, vChecks)
+                check();
+        }
+    }
+
+    for (size_t i = 0; i < vItems.size(); ++i)
+    {
+        const SecMsgScanItem& item = vItems[i];
+
+        // -- first matching key, in smsgAddresses order
+        int nKey = -1;
+        for (size_t c = 0; c < nChunks && nKey < 0; ++c)
+            nKey = vMatch[i * nChunks + c];
+        if (nKey < 0)
+            continue;
+
+        const SecMsgScanKey& scanKey = vKeys[nKey];
+        if (!scanKey.fReceiveAnon)
+        {
+            // -- have to do full decrypt to see address from
+            MessageData msg;
+            if (SecureMsgDecrypt(false, scanKey.sAddress, item.header, &item.vchPayload[0], msg) != 0
+                || msg.sFromAddress.compare("anon") == 0)
+                continue;
+        }
+
+        if (fDebugSmsg)
+            printf("Decrypted message with %s.\n", scanKey.sAddress.c_str());
+
+        vReceived.push_back(std::make_pair(i, scanKey.sAddress));
+    }
+
+    return true;
+}
+
+static int SecureMsgScanBatch(std::vector<SecMsgScanItem>& vItems, bool reportToGui)
+{
+    /*
+    Find the messages of vItems that belong to this node and add them to the inbox db.
+    vItems should be messages of one bucket.
+
+    returns the number of messages received
+    */
+
+    if (vItems.empty())
+        return 0;
+
+    std::vector<std::pair<size_t, std::string> > vReceived;
+    if (pwalletMain->IsLocked() || !SecureMsgTrialBatch(vItems, vReceived))
+    {
+        if (fDebugSmsg)
+            printf("ScanBatch: Wallet is locked, storing %u messages to scan later.\n", (unsigned int)vItems.size());
+
+        BOOST_FOREACH(const SecMsgScanItem& item, vItems)
+            SecureMsgStoreUnscanned(item.header, &item.vchPayload[0]);
+        return 0;
+    }
+
+    int nReceived = 0;
+    for (size_t i = 0; i < vReceived.size(); ++i)
+    {
+        const SecMsgScanItem& item = vItems[vReceived[i].first];
+        if (SecureMsgSaveInbox(item.header, &item.vchPayload[0], vReceived[i].second, reportToGui) == 0)
+            nReceived++;
+    }
+
+    return nReceived;
+}
+
+static void SecureMsgQueueScan(std::vector<SecMsgScanItem>& vItems)
+{
+    if (vItems.empty())
+        return;
+
+    if (!psmsgScanThreads)
+    {
+        SecureMsgScanBatch(vItems, true);
+        return;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(cs_smsgScanQueue);
+        smsgScanQueue.push_back(std::vector<SecMsgScanItem>());
+        smsgScanQueue.back().swap(vItems);
+    }
+    condSmsgScanQueue.notify_one();
+}
+
+static void ThreadSecureMsgTrial(CCheckQueue<CSecMsgTrialCheck>* pqueue)
+{
+    RenameThread("bitcredit-smsgtrial");
+    pqueue->Thread();
+}
+
+static void ThreadSecureMsgScan()
+{
+    RenameThread("bitcredit-smsgscan");
+
+    for (;;)
+    {
+        std::vector<SecMsgScanItem> vItems;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_smsgScanQueue);
+            while (smsgScanQueue.empty())
+                condSmsgScanQueue.wait(lock);
+            vItems.swap(smsgScanQueue.front());
+            smsgScanQueue.pop_front();
+        }
+
+        // -- finish the batch, stopping only while waiting for the next
+        boost::this_thread::disable_interruption di;
+        SecureMsgScanBatch(vItems, true);
+    }
+}
+
+static int SecureMsgScanThreadCount()
+{
+    // -- -smsgscanthreads sizes both the trial decryption and the chain scan
+    int nThreads = GetArg("-smsgscanthreads", 0);
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    if (nThreads <= 0)
+        nThreads = 1;
+    if (nThreads > (int)SMSG_MAX_SCAN_THREADS)
+        nThreads = SMSG_MAX_SCAN_THREADS;
+    return nThreads;
+}
+
+static void SecureMsgStartScanThreads()
+{
+    int nThreads = SecureMsgScanThreadCount();
+
+    psmsgScanThreads = new boost::thread_group();
+    psmsgScanThreads->create_thread(&ThreadSecureMsgScan);
+    if (nThreads > 1)
+    {
+        // -- the thread driving a batch is the last trial worker
+        psmsgTrialQueue = new CCheckQueue<CSecMsgTrialCheck>(16);
+        for (int i = 0; i < nThreads - 1; i++)
+            psmsgScanThreads->create_thread(boost::bind(&ThreadSecureMsgTrial, psmsgTrialQueue));
+    }
+
+    if (fDebugSmsg)
+        printf("Started %d secure message scan threads.\n", nThreads);
+}
+
+static void SecureMsgStopScanThreads()
+{
+    if (!psmsgScanThreads)
+        return;
+
+    psmsgScanThreads->interrupt_all();
+    psmsgScanThreads->join_all();
+    delete psmsgScanThreads;
+    psmsgScanThreads = NULL;
+
+    {
+        boost::lock_guard<boost::mutex> lock(cs_smsgTrialMaster);
+        delete psmsgTrialQueue;
+        psmsgTrialQueue = NULL;
+    }
+
+    // -- the messages are already stored in their buckets, nothing else would scan them again:
+    //    keep them in the wl files for the unlock scan, which also runs on the next start
+    std::deque<std::vector<SecMsgScanItem> > queue;
+    {
+        boost::lock_guard<boost::mutex> lock(cs_smsgScanQueue);
+        queue.swap(smsgScanQueue);
+    }
+    uint32_t nKept = 0;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        BOOST_FOREACH(const SecMsgScanItem& item, queue[i])
+            if (SecureMsgStoreUnscanned(item.header, &item.vchPayload[0]) == 0)
+                nKept++;
+    }
+    if (nKept > 0)
+        printf("Stored %u unscanned secure messages to scan on the next start.\n", nKept);
+}
+
+
+/*
+    Unlock scan
+
+    Messages received while the wallet is locked are appended to
+    <bucket>_01_wl.dat. When the wallet is unlocked ThreadSecureMsgUnlockScan()
+    works through those files in the background, oldest bucket first, so
+    unlocking returns at once. Each file is read SMSG_UNLOCK_SCAN_CHUNK
+    messages at a time, every chunk going through the trial decryption pool,
+    and the messages found are written to the inbox in one batch per bucket
+    before the file is removed. A pass stops when the wallet is locked again
+    or messaging is disabled; the files left over are scanned on the next
+    unlock, so the scan resumes where it stopped. Batches still waiting for
+    trial decryption when messaging stops are written to the wl files too,
+    and a pass runs at start whenever the wallet is not locked. A file whose
+    scan stops at a cut off or corrupt message is removed once the messages
+    before it are in the inbox.
+*/
+
+static boost::thread smsgUnlockScanThread;
+static boost::mutex cs_smsgUnlockScan;
+static SecMsgUnlockScanStatus smsgUnlockScanStatus;  // guarded by cs_smsgUnlockScan
+static bool fSmsgUnlockScanAgain = false;           // guarded by cs_smsgUnlockScan
+
+// -- serialises appends to the wl files with their removal
+static CCriticalSection cs_smsgUnscanned;
+
+static int SecureMsgScanFile(const fs::path& path, bool fUnlockScan, uint64_t& nBytesRead, uint32_t& nMessages, uint32_t& nReceived)
+{
+    /*
+    Trial decrypt all messages of a bucket file and add the ones for this node to the inbox db,
+    all in one batch.
+
+    returns
+        0 success,
+        1 error
+        2 stopped, wallet was locked or the thread interrupted
+    */
+
+    FILE *fp;
+    errno = 0;
+    if (!(fp = fopen(path.string().c_str(), "rb"))) {
+        printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
+        return 1;
+    }
+
+    std::vector<std::pair<std::vector<unsigned char>, SecMsgStored> > vInbox;
+    SecureMessageHeader smsg;
+    int rv = 0;
+    bool fEnd = false;
+    nBytesRead = 0;
+    while (!fEnd) {
+        std::vector<SecMsgScanItem> vItems;
+        uint64_t nChunkBytes = 0;
+        while (vItems.size() < SMSG_UNLOCK_SCAN_CHUNK) {
+            errno = 0;
+            if (fread(smsg.begin(), sizeof(unsigned char), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
+                if (errno != 0)
+                    printf("fread header failed: %s\n", strerror(errno));
+                fEnd = true;
+                break;
+            }
+
+            if (smsg.nPayload > SMSG_MAX_MSG_WORST) {
+                printf("SecureMsgScanFile(): Payload too large, %u\n", smsg.nPayload);
+                fEnd = true;
+                break;
+            }
+
+            vItems.push_back(SecMsgScanItem());
+            vItems.back().header = smsg;
+            vItems.back().vchPayload.resize(smsg.nPayload);
+
+            if (fread(&vItems.back().vchPayload[0], 1, smsg.nPayload, fp) != smsg.nPayload) {
+                printf("fread data failed: %s\n", strerror(errno));
+                vItems.pop_back();
+                fEnd = true;
+                break;
+            }
+            nChunkBytes += SMSG_HDR_LEN + smsg.nPayload;
+        }
+
+        std::vector<std::pair<size_t, std::string> > vReceived;
+        if (!SecureMsgTrialBatch(vItems, vReceived)) {
+            rv = 2;
+            break;
+        }
+
+        for (size_t i = 0; i < vReceived.size(); ++i) {
+            const SecMsgScanItem& item = vItems[vReceived[i].first];
+            vInbox.push_back(std::make_pair(std::vector<unsigned char>(18), SecMsgStored()));
+            if (!SecureMsgMakeInbox(item.header, &item.vchPayload[0], vReceived[i].second, &vInbox.back().first[0], vInbox.back().second))
+                vInbox.pop_back();
+        }
+
+        nBytesRead += nChunkBytes;
+        nMessages += vItems.size();
+        if (fUnlockScan) {
+            boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+            smsgUnlockScanStatus.nBytesDone += nChunkBytes;
+            smsgUnlockScanStatus.nMessages += vItems.size();
+        }
+
+        if (fUnlockScan && boost::this_thread::interruption_requested()) {
+            rv = 2;
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    if (rv != 0)
+        return rv;
+
+    if (vInbox.empty())
+        return 0;
+
+    // -- one batch for the whole bucket, a message already in the inbox is skipped
+    uint32_t nAdded = 0;
+    {
+        LOCK(cs_smsgDB);
+        SecMsgDB dbInbox;
+
+        if (!dbInbox.Open("cw"))
+            return 1;
+
+        dbInbox.TxnBegin();
+        for (size_t i = 0; i < vInbox.size(); ++i) {
+            if (dbInbox.ExistsSmesg(&vInbox[i].first[0]))
+                continue;
+            dbInbox.WriteSmesg(&vInbox[i].first[0], vInbox[i].second);
+            nAdded++;
+        }
+        if (!dbInbox.TxnCommit())
+            return 1;
+    }
+
+    if (nAdded > 0)
+        printf("SecureMsg saved %u messages to inbox from %s.\n", nAdded, path.filename().string().c_str());
+
+    nReceived += nAdded;
+    if (fUnlockScan) {
+        boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+        smsgUnlockScanStatus.nReceived += nAdded;
+    }
+    return 0;
+}
+
+static bool SecureMsgWlRecordAt(const fs::path& path, uint64_t nOffset, uint64_t nFileSize)
+{
+    /*
+    Whether a complete message with a sane header starts at nOffset of wl file path, must hold cs_smsgUnscanned
+    */
+
+    if (nOffset > nFileSize || nFileSize - nOffset < SMSG_HDR_LEN)
+        return false;
+
+    FILE *fp;
+    if (!(fp = fopen(path.string().c_str(), "rb")))
+        return true; // can't tell, keep the file
+
+    SecureMessageHeader smsg;
+    bool fHeader = fseek(fp, nOffset, SEEK_SET) == 0
+        && fread(smsg.begin(), sizeof(unsigned char), SMSG_HDR_LEN, fp) == (size_t)SMSG_HDR_LEN;
+    fclose(fp);
+
+    return fHeader
+        && smsg.nPayload <= SMSG_MAX_MSG_WORST
+        && nFileSize - nOffset - SMSG_HDR_LEN >= smsg.nPayload;
+}
+
+static void SecureMsgUnlockScan()
+{
+    int64_t mStart = GetTimeMillis();
+    int64_t now = GetTime();
+
+    // -- collect the wl files, oldest first as those expire first
+    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
+    std::vector<std::pair<int64_t, fs::path> > vFiles;
+    uint64_t nBytes = 0;
+    try {
+        if (!fs::is_directory(pathSmsgDir))
+            return;
+
+        fs::directory_iterator itend;
+        for (fs::directory_iterator itd(pathSmsgDir); itd != itend; ++itd) {
+            if (!fs::is_regular_file(itd->status()))
+                continue;
+
+            std::string fileName = itd->path().filename().string();
+            if (!boost::algorithm::ends_with(fileName, "_01_wl.dat"))
+                continue;
+
+            int64_t fileTime;
+            try {
+                fileTime = boost::lexical_cast<int64_t>(fileName.substr(0, fileName.find_first_of("_")));
+            } catch (const boost::bad_lexical_cast&) {
+                continue;
+            }
+
+            if (fileTime < now - SMSG_RETENTION) {
+                printf("Dropping file %s, expired.\n", fileName.c_str());
+                fs::remove(itd->path());
+                continue;
+            }
+
+            vFiles.push_back(std::make_pair(fileTime, itd->path()));
+            nBytes += fs::file_size(itd->path());
+        }
+    } catch (const fs::filesystem_error& ex) {
+        printf("SecureMsgUnlockScan(): %s\n", ex.what());
+    }
+    std::sort(vFiles.begin(), vFiles.end());
+
+    {
+        boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+        smsgUnlockScanStatus.nStartTime = now;
+        smsgUnlockScanStatus.nFiles = vFiles.size();
+        smsgUnlockScanStatus.nFilesDone = 0;
+        smsgUnlockScanStatus.nBytes = nBytes;
+        smsgUnlockScanStatus.nBytesDone = 0;
+        smsgUnlockScanStatus.nMessages = 0;
+        smsgUnlockScanStatus.nReceived = 0;
+    }
+
+    uint32_t nFiles = 0;
+    uint32_t nMessages = 0;
+    uint32_t nReceived = 0;
+    bool fStopped = false;
+    for (size_t i = 0; i < vFiles.size(); ++i) {
+        if (pwalletMain->IsLocked() || boost::this_thread::interruption_requested()) {
+            fStopped = true;
+            break;
+        }
+
+        uint64_t nBytesRead;
+        int rv = SecureMsgScanFile(vFiles[i].second, true, nBytesRead, nMessages, nReceived);
+        if (rv == 2) {
+            fStopped = true;
+            break;
+        }
+        if (rv != 0) {
+            printf("SecureMsgUnlockScan(): failed to scan %s, keeping it.\n", vFiles[i].second.filename().string().c_str());
+            continue;
+        }
+
+        // -- remove wl file when scanned, unless messages were appended meanwhile
+        {
+            LOCK(cs_smsgUnscanned);
+            try {
+                uint64_t nFileSize = fs::file_size(vFiles[i].second);
+                if (nFileSize == nBytesRead) {
+                    fs::remove(vFiles[i].second);
+                } else if (!SecureMsgWlRecordAt(vFiles[i].second, nBytesRead, nFileSize)) {
+                    // -- the scan stopped at a message that is still cut off or corrupt with no append
+                    //    in progress, it would stop there on every unlock. Everything before it is
+                    //    scanned, so the file goes rather than being truncated to scanned messages.
+                    printf("Removing wl file %s, corrupt after %u of %u bytes.\n",
+                        vFiles[i].second.filename().string().c_str(), (unsigned int)nBytesRead, (unsigned int)nFileSize);
+                    fs::remove(vFiles[i].second);
+                }
+            } catch (const fs::filesystem_error& ex) {
+                printf("Error removing wl file %s - %s\n", vFiles[i].second.filename().string().c_str(), ex.what());
+            }
+        }
+
+        nFiles++;
+        boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+        smsgUnlockScanStatus.nFilesDone++;
+    }
+
+    printf("Unlock scan %s: processed %u of %u files, scanned %u messages, received %u messages.\n",
+        fStopped ? "stopped" : "done", nFiles, (unsigned int)vFiles.size(), nMessages, nReceived);
+    printf("Took %d ms\n", (int)(GetTimeMillis() - mStart));
+
+    // -- notify gui
+    NotifySecMsgWalletUnlocked();
+}
+
+static void ThreadSecureMsgUnlockScan()
+{
+    RenameThread("bitcredit-smsgunlock");
+
+    // -- unlocking again while a pass runs queues one more pass
+    for (;;) {
+        {
+            boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+            fSmsgUnlockScanAgain = false;
+        }
+
+        SecureMsgUnlockScan();
+
+        boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+        if (!fSmsgUnlockScanAgain || boost::this_thread::interruption_requested()) {
+            smsgUnlockScanStatus.fRunning = false;
+            break;
+        }
+    }
+}
+
+int SecureMsgWalletUnlocked()
+{
+    if (!fSecMsgEnabled)
+        return 0;
+
+    boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+    if (smsgUnlockScanStatus.fRunning) {
+        fSmsgUnlockScanAgain = true;
+        return 0;
+    }
+
+    // -- an earlier pass has finished, only reap its thread
+    if (smsgUnlockScanThread.joinable())
+        smsgUnlockScanThread.join();
+
+    smsgUnlockScanStatus.fRunning = true;
+    smsgUnlockScanThread = boost::thread(&ThreadSecureMsgUnlockScan);
+    return 0;
+}
+
+static void SecureMsgStopUnlockScan()
+{
+    smsgUnlockScanThread.interrupt();
+    if (smsgUnlockScanThread.joinable())
+        smsgUnlockScanThread.join();
+
+    boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+    smsgUnlockScanStatus.fRunning = false;
+}
+
+void SecureMsgGetUnlockScanStatus(SecMsgUnlockScanStatus& status)
+{
+    boost::lock_guard<boost::mutex> lock(cs_smsgUnlockScan);
+    status = smsgUnlockScanStatus;
+}
+
+
+/*
+    Bucket files
+
+    <bucket>_01.dat holds the messages of a bucket back to back, each a
+    SMSG_HDR_LEN header followed by its payload, in the order received.
+
+    <bucket>_01.idx indexes it: a SecMsgIndexHeader followed by one
+    SecMsgIndexEntry per message. The header records how much of the .dat
+    file the index covers; an index that does not match its .dat file is
+    rebuilt by scanning the .dat file, so losing it costs only time.
+
+    At startup only the indexes are read. Messages are served to peers
+    straight out of a read-only mapping of the .dat file.
+*/
+
+static const char SMSG_INDEX_MAGIC[4] = {'S', 'M', 'I', 'X'};
+static const uint32_t SMSG_INDEX_VERSION = 1;
+
+struct SecMsgIndexHeader {
+    char            magic[4];
+    uint32_t        nVersion;
+    uint64_t        nDataSize;      // bytes of the .dat file indexed
+    uint32_t        nCount;
+    uint32_t        reserved;
+};
+
+struct SecMsgIndexEntry {
+    int64_t         timestamp;
+    unsigned char   sample[8];
+    uint64_t        offset;
+    uint32_t        nPayload;
+    uint32_t        reserved;
+};
+
+BOOST_STATIC_ASSERT(sizeof(SecMsgIndexHeader) == 24);
+BOOST_STATIC_ASSERT(sizeof(SecMsgIndexEntry) == 32);
+
+class SecMsgBucketMap
+{
+public:
+    SecMsgBucketMap(const std::string& path, size_t nSize) :
+        file(path.c_str(), boost::interprocess::read_only),
+        region(file, boost::interprocess::read_only, 0, nSize) {}
+
+    const unsigned char* begin() const { return (const unsigned char*) region.get_address(); }
+    size_t size() const { return region.get_size(); }
+
+private:
+    boost::interprocess::file_mapping file;
+    boost::interprocess::mapped_region region;
+};
+
+
+static fs::path SecureMsgBucketPath(int64_t bucket, const char* suffix)
+{
+    return GetDataDir() / "smsgStore" / (boost::lexical_cast<std::string>(bucket) + suffix);
+}
+
+static bool SecureMsgWriteIndex(int64_t bucket, uint64_t nDataSize, const std::vector<SecMsgIndexEntry>& vEntries)
+{
+    fs::path pathIndex = SecureMsgBucketPath(bucket, "_01.idx");
+
+    FILE *fp;
+    if (!(fp = fopen(pathIndex.string().c_str(), "wb"))) {
+        printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
+        return false;
+    }
+
+    SecMsgIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SMSG_INDEX_MAGIC, 4);
+    header.nVersion  = SMSG_INDEX_VERSION;
+    header.nDataSize = nDataSize;
+    header.nCount    = vEntries.size();
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1
+        || (!vEntries.empty() && fwrite(&vEntries[0], sizeof(SecMsgIndexEntry), vEntries.size(), fp) != vEntries.size())) {
+        printf("fwrite failed: %s\n", strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static bool SecureMsgRebuildIndex(int64_t bucket, SecMsgBucket& bkt, std::vector<SecMsgIndexEntry>& vEntries)
+{
+    /*
+        Scan the .dat file of bucket and write its index.
+        Only a last message cut short by a crash is trimmed off, any other damage fails the rebuild
+        and leaves the file as it is.
+    */
+
+    fs::path pathData = SecureMsgBucketPath(bucket, "_01.dat");
+
+    if (fDebugSmsg)
+        printf("Rebuilding index of %s.\n", pathData.string().c_str());
+
+    uint64_t nFileSize;
+    try {
+        nFileSize = fs::file_size(pathData);
+    } catch (const fs::filesystem_error& ex) {
+        printf("Error reading size of %s.\n", ex.what());
+        return false;
+    }
+
+    FILE *fp;
+    if (!(fp = fopen(pathData.string().c_str(), "rb"))) {
+        printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
+        return false;
+    }
+
+    vEntries.clear();
+    SecureMessageHeader smsg;
+    uint64_t nDataSize = 0;
+    bool fCorrupt = false;
+    while (nDataSize + SMSG_HDR_LEN <= nFileSize) {
+        if (fread(&smsg, sizeof(unsigned char), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
+            printf("fread header failed: %s\n", strerror(errno));
+            fCorrupt = true;
+            break;
+        }
+
+        if (smsg.nPayload < 8 || smsg.nPayload > SMSG_MAX_MSG_WORST) {
+            printf("Bad payload size %u at offset %lu.\n", smsg.nPayload, (unsigned long) nDataSize);
+            fCorrupt = true;
+            break;
+        }
+
+        // -- a message running past the end of the file is the partly written last one
+        if (nDataSize + SMSG_HDR_LEN + smsg.nPayload > nFileSize)
+            break;
+
+        SecMsgIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.timestamp = smsg.timestamp;
+        entry.offset    = nDataSize;
+        entry.nPayload  = smsg.nPayload;
+
+        if (fread(entry.sample, sizeof(unsigned char), 8, fp) != 8
+            || fseek(fp, smsg.nPayload-8, SEEK_CUR) != 0) {
+            printf("fread data failed: %s\n", strerror(errno));
+            fCorrupt = true;
+            break;
+        }
+
+        nDataSize += SMSG_HDR_LEN + smsg.nPayload;
+        vEntries.push_back(entry);
+    }
+
+    fclose(fp);
+
+    if (fCorrupt) {
+        printf("Could not rebuild index of %s, file is damaged.\n", pathData.string().c_str());
+        vEntries.clear();
+        return false;
+    }
+
+    // -- a partly written last message is left out, and overwritten by the next one
+    if (nDataSize != nFileSize) {
+        bkt.pmap.reset();
+        try {
+            fs::resize_file(pathData, nDataSize);
+        }
+        catch (const fs::filesystem_error& ex) {
+            printf("Error trimming bucket file %s.\n", ex.what());
+            return false;
+        }
+    }
+
+    return SecureMsgWriteIndex(bucket, nDataSize, vEntries);
+}
+
+static bool SecureMsgReadIndex(int64_t bucket, std::vector<SecMsgIndexEntry>& vEntries)
+{
+    /*
+        Load the index of bucket, false if it is missing or does not match the .dat file.
+    */
+
+    fs::path pathIndex = SecureMsgBucketPath(bucket, "_01.idx");
+    fs::path pathData = SecureMsgBucketPath(bucket, "_01.dat");
+
+    try {
+        if (!fs::exists(pathIndex))
+            return false;
+
+        uint64_t nIndexSize = fs::file_size(pathIndex);
+        if (nIndexSize < sizeof(SecMsgIndexHeader))
+            return false;
+
+        boost::interprocess::file_mapping file(pathIndex.string().c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(file, boost::interprocess::read_only);
+        const unsigned char* p = (const unsigned char*) region.get_address();
+
+        SecMsgIndexHeader header;
+        memcpy(&header, p, sizeof(header));
+        if (memcmp(header.magic, SMSG_INDEX_MAGIC, 4) != 0
+            || header.nVersion != SMSG_INDEX_VERSION
+            || nIndexSize != sizeof(header) + (uint64_t)header.nCount * sizeof(SecMsgIndexEntry)
+            || header.nDataSize != fs::file_size(pathData))
+            return false;
+
+        vEntries.resize(header.nCount);
+        if (header.nCount > 0)
+            memcpy(&vEntries[0], p + sizeof(header), header.nCount * sizeof(SecMsgIndexEntry));
+    } catch (const std::exception& e) {
+        printf("Error reading index %s: %s\n", pathIndex.string().c_str(), e.what());
+        return false;
+    }
+
+    return true;
+}
+
+static bool SecureMsgIndexCheck(int64_t bucket, SecMsgBucket& bkt)
+{
+    /*
+        Make sure the index of bucket covers the whole .dat file before a message is appended to both.
+        Only the index header is read, the full index is read at startup only. A .dat file cut
+        short by a crash is trimmed back to its last whole message by the rebuild.
+    */
+
+    fs::path pathData = SecureMsgBucketPath(bucket, "_01.dat");
+    boost::system::error_code ec;
+    uint64_t nDataSize = fs::file_size(pathData, ec);
+    if (ec)
+        return true;    // -- no .dat file yet
+
+    fs::path pathIndex = SecureMsgBucketPath(bucket, "_01.idx");
+    SecMsgIndexHeader header;
+    FILE *fp;
+    if ((fp = fopen(pathIndex.string().c_str(), "rb"))) {
+        bool fRead = fread(&header, sizeof(header), 1, fp) == 1;
+        fclose(fp);
+        if (fRead
+            && memcmp(header.magic, SMSG_INDEX_MAGIC, 4) == 0
+            && header.nVersion == SMSG_INDEX_VERSION
+            && header.nDataSize == nDataSize)
+            return true;
+    }
+
+    std::vector<SecMsgIndexEntry> vEntries;
+    return SecureMsgRebuildIndex(bucket, bkt, vEntries);
+}
+
+static bool SecureMsgIndexAppend(int64_t bucket, SecMsgBucket& bkt, const SecMsgToken& token, uint32_t nPayload)
+{
+    /*
+        Add the message just appended to the .dat file at token.offset to the index.
+    */
+
+    fs::path pathIndex = SecureMsgBucketPath(bucket, "_01.idx");
+
+    SecMsgIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.timestamp = token.timestamp;
+    memcpy(entry.sample, token.sample, 8);
+    entry.offset    = token.offset;
+    entry.nPayload  = nPayload;
+    uint64_t nDataSize = token.offset + SMSG_HDR_LEN + nPayload;
+
+    FILE *fp = NULL;
+    SecMsgIndexHeader header;
+    if (token.offset == 0) {
+        // -- new .dat file, start a new index
+        return SecureMsgWriteIndex(bucket, nDataSize, std::vector<SecMsgIndexEntry>(1, entry));
+    }
+
+    if (!(fp = fopen(pathIndex.string().c_str(), "r+b"))
+        || fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, SMSG_INDEX_MAGIC, 4) != 0
+        || header.nVersion != SMSG_INDEX_VERSION
+        || header.nDataSize != (uint64_t)token.offset) {
+        // -- index missing or stale
+        if (fp)
+            fclose(fp);
+        std::vector<SecMsgIndexEntry> vEntries;
+        return SecureMsgRebuildIndex(bucket, bkt, vEntries);
+    }
+
+    header.nDataSize = nDataSize;
+    header.nCount++;
+
+    if (fseek(fp, sizeof(header) + (long)(header.nCount - 1) * sizeof(SecMsgIndexEntry), SEEK_SET) != 0
+        || fwrite(&entry, sizeof(entry), 1, fp) != 1
+        || fseek(fp, 0, SEEK_SET) != 0
+        || fwrite(&header, sizeof(header), 1, fp) != 1) {
+        printf("Error updating index %s: %s\n", pathIndex.string().c_str(), strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static bool SecureMsgMapBucket(int64_t bucket, SecMsgBucket& bkt, uint64_t nNeed, const unsigned char*& pBegin, size_t& nSize)
+{
+    /*
+        Map the .dat file of bucket so that at least nNeed bytes are visible.
+        The file only grows, so an existing mapping is kept until a message past its end is wanted.
+        Must hold bkt.cs.
+    */
+
+    if (!bkt.pmap || bkt.pmap->size() < nNeed) {
+        fs::path pathData = SecureMsgBucketPath(bucket, "_01.dat");
+        try {
+            uint64_t nFileSize = fs::file_size(pathData);
+            if (nFileSize < nNeed)
+                return false;
+            bkt.pmap.reset(new SecMsgBucketMap(pathData.string(), nFileSize));
+        } catch (const std::exception& e) {
+            printf("Error mapping %s: %s\n", pathData.string().c_str(), e.what());
+            return false;
+        }
+    }
+
+    pBegin = bkt.pmap->begin();
+    nSize  = bkt.pmap->size();
+    return true;
+}
+
+boost::shared_ptr<SecMsgBucket> SecureMsgGetBucket(int64_t bucket, bool fCreate)
+{
+    /*
+        The bucket stays valid after it is expired and taken out of smsgBuckets,
+        check fRemoved under its lock before adding to it.
+    */
+
+    LOCK(cs_smsgBuckets);
+    std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it = smsgBuckets.find(bucket);
+    if (it != smsgBuckets.end())
+        return it->second;
+    if (!fCreate)
+        return boost::shared_ptr<SecMsgBucket>();
+
+    boost::shared_ptr<SecMsgBucket> pbkt(new SecMsgBucket());
+    smsgBuckets[bucket] = pbkt;
+    return pbkt;
+}
+
+void SecureMsgRemoveBucketFiles(int64_t bucket, SecMsgBucket& bkt)
+{
+    // -- mapped files can't be removed everywhere, unmap first
+    bkt.pmap.reset();
+    bkt.fRemoved = true;
+
+    const char* suffixes[] = {"_01.dat", "_01.idx"};
+    for (unsigned int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+        fs::path fullPath = SecureMsgBucketPath(bucket, suffixes[i]);
+        try {
+            fs::remove(fullPath);
+        }
+        catch (const fs::filesystem_error& ex) {
+            printf("Error removing bucket file %s.\n", ex.what());
+        }
+    }
+}
+
+int SecureMsgBuildBucketSet()
+{
+    /*
+        Build the bucket set by scanning the files in the smsgStore dir.
+
+        smsgBuckets should be empty
+    */
+
+    if (fDebugSmsg)
+        printf("SecureMsgBuildBucketSet()\n");
+
+    int64_t  now            = GetTime();
+    uint32_t nFiles         = 0;
+    uint32_t nBuckets       = 0;
+    uint32_t nMessages      = 0;
+
+    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
+    fs::directory_iterator itend;
+
+
+    if (!fs::exists(pathSmsgDir)
+        || !fs::is_directory(pathSmsgDir))
+    {
+        if (!fs::create_directory(pathSmsgDir)) {
+            printf("Message store directory does not exist and could not be created.\n");
+            return 1;
+        }
+    }
+
+    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd) {
+        if (!fs::is_regular_file(itd->status()))
+            continue;
+
+        std::string fileType = (*itd).path().extension().string();
+
+        if (fileType.compare(".dat") != 0)
+            continue;
+
+        std::string fileName = (*itd).path().filename().string();
+
+
+        if (fDebugSmsg)
+            printf("Processing file: %s.\n", fileName.c_str());
+
+        nFiles++;
+
+        // TODO files must be split if > 2GB
+        // time_noFile.dat
+        size_t sep = fileName.find_first_of("_");
+        if (sep == std::string::npos)
+            continue;
+
+        std::string stime = fileName.substr(0, sep);
+
+        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
+
+        if (fileTime < now - SMSG_RETENTION) {
+            printf("Dropping file %s, expired.\n", fileName.c_str());
+            try {
+                fs::remove((*itd).path());
+                fs::remove(SecureMsgBucketPath(fileTime, "_01.idx"));
+            }
+            catch (const fs::filesystem_error& ex) {
+                printf("Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
+            }
+            continue;
+        }
+
+        if (boost::algorithm::ends_with(fileName, "_wl.dat")) {
+            if (fDebugSmsg)
+                printf("Skipping wallet locked file: %s.\n", fileName.c_str());
+            continue;
+        }
+
+        boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(fileTime, true);
+        LOCK(pbkt->cs);
+        std::set<SecMsgToken>& tokenSet = pbkt->setTokens;
+
+        std::vector<SecMsgIndexEntry> vEntries;
+        if (!SecureMsgReadIndex(fileTime, vEntries)
+            && !SecureMsgRebuildIndex(fileTime, *pbkt, vEntries))
+            printf("Could not index %s.\n", fileName.c_str());
+
+        for (std::vector<SecMsgIndexEntry>::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+            SecMsgToken token;
+            token.timestamp = it->timestamp;
+            memcpy(token.sample, it->sample, 8);
+            token.offset = it->offset;
+            pbkt->addToken(token);
+        }
+        pbkt->hashBucket();
+
+        nMessages += tokenSet.size();
+
+        if (fDebugSmsg)
+            printf("Bucket %d contains %d messages.\n", (int) fileTime, (int) tokenSet.size());
     }
 
-    printf("Processed %u files, loaded %d buckets containing %u messages.\n", nFiles, (int) smsgBuckets.size(), nMessages);
+    {
+        LOCK(cs_smsgBuckets);
+        nBuckets = smsgBuckets.size();
+    }
+    printf("Processed %u files, loaded %u buckets containing %u messages.\n", nFiles, nBuckets, nMessages);
 
     return 0;
 }
@@ -1011,6 +2239,15 @@ bool SecureMsgStart(bool fDontStart, bool fScanChain) {
 }
 
 
+void SecureMsgReadArgs()
+{
+    nSmsgLocalFlags = SMSG_PEER_DIGEST;
+    if (GetBoolArg("-smsgreconcile", true))
+        nSmsgLocalFlags |= SMSG_PEER_RECONCILE;
+    fSmsgRequireStamp = GetBoolArg("-smsgrequirestamp", false);
+    nSmsgPeerRate = std::max(0, (int)GetArg("-smsgpeerrate", 0));
+}
+
 bool SecureMsgEnable() {
     // -- start secure messaging at runtime
     if (fSecMsgEnabled) {
@@ -1032,7 +2269,10 @@ bool SecureMsgEnable() {
                 printf("Failed to load addresses from wallet.\n");
         }
 
-        smsgBuckets.clear(); // should be empty already
+        {
+            LOCK(cs_smsgBuckets);
+            smsgBuckets.clear(); // should be empty already
+        }
 
         if (SecureMsgBuildBucketSet() != 0) {
             printf("SecureMsgEnable: could not load bucket sets, secure messaging disabled.\n");
@@ -1048,13 +2288,20 @@ bool SecureMsgEnable() {
         fSecMsgEnabled = false;
         return false;
     }
+    SecureMsgStartScanThreads();
+
+    // -- pick up the wl files left by a locked wallet or by the last shutdown
+    if (pwalletMain && !pwalletMain->IsLocked())
+        SecureMsgWalletUnlocked();
+
+    SecureMsgReadArgs();
 
     // -- ping each peer, don't know which have messaging enabled
     {
         LOCK(cs_vNodes);
         BOOST_FOREACH(CNode* pnode, vNodes) {
-            pnode->PushMessage("smsgPing");
-            pnode->PushMessage("smsgPong"); // Send pong as have missed initial ping sent by peer when it connected
+            pnode->PushMessage("smsgPing", nSmsgLocalFlags);
+            pnode->PushMessage("smsgPong", nSmsgLocalFlags); // Send pong as have missed initial ping sent by peer when it connected
         }
     }
 
@@ -1074,13 +2321,11 @@ bool SecureMsgDisable() {
         LOCK(cs_smsg);
         fSecMsgEnabled = false;
 
-        // -- clear smsgBuckets
-        std::map<int64_t, SecMsgBucket>::iterator it;
-        it = smsgBuckets.begin();
-        for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it) {
-            it->second.setTokens.clear();
+        // -- clear smsgBuckets, a bucket still in use is freed by its last user
+        {
+            LOCK(cs_smsgBuckets);
+            smsgBuckets.clear();
         }
-        smsgBuckets.clear();
 
         // -- tell each smsg enabled peer that this node is disabling
         {
@@ -1094,28 +2339,222 @@ bool SecureMsgDisable() {
             }
         }
 
-        if (SecureMsgWriteIni() != 0)
-            printf("Failed to save smsg.ini\n");
+        if (SecureMsgWriteIni() != 0)
+            printf("Failed to save smsg.ini\n");
+
+        smsgAddresses.clear();
+
+    } // LOCK(cs_smsg);
+
+    secureMsgThread.interrupt();
+    if (secureMsgThread.joinable())
+        secureMsgThread.join();
+    SecureMsgStopUnlockScan();
+    SecureMsgStopScanThreads();
+
+    if (smsgDB) {
+        LOCK(cs_smsgDB);
+        delete smsgDB;
+        smsgDB = NULL;
+    }
+
+
+    printf("Secure messaging disabled.\n");
+    return true;
+}
+
+
+uint32_t SecureMsgPeerAllowance(CNode* pnode)
+{
+    /*
+        Refill the peer's token bucket for -smsgpeerrate and return how many messages it may send now
+    */
+
+    if (nSmsgPeerRate <= 0)
+        return std::numeric_limits<uint32_t>::max();
+
+    SecMsgNode& data = pnode->smsgData;
+    int64_t nNow = GetTimeMillis();
+    if (data.nRateTime == 0)
+        data.dRateAllowance = nSmsgPeerRate;
+    else
+        data.dRateAllowance = std::min((double) nSmsgPeerRate,
+            data.dRateAllowance + (double) (nNow - data.nRateTime) * nSmsgPeerRate / (SMSG_RATE_PERIOD * 1000));
+    data.nRateTime = nNow;
+
+    return data.dRateAllowance < 1 ? 0 : (uint32_t) data.dRateAllowance;
+}
+
+static void SecureMsgPushHave(CNode* pto, int64_t time, SecMsgBucket& bkt)
+{
+    /*
+        Send peer the token list of bucket, must hold bkt.cs
+    */
+
+    std::set<SecMsgToken>& tokenSet = bkt.setTokens;
+    std::vector<unsigned char> vchDataOut;
+
+    try { vchDataOut.resize(8 + 16 * tokenSet.size()); } catch (std::exception& e)
+    {
+        std::cout << "vchDataOut.resize " << (8 + 16 * tokenSet.size()) << " threw " << e.what() << std::endl;
+        return;
+    }
+    memcpy(&vchDataOut[0], &time, 8);
+
+    unsigned char* p = &vchDataOut[8];
+    for (std::set<SecMsgToken>::iterator it = tokenSet.begin(); it != tokenSet.end(); ++it)
+    {
+        memcpy(p, &it->timestamp, 8);
+        memcpy(p+8, &it->sample, 8);
+
+        p += 16;
+    }
+    pto->PushMessage("smsgHave", vchDataOut);
+}
+
+static void SecureMsgPushBunch(CNode* pto, int64_t time, const SecMsgBucketMap& bmap,
+    const std::vector<std::pair<uint64_t, uint32_t> >& vSpans, uint64_t nBytes)
+{
+    /*
+        Send an smsgMsg bunch straight from the mapped bucket file into the
+        peer's send buffer, without first gathering it in a vector.
+        The bytes on the wire are those of PushMessage("smsgMsg", vchBunch).
+        Need not hold bkt.cs, the caller keeps a reference to the mapping.
+    */
+
+    uint32_t nBunch = vSpans.size();
+    try
+    {
+        pto->BeginMessage("smsgMsg");
+        pto->ssSend.reserve(pto->ssSend.size() + 9 + 4 + 8 + nBytes);
+        WriteCompactSize(pto->ssSend, 4 + 8 + nBytes);
+        pto->ssSend.write((const char*)&nBunch, 4);
+        pto->ssSend.write((const char*)&time, 8);
+        for (size_t i = 0; i < vSpans.size(); ++i)
+            pto->ssSend.write((const char*)bmap.begin() + vSpans[i].first, vSpans[i].second);
+        pto->EndMessage();
+    }
+    catch (...)
+    {
+        pto->AbortMessage();
+        throw;
+    }
+}
+
+static bool SecureMsgReceiveHave(CNode* pfrom, std::vector<unsigned char>& vchData)
+{
+    /*
+        Peer has the tokens in vchData (bucket time, then 16 bytes per token),
+        ask for those missing here with smsgWant
+    */
+
+    if (vchData.size() < 8)
+        return false;
+
+    int n = (vchData.size() - 8) / 16;
+
+    int64_t time;
+    memcpy(&time, &vchData[0], 8);
+
+    // -- Check time valid:
+    int64_t now = GetTime();
+    if (time < now - SMSG_RETENTION)
+    {
+        if (fDebugSmsg)
+            printf("Not interested in peer bucket %d, has expired.\n", (int32_t) time);
+        return false;
+    }
+    if (time > now + SMSG_TIME_LEEWAY)
+    {
+        if (fDebugSmsg)
+            printf("Not interested in peer bucket %d, in the future.\n", (int32_t) time);
+        Misbehaving(pfrom->id, 1);
+        return false;
+    }
+
+    boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(time, true);
+    LOCK(pbkt->cs);
+
+    if (pbkt->nLockCount > 0)
+    {
+        if (fDebugSmsg)
+            printf("Bucket %d lock count %u, waiting for message data from peer %u.\n", (int32_t) time, pbkt->nLockCount, pbkt->nLockPeerId);
+        return false;
+    }
+
+    if (fDebugSmsg)
+        printf("Sifting through bucket %d.\n", (int32_t) time);
+
+    std::vector<unsigned char> vchDataOut;
+    vchDataOut.resize(8);
+    memcpy(&vchDataOut[0], &vchData[0], 8);
+
+    std::set<SecMsgToken>& tokenSet = pbkt->setTokens;
+    std::set<SecMsgToken>::iterator it;
+    SecMsgToken token;
+    unsigned char* p = &vchData[8];
+
+    // -- don't ask for more than the peer's rate limit lets through
+    uint32_t nAllowance = SecureMsgPeerAllowance(pfrom);
 
-        smsgAddresses.clear();
+    for (int i = 0; i < n; ++i)
+    {
+        memcpy(&token.timestamp, p, 8);
+        memcpy(&token.sample, p+8, 8);
 
-    } // LOCK(cs_smsg);
+        it = tokenSet.find(token);
+        if (it == tokenSet.end()
+            && !pbkt->setRejected.count(token)
+            && (uint32_t) (vchDataOut.size() - 8) / 16 < nAllowance)
+        {
+            int nd = vchDataOut.size();
+            try {
+                vchDataOut.resize(nd + 16);
+            } catch (std::exception& e) {
+                printf("vchDataOut.resize %d threw: %s.\n", nd + 16, e.what());
+                continue;
+            }
 
-    secureMsgThread.interrupt();
-    if (secureMsgThread.joinable())
-        secureMsgThread.join();
+            memcpy(&vchDataOut[nd], p, 16);
+        }
 
-    if (smsgDB) {
-        LOCK(cs_smsgDB);
-        delete smsgDB;
-        smsgDB = NULL;
+        p += 16;
     }
 
+    if (vchDataOut.size() > 8)
+    {
+        if (fDebugSmsg)
+        {
+            printf("Asking peer for  %d messages.\n", (int) (vchDataOut.size() - 8) / 16);
+            printf("Locking bucket %d for peer %u.\n", (int) time, pfrom->smsgData.nPeerId);
+        }
+        pbkt->nLockCount   = 3; // lock this bucket for at most 3 * SMSG_THREAD_DELAY seconds, unset when peer sends smsgMsg
+        pbkt->nLockPeerId  = pfrom->smsgData.nPeerId;
+        pfrom->PushMessage("smsgWant", vchDataOut);
+    }
 
-    printf("Secure messaging disabled.\n");
     return true;
 }
 
+static void SecureMsgFillIBLT(const std::set<SecMsgToken>& setTokens, CIBLT& iblt)
+{
+    unsigned char key[IBLT_KEY_SIZE];
+    for (std::set<SecMsgToken>::const_iterator it = setTokens.begin(); it != setTokens.end(); ++it)
+    {
+        memcpy(key, &it->timestamp, 8);
+        memcpy(key+8, it->sample, 8);
+        iblt.insert(key);
+    }
+}
+
+static void SecureMsgPackTokens(int64_t time, const std::vector<std::vector<unsigned char> >& vTokens, std::vector<unsigned char>& vchData)
+{
+    vchData.resize(8 + 16 * vTokens.size());
+    memcpy(&vchData[0], &time, 8);
+    for (size_t i = 0; i < vTokens.size(); ++i)
+        memcpy(&vchData[8 + 16 * i], &vTokens[i][0], 16);
+}
+
 
 bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRecv)
 {
@@ -1127,10 +2566,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
     if (fDebugSmsg)
         printf("SecureMsgReceiveData() %s %s.\n", pfrom->addrName.c_str(), strCommand.c_str());
 
-    {
-    // break up?
-    LOCK(cs_smsg);
-
+    // -- no global lock, each handler below locks only the bucket it works on
     if (strCommand == "smsgInv")
     {
         std::vector<unsigned char> vchData;
@@ -1151,7 +2587,11 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
             return false;
         }
 
-        uint32_t nBuckets       = smsgBuckets.size();
+        uint32_t nBuckets;
+        {
+            LOCK(cs_smsgBuckets);
+            nBuckets = smsgBuckets.size();
+        }
         uint32_t nLocked        = 0;    // no. of locked buckets on this node
         uint32_t nInvBuckets;           // no. of bucket headers sent by peer in smsgInv
         memcpy(&nInvBuckets, &vchData[0], 4);
@@ -1178,6 +2618,9 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         vchDataOut.reserve(4 + 8 * nInvBuckets); // reserve max possible size
         vchDataOut.resize(4);
         uint32_t nShowBuckets = 0;
+        uint32_t nReconBuckets = 0;
+        bool fReconcile = (nSmsgLocalFlags & pfrom->smsgData.nFlags & SMSG_PEER_RECONCILE);
+        bool fDigest = (nSmsgLocalFlags & pfrom->smsgData.nFlags & SMSG_PEER_DIGEST);
 
 
         unsigned char *p = &vchData[4];
@@ -1216,26 +2659,71 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                 continue;
             }
 
+            uint32_t nMessages = 0, nHash = 0, nRejected = 0, nRejectedDigest = 0, nLockCount = 0, nLockPeerId = 0;
+            boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(time, false);
+            if (pbkt)
+            {
+                LOCK(pbkt->cs);
+                nMessages   = pbkt->setTokens.size();
+                nHash       = fDigest ? pbkt->nDigest : pbkt->legacyHash();
+                nRejected   = pbkt->setRejected.size();
+                nRejectedDigest = pbkt->nRejectedDigest;
+                nLockCount  = pbkt->nLockCount;
+                nLockPeerId = pbkt->nLockPeerId;
+            }
+
             if (fDebugSmsg)
             {
                 printf("peer bucket %d %u %u.\n", (int32_t) time, ncontent, hash);
-                std::cout << "this bucket " << time << ", " << smsgBuckets[time].setTokens.size() << ", " << smsgBuckets[time].hash << std::endl;
+                std::cout << "this bucket " << time << ", " << nMessages << ", " << nHash << std::endl;
             }
 
-            if (smsgBuckets[time].nLockCount > 0)
+            if (nLockCount > 0)
             {
                 if (fDebugSmsg)
-                    std::cout << "Bucket is locked " << smsgBuckets[time].nLockCount << " waiting for peer " << smsgBuckets[time].nLockPeerId << " to send data." << std::endl;
+                    std::cout << "Bucket is locked " << nLockCount << " waiting for peer " << nLockPeerId << " to send data." << std::endl;
                 nLocked++;
                 continue;
             }
 
+            // -- tokens rejected for a missing stamp are still in the peer's bucket, count them as
+            //    known or a peer relaying unstamped messages would be asked for them on every inv
+            uint32_t nKnown = nMessages + nRejected;
+            uint32_t nKnownHash = nHash;
+            if (nRejected > 0 && nKnown == ncontent)
+            {
+                // -- the legacy hash can't be extended over setRejected, go by the count alone
+                nKnownHash = fDigest ? nHash + nRejectedDigest : hash;
+            }
+
             // -- if this node has more than the peer node, peer node will pull from this
             //    if then peer node has more this node will pull fom peer
-            if (smsgBuckets[time].setTokens.size() < ncontent
-                || (smsgBuckets[time].setTokens.size() == ncontent
-                    && smsgBuckets[time].hash != hash)) // if same amount in buckets check hash
+            if (nKnown < ncontent
+                || (nKnown == ncontent
+                    && nKnownHash != hash)) // if same amount in buckets check hash
             {
+                // -- with a peer that reconciles, send a table of this bucket sized for the
+                //    difference expected, if that is smaller than the token list the peer would send
+                uint64_t nCells = 2 * ((uint64_t) (ncontent > nMessages ? ncontent - nMessages : nMessages - ncontent) + SMSG_RECON_SLACK);
+                if (fReconcile
+                    && pbkt
+                    && nMessages > 0
+                    && nCells <= SMSG_RECON_MAX_CELLS
+                    && nCells * IBLT_CELL_SIZE < 16 * (uint64_t) ncontent)
+                {
+                    if (fDebugSmsg)
+                        printf("Reconciling bucket %d, %u cells.\n", (int32_t) time, (unsigned int) nCells);
+
+                    CIBLT iblt(nCells, GetRand(std::numeric_limits<uint32_t>::max()));
+                    {
+                        LOCK(pbkt->cs);
+                        SecureMsgFillIBLT(pbkt->setTokens, iblt);
+                    }
+                    pfrom->PushMessage("smsgRecon", time, iblt);
+                    nReconBuckets++;
+                    continue;
+                }
+
                 if (fDebugSmsg)
                     printf("Requesting contents of bucket %d.\n", (int32_t) time);
 
@@ -1253,7 +2741,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         {
             pfrom->PushMessage("smsgShow", vchDataOut);
         } else
-        if (nLocked < 1) // Don't report buckets as matched if any are locked
+        if (nLocked < 1 && nReconBuckets < 1) // Don't report buckets as matched if any are locked or being reconciled
         {
             // -- peer has no buckets we want, don't send them again until something changes
             //    peer will still request buckets from this node if needed (< ncontent)
@@ -1265,6 +2753,67 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         }
 
     } else
+    if (strCommand == "smsgRecon")
+    {
+        // -- peer sent a table of its tokens in a bucket that differs from this node's
+        int64_t time;
+        CIBLT iblt;
+        vRecv >> time >> iblt;
+
+        if (!iblt.IsWithinSizeConstraints(SMSG_RECON_MAX_CELLS))
+        {
+            Misbehaving(pfrom->id, 1);
+            return false;
+        }
+
+        int64_t now = GetTime();
+        if (time < now - SMSG_RETENTION
+            || time > now + SMSG_TIME_LEEWAY)
+        {
+            if (fDebugSmsg)
+                printf("Not reconciling peer bucket %d, out of range.\n", (int32_t) time);
+            return false;
+        }
+
+        boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(time, false);
+        CIBLT ibltOurs(iblt.size(), iblt.GetTweak());
+        if (pbkt)
+        {
+            LOCK(pbkt->cs);
+            SecureMsgFillIBLT(pbkt->setTokens, ibltOurs);
+        }
+
+        // -- what is left is in the peer's bucket only (positive) or in this node's only (negative)
+        std::vector<std::vector<unsigned char> > vPeerOnly, vOursOnly;
+        if (!iblt.subtract(ibltOurs)
+            || !iblt.list(vPeerOnly, vOursOnly))
+        {
+            // -- too many differences for the table, fall back to the full token list
+            if (fDebugSmsg)
+                printf("Could not reconcile bucket %d, sending all tokens.\n", (int32_t) time);
+            if (pbkt)
+            {
+                LOCK(pbkt->cs);
+                SecureMsgPushHave(pfrom, time, *pbkt);
+            }
+            return true;
+        }
+
+        if (fDebugSmsg)
+            printf("Reconciled bucket %d, peer lacks %u, this node lacks %u.\n", (int32_t) time, (unsigned int) vOursOnly.size(), (unsigned int) vPeerOnly.size());
+
+        std::vector<unsigned char> vchDataOut;
+        if (vOursOnly.size() > 0)
+        {
+            SecureMsgPackTokens(time, vOursOnly, vchDataOut);
+            pfrom->PushMessage("smsgHave", vchDataOut);
+        }
+        if (vPeerOnly.size() > 0)
+        {
+            SecureMsgPackTokens(time, vPeerOnly, vchDataOut);
+            SecureMsgReceiveHave(pfrom, vchDataOut);
+        }
+    } else
     if (strCommand == "smsgShow")
     {
         std::vector<unsigned char> vchData;
@@ -1282,42 +2831,22 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         if (fDebugSmsg)
             printf("smsgShow: peer wants to see content of %u buckets.\n", nBuckets);
 
-        std::map<int64_t, SecMsgBucket>::iterator itb;
-        std::set<SecMsgToken>::iterator it;
-
-        std::vector<unsigned char> vchDataOut;
         int64_t time;
         unsigned char* pIn = &vchData[4];
         for (uint32_t i = 0; i < nBuckets; ++i, pIn += 8)
         {
             memcpy(&time, pIn, 8);
 
-            itb = smsgBuckets.find(time);
-            if (itb == smsgBuckets.end())
+            boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(time, false);
+            if (!pbkt)
             {
                 if (fDebugSmsg)
                     printf("Don't have bucket %d.\n", (int32_t) time);
                 continue;
             }
 
-            std::set<SecMsgToken>& tokenSet = (*itb).second.setTokens;
-
-            try { vchDataOut.resize(8 + 16 * tokenSet.size()); } catch (std::exception& e)
-            {
-                std::cout << "vchDataOut.resize " << (8 + 16 * tokenSet.size()) << " threw " << e.what() << std::endl;
-                continue;
-            }
-            memcpy(&vchDataOut[0], &time, 8);
-
-            unsigned char* p = &vchDataOut[8];
-            for (it = tokenSet.begin(); it != tokenSet.end(); ++it)
-            {
-                memcpy(p, &it->timestamp, 8);
-                memcpy(p+8, &it->sample, 8);
-
-                p += 16;
-            }
-            pfrom->PushMessage("smsgHave", vchDataOut);
+            LOCK(pbkt->cs);
+            SecureMsgPushHave(pfrom, time, *pbkt);
         }
 
 
@@ -1328,82 +2857,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         std::vector<unsigned char> vchData;
         vRecv >> vchData;
 
-        if (vchData.size() < 8)
-            return false;
-
-        int n = (vchData.size() - 8) / 16;
-
-        int64_t time;
-        memcpy(&time, &vchData[0], 8);
-
-        // -- Check time valid:
-        int64_t now = GetTime();
-        if (time < now - SMSG_RETENTION)
-        {
-            if (fDebugSmsg)
-                printf("Not interested in peer bucket %d, has expired.\n", (int32_t) time);
-            return false;
-        }
-        if (time > now + SMSG_TIME_LEEWAY)
-        {
-            if (fDebugSmsg)
-                printf("Not interested in peer bucket %d, in the future.\n", (int32_t) time);
-            Misbehaving(pfrom->id, 1);
-            return false;
-        }
-
-        if (smsgBuckets[time].nLockCount > 0)
-        {
-            if (fDebugSmsg)
-                printf("Bucket %d lock count %u, waiting for message data from peer %u.\n", (int32_t) time, smsgBuckets[time].nLockCount, smsgBuckets[time].nLockPeerId);
-            return false;
-        }
-
-        if (fDebugSmsg)
-            printf("Sifting through bucket %d.\n", (int32_t) time);
-
-        std::vector<unsigned char> vchDataOut;
-        vchDataOut.resize(8);
-        memcpy(&vchDataOut[0], &vchData[0], 8);
-
-        std::set<SecMsgToken>& tokenSet = smsgBuckets[time].setTokens;
-        std::set<SecMsgToken>::iterator it;
-        SecMsgToken token;
-        unsigned char* p = &vchData[8];
-
-        for (int i = 0; i < n; ++i)
-        {
-            memcpy(&token.timestamp, p, 8);
-            memcpy(&token.sample, p+8, 8);
-
-            it = tokenSet.find(token);
-            if (it == tokenSet.end())
-            {
-                int nd = vchDataOut.size();
-                try {
-                    vchDataOut.resize(nd + 16);
-                } catch (std::exception& e) {
-                    printf("vchDataOut.resize %d threw: %s.\n", nd + 16, e.what());
-                    continue;
-                }
-
-                memcpy(&vchDataOut[nd], p, 16);
-            }
-
-            p += 16;
-        }
-
-        if (vchDataOut.size() > 8)
-        {
-            if (fDebugSmsg)
-            {
-                printf("Asking peer for  %d messages.\n", (int) (vchDataOut.size() - 8) / 16);
-                printf("Locking bucket %d for peer %u.\n", (int) time, pfrom->smsgData.nPeerId);
-            }
-            smsgBuckets[time].nLockCount   = 3; // lock this bucket for at most 3 * SMSG_THREAD_DELAY seconds, unset when peer sends smsgMsg
-            smsgBuckets[time].nLockPeerId  = pfrom->smsgData.nPeerId;
-            pfrom->PushMessage("smsgWant", vchDataOut);
-        }
+        return SecureMsgReceiveHave(pfrom, vchData);
     } else
     if (strCommand == "smsgWant")
     {
@@ -1413,79 +2867,78 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         if (vchData.size() < 8)
             return false;
 
-        std::vector<unsigned char> vchOne;
-        std::vector<unsigned char> vchBunch;
-
-        vchBunch.resize(4+8); // nmessages + bucketTime
-
         int n = (vchData.size() - 8) / 16;
 
         int64_t time;
         uint32_t nBunch = 0;
+        uint64_t nBunchBytes = 0;
         memcpy(&time, &vchData[0], 8);
 
-        std::map<int64_t, SecMsgBucket>::iterator itb;
-        itb = smsgBuckets.find(time);
-        if (itb == smsgBuckets.end())
+        boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(time, false);
+        if (!pbkt)
         {
             if (fDebugSmsg)
                 printf("Don't have bucket %d.\n", (int32_t) time);
             return false;
         }
 
-        std::set<SecMsgToken>& tokenSet = itb->second.setTokens;
-        std::set<SecMsgToken>::iterator it;
-        SecMsgToken token;
-        unsigned char* p = &vchData[8];
-        for (int i = 0; i < n; ++i)
+        // -- offset and length in the bucket file of each message to send
+        std::vector<std::pair<uint64_t, uint32_t> > vSpans;
+        boost::shared_ptr<SecMsgBucketMap> pmap;
         {
-            memcpy(&token.timestamp, p, 8);
-            memcpy(&token.sample, p+8, 8);
-
-            it = tokenSet.find(token);
-            if (it == tokenSet.end())
-            {
-                if (fDebugSmsg)
-                    printf("Don't have wanted message %d.\n", (int32_t) token.timestamp);
-            } else
+            LOCK(pbkt->cs);
+            std::set<SecMsgToken>& tokenSet = pbkt->setTokens;
+            std::set<SecMsgToken>::iterator it;
+            SecMsgToken token;
+            unsigned char* p = &vchData[8];
+            for (int i = 0; i < n; ++i)
             {
-                //printf("Have message at %"PRId64".\n", it->offset); // DEBUG
-                token.offset = it->offset;
-                //printf("winb before SecureMsgRetrieve %"PRId64".\n", token.timestamp);
+                memcpy(&token.timestamp, p, 8);
+                memcpy(&token.sample, p+8, 8);
 
-                // -- place in vchOne so if SecureMsgRetrieve fails it won't corrupt vchBunch
-                SecureMessage smsg;
-                if (SecureMsgRetrieve(token, smsg) == 0)
+                it = tokenSet.find(token);
+                if (it == tokenSet.end())
                 {
-                    nBunch++;
-                    const size_t size = vchBunch.size();
-                    vchBunch.resize(size + SMSG_HDR_LEN + smsg.nPayload);
-                    memcpy(&vchBunch[size], &smsg, SMSG_HDR_LEN);
-                    memcpy(&vchBunch[size+SMSG_HDR_LEN], &smsg.vchPayload[0], smsg.nPayload);
+                    if (fDebugSmsg)
+                        printf("Don't have wanted message %d.\n", (int32_t) token.timestamp);
                 } else
                 {
-                    printf("SecureMsgRetrieve failed %d.\n", (int32_t) token.timestamp);
-                }
+                    //printf("Have message at %"PRId64".\n", it->offset); // DEBUG
+                    token.offset = it->offset;
 
-                if (nBunch >= 500
-                    || vchBunch.size() >= 96000)
-                {
-                    if (fDebugSmsg)
-                        printf("Break bunch %u, %d.\n", nBunch, (int) vchBunch.size());
-                    break; // end here, peer will send more want messages if needed.
+                    const unsigned char* pMessage;
+                    if (SecureMsgRetrieve(*pbkt, token, pMessage) == 0)
+                    {
+                        nBunch++;
+                        SecureMessageHeader header(pMessage);
+                        vSpans.push_back(std::make_pair(token.offset, SMSG_HDR_LEN + header.nPayload));
+                        nBunchBytes += SMSG_HDR_LEN + header.nPayload;
+                    } else
+                    {
+                        printf("SecureMsgRetrieve failed %d.\n", (int32_t) token.timestamp);
+                    }
+
+                    if (nBunch >= 500
+                        || nBunchBytes >= 96000)
+                    {
+                        if (fDebugSmsg)
+                            printf("Break bunch %u, %d.\n", nBunch, (int) nBunchBytes);
+                        break; // end here, peer will send more want messages if needed.
+                    }
                 }
+                p += 16;
             }
-            p += 16;
+
+            // -- the file only grows, the latest mapping covers every span
+            pmap = pbkt->pmap;
         }
 
-        if (nBunch > 0)
+        if (nBunch > 0 && pmap)
         {
             if (fDebugSmsg)
                 printf("Sending block of %u messages for bucket %d.\n", nBunch, (int32_t) time);
 
-            memcpy(&vchBunch[0], &nBunch, 4);
-            memcpy(&vchBunch[4], &time, 8);
-            pfrom->PushMessage("smsgMsg", vchBunch);
+            SecureMsgPushBunch(pfrom, time, *pmap, vSpans, nBunchBytes);
         }
     } else
     if (strCommand == "smsgMsg")
@@ -1532,12 +2985,17 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
     if (strCommand == "smsgPing")
     {
         // -- smsgPing is the initial message, send reply
-        pfrom->PushMessage("smsgPong");
+        if (!vRecv.empty())
+            vRecv >> pfrom->smsgData.nFlags;
+        pfrom->PushMessage("smsgPong", nSmsgLocalFlags);
     } else
     if (strCommand == "smsgPong")
     {
+        if (!vRecv.empty())
+            vRecv >> pfrom->smsgData.nFlags;
+
         if (fDebugSmsg)
-             printf("Peer replied, secure messaging enabled.\n");
+             printf("Peer replied, secure messaging enabled, flags %u.\n", pfrom->smsgData.nFlags);
 
         pfrom->smsgData.fEnabled = true;
     } else
@@ -1577,11 +3035,68 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         // Unknown message
     }
 
-    } //  LOCK(cs_smsg);
-
     return true;
 }
 
+uint32_t SecureMsgBuildInventory(int64_t lastMatched, std::vector<unsigned char>& vchData, bool fLegacyHash)
+{
+    /*
+        Build an smsgInv message of the non empty buckets changed since lastMatched.
+        Without fLegacyHash only the published inventory entries are read and no bucket is locked,
+        a peer without SMSG_PEER_DIGEST needs the legacy hash of each bucket instead.
+
+        returns the number of buckets listed
+    */
+
+    std::vector<std::pair<int64_t, boost::shared_ptr<SecMsgBucket> > > vBuckets;
+    std::vector<std::pair<uint32_t, uint32_t> > vEntries;  // nMessages, hash
+    {
+        LOCK(cs_smsgBuckets);
+        std::map<int64_t, boost::shared_ptr<SecMsgBucket> >::iterator it;
+        for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
+        {
+            SecMsgBucket &bkt = *it->second;
+            if (bkt.timeChanged < lastMatched     // peer has this bucket
+                || bkt.nMessages < 1)             // this bucket is empty
+                continue;
+            vBuckets.push_back(*it);
+            vEntries.push_back(std::make_pair(bkt.nMessages, bkt.hash));
+        }
+    }
+
+    if (vBuckets.empty()) // no need to send keep alive pkts, coin messages already do that
+        return 0;
+
+    if (fLegacyHash)
+    {
+        for (size_t i = 0; i < vBuckets.size(); ++i)
+        {
+            SecMsgBucket &bkt = *vBuckets[i].second;
+            LOCK(bkt.cs);
+            vEntries[i] = std::make_pair((uint32_t) bkt.setTokens.size(), bkt.legacyHash());
+        }
+    }
+
+    uint32_t nBucketsShown = vBuckets.size();
+    try { vchData.resize(4 + nBucketsShown*16); } catch (std::exception& e) // timestamp + size + hash
+    {
+        printf("vchData.resize %u threw: %s.\n", 4 + nBucketsShown*16, e.what());
+        return 0;
+    }
+    memcpy(&vchData[0], &nBucketsShown, 4);
+
+    unsigned char* p = &vchData[4];
+    for (size_t i = 0; i < vBuckets.size(); ++i)
+    {
+        memcpy(p, &vBuckets[i].first, 8);
+        memcpy(p+8, &vEntries[i].first, 4);
+        memcpy(p+12, &vEntries[i].second, 4);
+        p += 16;
+    }
+
+    return nBucketsShown;
+}
+
 bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
 {
     /*
@@ -1601,7 +3116,7 @@ bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
         if (fDebugSmsg)
             printf("SecureMsgSendData() new node %s, peer id %u.\n", pto->addrName.c_str(), pto->smsgData.nPeerId);
         // -- Send smsgPing once, do nothing until receive 1st smsgPong (then set fEnabled)
-        pto->PushMessage("smsgPing");
+        pto->PushMessage("smsgPing", nSmsgLocalFlags);
         pto->smsgData.lastSeen = GetTime();
         return true;
     } else
@@ -1624,58 +3139,14 @@ bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
     }
     pto->smsgData.nWakeCounter--;
 
+    std::vector<unsigned char> vchData;
+    bool fLegacyHash = !(nSmsgLocalFlags & pto->smsgData.nFlags & SMSG_PEER_DIGEST);
+    if (SecureMsgBuildInventory(pto->smsgData.lastMatched, vchData, fLegacyHash) > 0)
     {
-        LOCK(cs_smsg);
-        std::map<int64_t, SecMsgBucket>::iterator it;
-
-        uint32_t nBuckets = smsgBuckets.size();
-        if (nBuckets > 0) // no need to send keep alive pkts, coin messages already do that
-        {
-            std::vector<unsigned char> vchData;
-            // should reserve?
-            vchData.reserve(4 + nBuckets*16); // timestamp + size + hash
-
-            uint32_t nBucketsShown = 0;
-            vchData.resize(4);
-
-            unsigned char* p = &vchData[4];
-            for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
-            {
-                SecMsgBucket &bkt = it->second;
-
-                uint32_t nMessages = bkt.setTokens.size();
-
-                if (bkt.timeChanged < pto->smsgData.lastMatched     // peer has this bucket
-                    || nMessages < 1)                               // this bucket is empty
-                    continue;
-
-
-                uint32_t hash = bkt.hash;
-
-                try { vchData.resize(vchData.size() + 16); } catch (std::exception& e)
-                {
-                    printf("vchData.resize %d threw: %s.\n", (int) vchData.size() + 16, e.what());
-                    continue;
-                }
-                memcpy(p, &it->first, 8);
-                memcpy(p+8, &nMessages, 4);
-                memcpy(p+12, &hash, 4);
-
-                p += 16;
-                nBucketsShown++;
-                //if (fDebug)
-                //    printf("Sending bucket %"PRId64", size %d \n", it->first, it->second.size());
-            }
-
-            if (vchData.size() > 4)
-            {
-                memcpy(&vchData[0], &nBucketsShown, 4);
-                if (fDebugSmsg)
-                    printf("Sending %d bucket headers.\n", nBucketsShown);
+        if (fDebugSmsg)
+            printf("Sending %u bucket headers.\n", (unsigned int) (vchData.size() - 4) / 16);
 
-                pto->PushMessage("smsgInv", vchData);
-            }
-        }
+        pto->PushMessage("smsgInv", vchData);
     }
 
     pto->smsgData.lastSeen = GetTime();
@@ -1739,109 +3210,87 @@ int SecureMsgInsertAddress(CKeyID& hashKey, CPubKey& pubKey)
 }
 
 
-static bool ScanBlock(CBlock& block, SecMsgDB& addrpkdb,
-    uint32_t& nTransactions, uint32_t& nInputs, uint32_t& nPubkeys, uint32_t& nDuplicates)
+typedef std::map<CKeyID, CPubKey> SecMsgKeyMap;
+
+static void ExtractPublicKeys(const CBlock& block, std::vector<std::pair<CKeyID, CPubKey> >& vKeys,
+    uint32_t& nTransactions, uint32_t& nInputs)
 {
-    // -- should have LOCK(cs_smsg) where db is opened
+    /*
+    Public keys are pushed in the scriptSig of standard inputs.
+    The db stores each key under its own hash, so the output an input spends
+    is not needed: unlike a lookup of the previous transaction, this touches
+    no shared state and ScanChainForPublicKeys can run it on several threads.
+    */
     BOOST_FOREACH(const CTransaction& tx, block.vtx)
     {
         if (tx.IsCoinBase())
             continue; // leave out coinbase
 
-
-        /*
-        Look at the inputs of every tx.
-        If the inputs are standard, get the pubkey from scriptsig and
-        look for the corresponding output (the input(output of other tx) to the input of this tx)
-        get the address from scriptPubKey
-        add to db if address is unique.
-
-        Would make more sense to do this the other way around, get address first for early out.
-
-        */
-
         for (size_t i = 0; i < tx.vin.size(); i++)
         {
-/*
-            TODO ???
-            if (tx.nVersion == ANON_TXN_VERSION
-                && tx.vin[i].IsAnonInput())
-                continue; // skip anon inputs
-*/
             const CScript &script = tx.vin[i].scriptSig;
 
             opcodetype opcode;
             std::vector<unsigned char> vch;
 
-            uint256 prevoutHash, blockHash;
-
-            // -- matching address is in scriptPubKey of previous tx output
             for (CScript::const_iterator pc = script.begin(); script.GetOp(pc, opcode, vch); )
             {
                 // -- opcode is the length of the following data, compressed public key is always 33
-                if (opcode == 33)
-                {
-                    CPubKey pubKey(vch);
-
-                    if (!pubKey.IsValid())
-                    {
-                        printf("Public key is invalid %s.\n", HexStr(vch).c_str());
-                        continue;
-                    }
-
-                    prevoutHash = tx.vin[i].prevout.hash;
-                    CTransaction txOfPrevOutput;
-                    
-                    if (!GetTransaction(prevoutHash, txOfPrevOutput, blockHash, true))
-                    {
-                        printf("Could not get transaction %s (output %d) referenced by input #%d of transaction %s in block %s\n", prevoutHash.ToString().c_str(), tx.vin[i].prevout.n, (int) i, tx.GetHash().ToString().c_str(), block.GetHash().ToString().c_str());
-                        continue;
-                    }
-
-                    unsigned int nOut = tx.vin[i].prevout.n;
-                    if (nOut >= txOfPrevOutput.vout.size())
-                    {
-                        printf("Output %u, not in transaction: %s\n", nOut, prevoutHash.ToString().c_str());
-                        continue;
-                    }
-
-                    const CTxOut &txOut = txOfPrevOutput.vout[nOut];
-
-                    CTxDestination addressRet;
-                    if (!ExtractDestination(txOut.scriptPubKey, addressRet))
-                    {
-                        printf("ExtractDestination failed: %s\n", prevoutHash.ToString().c_str());
-                        continue;
-                    }
-
-                    CBitcreditAddress coinAddress(addressRet);
-                    CKeyID hashKey;
-                    if (!coinAddress.GetKeyID(hashKey))
-                    {
-                        printf("coinAddress.GetKeyID failed: %s\n", coinAddress.ToString().c_str());
-                        continue;
-                    }
-                    
-                    if (hashKey != pubKey.GetID())
-                        continue;
+                if (opcode != 33)
+                    continue;
 
-                    int rv = SecureMsgInsertAddress(hashKey, pubKey, addrpkdb);
-                    nPubkeys += (rv == 0);
-                    nDuplicates += (rv == 4);
-                }
+                CPubKey pubKey(vch);
+                if (!pubKey.IsFullyValid())
+                    continue;
 
-                //printf("opcode %d, %s, value %s.\n", opcode, GetOpName(opcode), HexStr(vch).c_str());
+                vKeys.push_back(std::make_pair(pubKey.GetID(), pubKey));
             }
             nInputs++;
         }
         nTransactions++;
+    }
+}
+
+static bool SecureMsgWriteKeys(SecMsgKeyMap& mapKeys, const CBlockLocator* pCheckpoint, uint32_t& nDuplicates)
+{
+    /*
+    write the keys not yet in the db as one batch, in key order
+    with pCheckpoint set, the scan checkpoint is moved in the same batch
+    mapKeys is left with the new keys only
+    */
+
+    LOCK(cs_smsgDB);
 
-        if (nTransactions % 10000 == 0) // for ScanChainForPublicKeys
+    SecMsgDB addrpkdb;
+    if (!addrpkdb.Open("cw"))
+        return false;
+
+    // -- before TxnBegin, so ExistsPK does not search the batch
+    for (SecMsgKeyMap::iterator it = mapKeys.begin(); it != mapKeys.end(); )
+    {
+        CKeyID hashKey = it->first;
+        if (addrpkdb.ExistsPK(hashKey))
         {
-            printf("Scanning transaction no. %u.\n", nTransactions);
-        }
+            nDuplicates++;
+            mapKeys.erase(it++);
+        } else
+            ++it;
     }
-    return true;
+
+    if (!addrpkdb.TxnBegin())
+        return false;
+
+    for (SecMsgKeyMap::iterator it = mapKeys.begin(); it != mapKeys.end(); ++it)
+    {
+        CKeyID hashKey = it->first;
+        CPubKey pubKey = it->second;
+        addrpkdb.WritePK(hashKey, pubKey);
+    }
+
+    if (pCheckpoint)
+        addrpkdb.WriteScanCheckpoint(*pCheckpoint);
+
+    return addrpkdb.TxnCommit();
 }
 
 
@@ -1857,39 +3306,64 @@ bool SecureMsgScanBlock(CBlock& block)
 
     uint32_t nTransactions  = 0;
     uint32_t nInputs        = 0;
-    uint32_t nPubkeys       = 0;
     uint32_t nDuplicates    = 0;
 
-    {
-        LOCK(cs_smsgDB);
-
-        SecMsgDB addrpkdb;
-        if (!addrpkdb.Open("cw")
-            || !addrpkdb.TxnBegin())
-            return false;
-
-        ScanBlock(block, addrpkdb,
-            nTransactions, nInputs, nPubkeys, nDuplicates);
+    std::vector<std::pair<CKeyID, CPubKey> > vKeys;
+    ExtractPublicKeys(block, vKeys, nTransactions, nInputs);
 
-        addrpkdb.TxnCommit();
-    }
+    SecMsgKeyMap mapKeys(vKeys.begin(), vKeys.end());
+    if (!mapKeys.empty()
+        && !SecureMsgWriteKeys(mapKeys, NULL, nDuplicates))
+        return false;
 
     if (fDebugSmsg)
-        printf("Found %u transactions, %u inputs, %u new public keys, %u duplicates.\n", nTransactions, nInputs, nPubkeys, nDuplicates);
+        printf("Found %u transactions, %u inputs, %u new public keys, %u duplicates.\n", nTransactions, nInputs, (uint32_t)mapKeys.size(), nDuplicates);
 
     return true;
 }
 
-bool ScanChainForPublicKeys(CBlockIndex* pindexStart, size_t n)
+// -- what one thread of ScanChainForPublicKeys found in its share of a round
+struct SecMsgChainScanPart
+{
+    SecMsgChainScanPart() : nTransactions(0), nInputs(0), nFailed(0) {}
+
+    std::vector<std::pair<CKeyID, CPubKey> > vKeys;
+    uint32_t nTransactions;
+    uint32_t nInputs;
+    uint32_t nFailed;
+};
+
+static void SecureMsgScanChainPart(const std::vector<CBlockIndex*>& vIndex, size_t nFirst, size_t nStride, SecMsgChainScanPart& part)
+{
+    // -- threads take every nStride'th block, keeping their reads close together in the block files
+    for (size_t i = nFirst; i < vIndex.size(); i += nStride)
+    {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, vIndex[i]))
+        {
+            part.nFailed++;
+            continue;
+        }
+        ExtractPublicKeys(block, part.vKeys, part.nTransactions, part.nInputs);
+    }
+}
+
+bool ScanChainForPublicKeys(int nStartHeight)
 {
-    printf("Scanning block chain for public keys.\n");
+    /*
+    scan the active chain from nStartHeight to the tip in rounds of
+    SMSG_CHAIN_SCAN_BLOCKS blocks per thread
+    each round is written as one batch together with a checkpoint, an
+    interrupted scan resumes from there
+    */
+
+    int nThreads = SecureMsgScanThreadCount();
+
+    printf("Scanning block chain for public keys, %d threads.\n", nThreads);
     int64_t nStart = GetTimeMillis();
 
     if (fDebugSmsg)
-        printf("From height %u.\n", pindexStart->nHeight);
-
-    // -- public keys are in txin.scriptSig
-    //    matching addresses are in scriptPubKey of txin's referenced output
+        printf("From height %d.\n", nStartHeight);
 
     uint32_t nBlocks        = 0;
     uint32_t nTransactions  = 0;
@@ -1897,26 +3371,56 @@ bool ScanChainForPublicKeys(CBlockIndex* pindexStart, size_t n)
     uint32_t nPubkeys       = 0;
     uint32_t nDuplicates    = 0;
 
+    for (int nHeight = nStartHeight; ; )
     {
-        LOCK(cs_smsgDB);
-
-        SecMsgDB addrpkdb;
-        if (!addrpkdb.Open("cw")
-            || !addrpkdb.TxnBegin())
+        if (ShutdownRequested())
+        {
+            printf("ScanChainForPublicKeys() interrupted at height %d.\n", nHeight);
             return false;
+        }
 
-        CBlockIndex* pindex = pindexStart;
-        for (size_t i = 0; pindex != NULL && i < n; i++, pindex = pindex->pprev)
+        // -- cs_main is only held to walk the chain, the tip may move on while reading
+        std::vector<CBlockIndex*> vIndex;
+        CBlockLocator locator;
         {
-            nBlocks++;
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
+            LOCK(cs_main);
+            int nEnd = std::min(chainActive.Height() + 1, nHeight + nThreads * (int)SMSG_CHAIN_SCAN_BLOCKS);
+            for (int h = nHeight; h < nEnd; h++)
+                vIndex.push_back(chainActive[h]);
+            if (!vIndex.empty())
+                locator = chainActive.GetLocator(vIndex.back());
+        }
+        if (vIndex.empty())
+            break;
 
-            ScanBlock(block, addrpkdb,
-                nTransactions, nInputs, nPubkeys, nDuplicates);
+        std::vector<SecMsgChainScanPart> vParts(nThreads);
+        boost::thread_group readers;
+        for (int i = 1; i < nThreads; i++)
+            readers.create_thread(boost::bind(&SecureMsgScanChainPart, boost::cref(vIndex), i, nThreads, boost::ref(vParts[i])));
+        SecureMsgScanChainPart(vIndex, 0, nThreads, vParts[0]);
+        readers.join_all();
+
+        SecMsgKeyMap mapKeys;
+        for (int i = 0; i < nThreads; i++)
+        {
+            if (vParts[i].nFailed)
+            {
+                printf("ScanChainForPublicKeys() could not read %u blocks after height %d.\n", vParts[i].nFailed, nHeight);
+                return false;
+            }
+            nTransactions += vParts[i].nTransactions;
+            nInputs += vParts[i].nInputs;
+            mapKeys.insert(vParts[i].vKeys.begin(), vParts[i].vKeys.end());
         }
 
-        addrpkdb.TxnCommit();
+        if (!SecureMsgWriteKeys(mapKeys, &locator, nDuplicates))
+            return false;
+
+        nPubkeys += mapKeys.size();
+        nBlocks += vIndex.size();
+        nHeight += vIndex.size();
+
+        printf("Scanned to height %d, %u public keys found.\n", nHeight - 1, nPubkeys);
     }
 
     printf("Scanned %u blocks, %u transactions, %u inputs\n", nBlocks, nTransactions, nInputs);
@@ -1926,38 +3430,50 @@ bool ScanChainForPublicKeys(CBlockIndex* pindexStart, size_t n)
     return true;
 }
 
-bool SecureMsgScanBlockChain()
+bool SecureMsgScanBlockChain(bool fRescan)
 {
-    TRY_LOCK(cs_main, lockMain);
-    if (lockMain)
-    {
-        CBlockIndex *indexScan = chainActive.Tip();
+    /*
+    continue from the checkpoint of the last scan, or from the fork point
+    if its block is no longer in the active chain
+    fRescan starts from genesis
+    */
 
-        try { // -- in try to catch errors opening db,
-            if (!ScanChainForPublicKeys(indexScan, indexScan->nHeight))
-                return false;
-        } catch (std::exception& e)
+    try { // -- in try to catch errors opening db,
+        CBlockLocator locator;
+        if (!fRescan)
         {
-            printf("ScanChainForPublicKeys() threw: %s.\n", e.what());
-            return false;
+            LOCK(cs_smsgDB);
+            SecMsgDB addrpkdb;
+            if (addrpkdb.Open("cr+"))
+                addrpkdb.ReadScanCheckpoint(locator);
         }
-    } else
+
+        int nStartHeight = 0;
+        if (!locator.IsNull())
+        {
+            LOCK(cs_main);
+            nStartHeight = FindForkInGlobalIndex(chainActive, locator)->nHeight + 1;
+        }
+
+        if (!ScanChainForPublicKeys(nStartHeight))
+            return false;
+    } catch (std::exception& e)
     {
-        printf("ScanChainForPublicKeys() Could not lock main.\n");
+        printf("ScanChainForPublicKeys() threw: %s.\n", e.what());
         return false;
     }
 
     return true;
 }
 
-int SecureMsgScanBuckets(std::string &error, bool fDecrypt)
+int SecureMsgScanBuckets(std::string &error)
 {
     if (fDebugSmsg)
         printf("SecureMsgScanBuckets()\n");
 
     if (!fSecMsgEnabled) {
         error = "Secure messaging is disabled.";
-        return fDecrypt ? 0 : RPC_METHOD_NOT_FOUND;
+        return RPC_METHOD_NOT_FOUND;
     }
     if (pwalletMain->IsLocked()) {
         error = "Wallet is locked. Secure messaging needs an unlocked wallet.";
@@ -1980,15 +3496,13 @@ int SecureMsgScanBuckets(std::string &error, bool fDecrypt)
         }
     }
 
-    SecureMessage smsg;
-
     for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd) {
         if (!fs::is_regular_file(itd->status()))
             continue;
 
         std::string fileName = (*itd).path().filename().string();
 
-        if (!boost::algorithm::ends_with(fileName, fDecrypt ? "_wl.dat" : ".dat"))
+        if (!boost::algorithm::ends_with(fileName, ".dat"))
             continue;
 
         if (fDebugSmsg)
@@ -2010,6 +3524,7 @@ int SecureMsgScanBuckets(std::string &error, bool fDecrypt)
             printf("Dropping file %s, expired.\n", fileName.c_str());
             try {
                 fs::remove((*itd).path());
+                fs::remove(SecureMsgBucketPath(fileTime, "_01.idx"));
             }
             catch (const fs::filesystem_error& ex) {
                 printf("Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
@@ -2017,78 +3532,22 @@ int SecureMsgScanBuckets(std::string &error, bool fDecrypt)
             continue;
         }
 
-        if (!fDecrypt && boost::algorithm::ends_with(fileName, "_wl.dat")) {
+        // -- wallet locked files are left to the unlock scan
+        if (boost::algorithm::ends_with(fileName, "_wl.dat")) {
             if (fDebugSmsg)
                 printf("Skipping wallet locked file: %s.\n", fileName.c_str());
             continue;
         }
 
-        {
-            LOCK(cs_smsg);
-            FILE *fp;
-            errno = 0;
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb"))) {
-                printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
-                continue;
-            }
-
-            for (;;) {
-                errno = 0;
-                if (fread(smsg.Header(), sizeof(unsigned char), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
-                    if (errno != 0) {
-                        printf("fread header failed: %s\n", strerror(errno));
-                    }
-                    else {
-                        //printf("End of file.\n");
-                    }
-                    break;
-                }
-
-                try {
-                    smsg.vchPayload.resize(smsg.nPayload);
-                }
-                catch (std::exception& e) {
-                    printf("SecureMsgWalletUnlocked(): Could not resize vchPayload, %u, %s\n", smsg.nPayload, e.what());
-                    fclose(fp);
-                    return 1;
-                }
-
-                if (fread(&smsg.vchPayload[0], 1, smsg.nPayload, fp) != smsg.nPayload) {
-                    printf("fread data failed: %s\n", strerror(errno));
-                    break;
-                }
-
-                // -- don't report to gui,
-                int rv = SecureMsgScanMessage(*smsg.Header(), &smsg.vchPayload[0], false);
-
-                if (rv == 0) {
-                    nFoundMessages++;
-                }
-                else if (rv != 0) {
-                    // SecureMsgScanMessage failed
-                }
-
-                nMessages ++;
-            }
-
-            fclose(fp);
-
-            // -- remove wl file when scanned
-            try {
-                fs::remove((*itd).path());
-            } catch (const boost::filesystem::filesystem_error& ex) {
-                printf("Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
-                return 1;
-            }
+        uint64_t nBytesRead;
+        if (SecureMsgScanFile((*itd).path(), false, nBytesRead, nMessages, nFoundMessages) == 2) {
+            error = "Wallet is locked. Secure messaging needs an unlocked wallet.";
+            return RPC_WALLET_UNLOCK_NEEDED;
         }
     }
 
     printf("Processed %u files, scanned %u messages, received %u messages.\n", nFiles, nMessages, nFoundMessages);
     printf("Took %d ms\n", (int)(GetTimeMillis() - mStart));
-    
-	// -- notify gui
-    if (fDecrypt)
-        NotifySecMsgWalletUnlocked();
     return 0;
 }
 
@@ -2160,93 +3619,10 @@ int SecureMsgScanMessage(const SecureMessageHeader &smsg, const unsigned char *p
         return 3;
     }
 
-    // -- Calculate hash of payload and enable verification of the HMAC
-    SecureMessageHeader header((const unsigned char*) smsg.begin());
-    memcpy(header.hash, Hash(&pPayload[0], &pPayload[smsg.nPayload]).begin(), 32);
-    
-    std::string addressTo;
-    MessageData msg; // placeholder
-    bool fOwnMessage = false;
-
-    for (std::vector<SecMsgAddress>::iterator it = smsgAddresses.begin(); it != smsgAddresses.end(); ++it)
-    {
-        if (!it->fReceiveEnabled)
-            continue;
-
-        CBitcreditAddress coinAddress(it->sAddress);
-        addressTo = coinAddress.ToString();
-
-        if (!it->fReceiveAnon)
-        {
-            // -- have to do full decrypt to see address from
-            if (SecureMsgDecrypt(false, addressTo, header, pPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    printf("%d: Decrypted message with %s.\n", __LINE__, addressTo.c_str());
-
-                if (msg.sFromAddress.compare("anon") != 0)
-                    fOwnMessage = true;
-                break;
-            }
-        } else
-        {
-
-            if (SecureMsgDecrypt(true, addressTo, header, pPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    printf("%d: Decrypted message with %s.\n", __LINE__, addressTo.c_str());
-
-                fOwnMessage = true;
-                break;
-            }
-        }
-    }
-
-    if (fOwnMessage)
-    {
-        // -- save to inbox
-        std::string sPrefix("im");
-        unsigned char chKey[18];
-        memcpy(&chKey[0],  sPrefix.data(),  2);
-        memcpy(&chKey[2],  &smsg.timestamp, 8);
-        memcpy(&chKey[10], pPayload,        8);
-
-        SecMsgStored smsgInbox;
-        smsgInbox.timeReceived  = GetTime();
-        smsgInbox.status        = (SMSG_MASK_UNREAD) & 0xFF;
-        smsgInbox.sAddrTo       = addressTo;
-
-        // -- data may not be contiguous
-        try {
-            smsgInbox.vchMessage.resize(SMSG_HDR_LEN + smsg.nPayload);
-        } catch (std::exception& e) {
-            printf("SecureMsgScanMessage(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
-            return 1;
-        }
-        memcpy(&smsgInbox.vchMessage[0], smsg.begin(), SMSG_HDR_LEN);
-        memcpy(&smsgInbox.vchMessage[SMSG_HDR_LEN], pPayload, smsg.nPayload);
-
-        {
-            LOCK(cs_smsgDB);
-            SecMsgDB dbInbox;
-
-            if (dbInbox.Open("cw"))
-            {
-                if (dbInbox.ExistsSmesg(chKey))
-                {
-                    if (fDebugSmsg)
-                        printf("Message already exists in inbox db.\n");
-                } else
-                {
-                    dbInbox.WriteSmesg(chKey, smsgInbox);
-
-                    if (reportToGui)
-                        NotifySecMsgInboxChanged(smsgInbox);
-                    printf("SecureMsg saved to inbox, received with %s.\n", addressTo.c_str());
-                }
-            }
-        }
-    }
+    std::vector<SecMsgScanItem> vItems(1);
+    vItems[0].header = SecureMessageHeader(smsg.begin());
+    vItems[0].vchPayload.assign(pPayload, pPayload + smsg.nPayload);
+    SecureMsgScanBatch(vItems, reportToGui);
 
     return 0;
 }
@@ -2383,40 +3759,51 @@ int SecureMsgAddAddress(std::string& address, std::string& publicKey)
     return SecureMsgInsertAddress(hashKey, pubKey);
 }
 
-int SecureMsgRetrieve(SecMsgToken &token, SecureMessage &smsg)
+int SecureMsgRetrieve(SecMsgBucket& bkt, const SecMsgToken &token, const unsigned char*& pMessage)
 {
+    /*
+        pMessage points into the bucket's mapping, it stays valid while bkt.cs is held
+    */
+
     if (fDebugSmsg)
         printf("SecureMsgRetrieve() %d.\n", (int32_t) token.timestamp);
 
-    // -- has cs_smsg lock from SecureMsgReceiveData
-
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
+    AssertLockHeld(bkt.cs);
 
     int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
-    std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
 
-    //printf("bucket %"PRId64".\n", bucket);
-    //printf("bucket lld %lld.\n", bucket);
-    //printf("fileName %s.\n", fileName.c_str());
-
-    FILE *fp;
-    if (!(fp = fopen(fullpath.string().c_str(), "rb"))) {
-        printf("Error opening file: %s\nPath %s\n", strerror(errno), fullpath.string().c_str());
+    const unsigned char* pBegin;
+    size_t nSize;
+    if (!SecureMsgMapBucket(bucket, bkt, token.offset + SMSG_HDR_LEN, pBegin, nSize)) {
+        printf("SecureMsgRetrieve(): No message at %d in bucket %d.\n", (int) token.offset, (int) bucket);
         return 1;
     }
 
-    if (fseek(fp, token.offset, SEEK_SET) != 0) {
-        printf("fseek, strerror: %s.\n", strerror(errno));
-        fclose(fp);
+    SecureMessageHeader header(pBegin + token.offset);
+    uint64_t nEnd = token.offset + SMSG_HDR_LEN + header.nPayload;
+    if (nEnd > nSize
+        && !SecureMsgMapBucket(bucket, bkt, nEnd, pBegin, nSize)) {
+        printf("SecureMsgRetrieve(): Message at %d in bucket %d is truncated.\n", (int) token.offset, (int) bucket);
         return 1;
     }
 
-    if (fread(smsg.Header(), sizeof(unsigned char), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN) {
-        printf("fread header failed: %s\n", strerror(errno));
-        fclose(fp);
+    pMessage = pBegin + token.offset;
+    return 0;
+}
+
+int SecureMsgRetrieve(const SecMsgToken &token, SecureMessage &smsg)
+{
+    int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
+    boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(bucket, false);
+    if (!pbkt)
+        return 1;
+
+    LOCK(pbkt->cs);
+    const unsigned char* pMessage;
+    if (SecureMsgRetrieve(*pbkt, token, pMessage) != 0)
         return 1;
-    }
+
+    memcpy(smsg.Header(), pMessage, SMSG_HDR_LEN);
 
     try {
         smsg.vchPayload.resize(smsg.nPayload);
@@ -2426,14 +3813,7 @@ int SecureMsgRetrieve(SecMsgToken &token, SecureMessage &smsg)
         return 1;
     }
 
-    if (fread(&smsg.vchPayload[0], sizeof(unsigned char), smsg.nPayload, fp) != smsg.nPayload) {
-        printf("fread data failed: %s. Wanted %u bytes.\n", strerror(errno), smsg.nPayload);
-        fclose(fp);
-        return 1;
-    }
-
-
-    fclose(fp);
+    memcpy(&smsg.vchPayload[0], pMessage + SMSG_HDR_LEN, smsg.nPayload);
 
     return 0;
 }
@@ -2471,59 +3851,87 @@ int SecureMsgReceive(CNode* pfrom, std::vector<unsigned char>& vchData)
         return 1;
     }
 
-    std::map<int64_t, SecMsgBucket>::iterator itb;
+    boost::shared_ptr<SecMsgBucket> pbkt;
 
     if (nBunch == 0 || nBunch > 500) {
         printf("Error: Invalid no. messages received in bunch %u, for bucket %d.\n", nBunch, (int32_t) bktTime);
         Misbehaving(pfrom->id, 1);
 
         // -- release lock on bucket if it exists
-        itb = smsgBuckets.find(bktTime);
-        if (itb != smsgBuckets.end())
-            itb->second.nLockCount = 0;
+        if ((pbkt = SecureMsgGetBucket(bktTime, false))) {
+            LOCK(pbkt->cs);
+            pbkt->nLockCount = 0;
+        }
         return 1;
     }
 
     uint32_t n = 12;
+    std::vector<SecMsgScanItem> vScan;
+    vScan.reserve(nBunch);
+    std::vector<SecMsgToken> vRejected;
 
-    for (uint32_t i = 0; i < nBunch; ++i) {
+    // -- everything up to the disk write is cheap: the rate limit, then size checks, then one hash for the stamp
+    uint32_t nAllowance = SecureMsgPeerAllowance(pfrom);
+    if (nAllowance < nBunch && fDebugSmsg)
+        printf("Peer %u is over its rate limit, dropping %u of %u messages.\n", pfrom->smsgData.nPeerId, nBunch - nAllowance, nBunch);
+
+    for (uint32_t i = 0; i < nBunch && i < nAllowance; ++i) {
         if (vchData.size() - n < SMSG_HDR_LEN) {
             printf("Error: not enough data sent, n = %u.\n", n);
             break;
         }
 
         SecureMessageHeader header(&vchData[n]);
+        const unsigned char* pPayload = &vchData[n + SMSG_HDR_LEN];
+        if (vchData.size() - n - SMSG_HDR_LEN < header.nPayload) {
+            printf("Error: not enough data sent, n = %u.\n", n);
+            Misbehaving(pfrom->id, 1);
+            break;
+        }
+        n += SMSG_HDR_LEN + header.nPayload;
+        if (nSmsgPeerRate > 0)
+            pfrom->smsgData.dRateAllowance -= 1;
 
-        int rv = SecureMsgValidate(header, vchData.size() - n-SMSG_HDR_LEN);
+        int rv = SecureMsgValidate(header, header.nPayload);
         if (rv != 0) {
             Misbehaving(pfrom->id, 1);
             continue;
         }
 
+        if (fSmsgRequireStamp && !SecureMsgCheckStamp(header, pPayload)) {
+            if (fDebugSmsg)
+                printf("Dropping message without a valid stamp, %d.\n", (int32_t) header.timestamp);
+            vRejected.push_back(SecMsgToken(header.timestamp, pPayload, header.nPayload, 0));
+            continue;
+        }
+
         // -- store message, but don't hash bucket
-        if (SecureMsgStore(header, &vchData[n + SMSG_HDR_LEN], false) != 0) {
+        if (SecureMsgStore(header, pPayload, false) != 0) {
             // message dropped
             break; // continue?
         }
         
-        if (SecureMsgScanMessage(header, &vchData[n + SMSG_HDR_LEN], true) != 0) {
-            // message recipient is not this node (or failed)
-        }
-
-        n += SMSG_HDR_LEN + header.nPayload;
+        // -- trial decryption happens off this thread, see SecureMsgQueueScan
+        vScan.push_back(SecMsgScanItem());
+        vScan.back().header = header;
+        vScan.back().vchPayload.assign(pPayload, pPayload + header.nPayload);
     }
 
+    SecureMsgQueueScan(vScan);
+
     // -- if messages have been added, bucket must exist now
-    itb = smsgBuckets.find(bktTime);
-    if (itb == smsgBuckets.end()) {
+    if (!(pbkt = SecureMsgGetBucket(bktTime, !vRejected.empty()))) {
         if (fDebugSmsg)
             printf("Don't have bucket %d.\n", (int32_t) bktTime);
         return 1;
     }
 
-    itb->second.nLockCount  = 0; // this node has received data from peer, release lock
-    itb->second.nLockPeerId = 0;
-    itb->second.hashBucket();
+    LOCK(pbkt->cs);
+    pbkt->nLockCount  = 0; // this node has received data from peer, release lock
+    pbkt->nLockPeerId = 0;
+    for (std::vector<SecMsgToken>::const_iterator it = vRejected.begin(); it != vRejected.end(); ++it)
+        pbkt->addRejected(*it);
+    pbkt->hashBucket();
 
     return 0;
 }
@@ -2567,6 +3975,7 @@ int SecureMsgStoreUnscanned(const SecureMessageHeader &header, const unsigned ch
     std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01_wl.dat";
     fs::path fullpath = pathSmsgDir / fileName;
 
+    LOCK(cs_smsgUnscanned);
     FILE *fp;
     if (!(fp = fopen(fullpath.string().c_str(), "ab"))) {
         printf("Error opening file: %s (%d)\n", strerror(errno), __LINE__);
@@ -2622,12 +4031,17 @@ int SecureMsgStore(const SecureMessageHeader &smsg, const unsigned char *pPayloa
     int64_t bucket = smsg.timestamp - (smsg.timestamp % SMSG_BUCKET_LEN);
 
     {
-        // -- must lock cs_smsg before calling
-        //LOCK(cs_smsg);
+        boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(bucket, true);
+        LOCK(pbkt->cs);
+
+        if (pbkt->fRemoved) {
+            printf("Bucket %d expired.\n", (int) bucket);
+            return 1;
+        }
 
         SecMsgToken token(smsg.timestamp, pPayload, smsg.nPayload, 0);
 
-        std::set<SecMsgToken>& tokenSet = smsgBuckets[bucket].setTokens;
+        std::set<SecMsgToken>& tokenSet = pbkt->setTokens;
         std::set<SecMsgToken>::iterator it;
         it = tokenSet.find(token);
         if (it != tokenSet.end())
@@ -2660,6 +4074,12 @@ int SecureMsgStore(const SecureMessageHeader &smsg, const unsigned char *pPayloa
         std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
         fs::path fullpath = pathSmsgDir / fileName;
 
+        if (!SecureMsgIndexCheck(bucket, *pbkt))
+        {
+            printf("Error: Could not index %s.\n", fileName.c_str());
+            return 1;
+        }
+
         FILE *fp;
         if (!(fp = fopen(fullpath.string().c_str(), "ab")))
         {
@@ -2671,6 +4091,7 @@ int SecureMsgStore(const SecureMessageHeader &smsg, const unsigned char *pPayloa
         if (fseek(fp, 0, SEEK_END) != 0)
         {
             printf("Error fseek failed: %s\n", strerror(errno));
+            fclose(fp);
             return 1;
         }
 
@@ -2689,11 +4110,14 @@ int SecureMsgStore(const SecureMessageHeader &smsg, const unsigned char *pPayloa
 
         token.offset = ofs;
 
+        // -- a failed index update is caught and the index rebuilt by the next SecureMsgIndexCheck
+        SecureMsgIndexAppend(bucket, *pbkt, token, smsg.nPayload);
+
         //printf("token.offset: %"PRId64"\n", token.offset); // DEBUG
-        tokenSet.insert(token);
+        pbkt->addToken(token);
 
         if (fUpdateBucket)
-            smsgBuckets[bucket].hashBucket();
+            pbkt->hashBucket();
     }
 
     //if (fDebugSmsg)
@@ -2729,6 +4153,56 @@ int SecureMsgValidate(const SecureMessageHeader &smsg_header, size_t nPayload)
 }
 
 
+/*
+    Message stamp
+
+    A cheap proof of work relays can check without being able to decrypt:
+    the 3 reserved header bytes hold a nonce chosen so that SHA256 of the
+    header up to the MAC followed by the payload hash starts with
+    SMSG_POW_BITS zero bits. The MAC is computed after stamping, so older
+    nodes see nothing but reserved bytes they pass along untouched.
+*/
+
+static uint256 SecureMsgStampHash(const SecureMessageHeader &smsg, const unsigned char *pHashPayload)
+{
+    uint256 hash;
+    CSHA256().Write(smsg.begin(), smsg.mac - smsg.begin()).Write(pHashPayload, 32).Finalize(hash.begin());
+    return hash;
+}
+
+static bool SecureMsgStampValid(const uint256& hash)
+{
+    const unsigned char* p = hash.begin();
+    unsigned int nBits = SMSG_POW_BITS;
+    for (; nBits >= 8; nBits -= 8, ++p)
+        if (*p != 0)
+            return false;
+    return nBits == 0 || (*p >> (8 - nBits)) == 0;
+}
+
+bool SecureMsgStamp(SecureMessageHeader &smsg)
+{
+    /*
+        smsg.hash must hold the payload hash
+    */
+
+    for (uint32_t nNonce = 0; nNonce < (1 << 24); ++nNonce)
+    {
+        smsg.reserved[0] = nNonce & 0xFF;
+        smsg.reserved[1] = (nNonce >> 8) & 0xFF;
+        smsg.reserved[2] = (nNonce >> 16) & 0xFF;
+        if (SecureMsgStampValid(SecureMsgStampHash(smsg, smsg.hash)))
+            return true;
+    }
+    return false;
+}
+
+bool SecureMsgCheckStamp(const SecureMessageHeader &smsg, const unsigned char *pPayload)
+{
+    uint256 hashPayload = Hash(pPayload, pPayload + smsg.nPayload);
+    return SecureMsgStampValid(SecureMsgStampHash(smsg, hashPayload.begin()));
+}
+
 int SecureMsgEncrypt(SecureMessage& smsg, std::string& addressFrom, std::string& addressTo, std::string& message)
 {
     /* Create a secure message
@@ -2752,6 +4226,7 @@ int SecureMsgEncrypt(SecureMessage& smsg, std::string& addressFrom, std::string&
             9       Could not compress message data.
             10      Could not generate MAC.
             11      Encrypt failed.
+            12      Could not stamp message.
     */
 
     if (fDebugSmsg)
@@ -2953,6 +4428,12 @@ int SecureMsgEncrypt(SecureMessage& smsg, std::string& addressFrom, std::string&
     // -- calculate hash of encrypted payload
     memcpy(smsg.hash, Hash(&smsg.vchPayload[0], &smsg.vchPayload[smsg.nPayload]).begin(), 32);
 
+    // -- stamp before the MAC, it covers the reserved bytes
+    if (!SecureMsgStamp(smsg)) {
+        printf("Could not stamp message.\n");
+        return 12;
+    }
+
     // -- Calculate a 32 byte MAC with HMACSHA256, using key_m as salt
     //    Message authentication code of the header
     CHMAC_SHA256 hmac(&vchHashed[32], 32);
@@ -3168,39 +4649,9 @@ int SecureMsgDecrypt(bool fTestOnly, const std::string& address, const SecureMes
     }
 
 
-    CPubKey keyR(smsg.cpkR, smsg.cpkR+33);
-    if (!keyR.IsValid()) {
-        printf("Could not get compressed public key for key R.\n");
-        return 1;
-    }
-
-
-    // -- Do an EC point multiply with private key k and public key R. This gives you public EC key P.
-    secure_buffer vchP;
-    if (!DeriveKey(vchP, keyDest, keyR)) {
-        printf("ECDH key derivation failed\n");
-        return 1;
-    }
-
-
-    // -- Use public key P to calculate the SHA512 hash H.
-    //    The first 32 bytes of H are called key_e and the last 32 bytes are called key_m.
-    secure_buffer vchHashedDec(64); // 512 bits
-    secure_buffer sha512_mem(sizeof(CSHA512), 0);
-    CSHA512 &sha512 = *new (&sha512_mem[0]) CSHA512();
-    sha512.Write(&vchP[0], vchP.size());
-    sha512.Finalize(&vchHashedDec[0]);
-    sha512.~CSHA512();
-
-    // -- Message authentication code of header
-    SecureMessageHeader smsg_(smsg.begin());
-    memcpy(smsg_.mac, smsg.hash, 32);
-    unsigned char mac[32];
-    CHMAC_SHA256 hmac(&vchHashedDec[32], 32);
-    hmac.Write((const unsigned char*) smsg_.begin(), SMSG_HDR_LEN);
-    hmac.Finalize(mac);
-
-    if (memcmp(mac, smsg.mac, 32) != 0) {
+    // -- Derive key_e and key_m and check the message authentication code of the header
+    secure_buffer vchHashedDec;
+    if (!SecureMsgCheckMac(keyDest, smsg, vchHashedDec)) {
         if (fDebugSmsg)
             printf("MAC does not match for address %s.\n", coinAddrDest.ToString().c_str()); // expected if message is not to address on node
         return 1;
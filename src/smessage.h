@@ -16,6 +16,8 @@
 #include "wallet.h"
 #include "lz4/lz4.h"
 
+#include <boost/shared_ptr.hpp>
+
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > secure_buffer;
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > secure_string;
@@ -35,6 +37,21 @@ const unsigned int SMSG_TIME_IGNORE     = 90;                // seconds that a p
 
 const unsigned int SMSG_MAX_MSG_BYTES   = 4096;              // the user input part
 
+const unsigned int SMSG_SCAN_KEYS_PER_CHECK = 16;            // owned keys tried per trial decryption job
+const unsigned int SMSG_MAX_SCAN_THREADS    = 16;
+const unsigned int SMSG_UNLOCK_SCAN_CHUNK   = 256;           // wallet locked messages read and trial decrypted per step
+const unsigned int SMSG_CHAIN_SCAN_BLOCKS   = 500;           // blocks each thread reads per round of the chain scan, one checkpoint per round
+
+// -- flags sent with smsgPing and smsgPong, older nodes send none
+const uint32_t SMSG_PEER_RECONCILE          = (1 << 0);      // syncs buckets with smsgRecon
+const uint32_t SMSG_PEER_DIGEST             = (1 << 1);      // smsgInv carries the incremental bucket digest
+
+const unsigned int SMSG_POW_BITS            = 16;            // leading zero bits of a message stamp, see SecureMsgCheckStamp
+const unsigned int SMSG_RATE_PERIOD         = 60;            // -smsgpeerrate is messages per this many seconds
+
+const unsigned int SMSG_RECON_SLACK         = 8;             // differences an smsgRecon table is sized for beyond the difference in counts
+const unsigned int SMSG_RECON_MAX_CELLS     = 3 * 1024;
+
 // max size of payload worst case compression
 const unsigned int SMSG_MAX_MSG_WORST = LZ4_COMPRESSBOUND(SMSG_MAX_MSG_BYTES+SMSG_PL_HDR_LEN);
 
@@ -54,7 +71,7 @@ extern boost::signals2::signal<void (SecMsgStored& inboxHdr)> NotifySecMsgInboxC
 // Outbox db changed, called with lock cs_smsgDB held.
 extern boost::signals2::signal<void (SecMsgStored& outboxHdr)> NotifySecMsgOutboxChanged;
 
-// Wallet Unlocked, called after all messages received while locked have been processed.
+// Wallet Unlocked, called from the unlock scan thread after the messages received while locked have been processed.
 extern boost::signals2::signal<void ()> NotifySecMsgWalletUnlocked;
 
 
@@ -62,11 +79,13 @@ class SecMsgBucket;
 class SecMsgAddress;
 class SecMsgOptions;
 
-extern std::map<int64_t, SecMsgBucket>  smsgBuckets;
+extern std::map<int64_t, boost::shared_ptr<SecMsgBucket> > smsgBuckets;
 extern std::vector<SecMsgAddress>       smsgAddresses;
 extern SecMsgOptions                    smsgOptions;
 
-extern CCriticalSection cs_smsg;            // all except inbox and outbox
+// Lock order: cs_smsg, then SecMsgBucket::cs, then cs_smsgBuckets
+extern CCriticalSection cs_smsg;            // addresses, options and wallet locked files
+extern CCriticalSection cs_smsgBuckets;     // the smsgBuckets map
 extern CCriticalSection cs_smsgDB;
 
 
@@ -184,25 +203,56 @@ public:
 };
 
 
+class SecMsgBucketMap;
+
 class SecMsgBucket
 {
+/*
+    Each bucket is locked on its own, so peers can sync different buckets at the same time.
+    cs guards all members and the bucket's files.
+    timeChanged, hash and nMessages are the bucket's inventory entry, they are only
+    changed by hashBucket() with cs_smsgBuckets held as well, and can be read holding either lock.
+
+    nDigest is the sum of a hash of each token, so it is kept up to date in O(1) by addToken()
+    whatever order the tokens arrive in. nRejectedDigest is the same sum over setRejected, so
+    the digest of a peer's bucket that still holds the rejected tokens can be matched too. Peers without SMSG_PEER_DIGEST compare the XXH32 of the
+    ordered token list instead, legacyHash() computes that on demand and caches it until the next insert.
+*/
 public:
     SecMsgBucket()
     {
         timeChanged     = 0;
         hash            = 0;
+        nMessages       = 0;
+        nDigest         = 0;
+        nRejectedDigest = 0;
+        nLegacyHash     = 0;
+        fLegacyHashValid = false;
         nLockCount      = 0;
         nLockPeerId     = 0;
+        fRemoved        = false;
     };
     ~SecMsgBucket() {};
 
+    bool addToken(const SecMsgToken& token);
+    bool addRejected(const SecMsgToken& token);
     void hashBucket();
+    uint32_t legacyHash();
 
+    CCriticalSection            cs;
     int64_t                     timeChanged;
-    uint32_t                    hash;           // token set should get ordered the same on each node
+    uint32_t                    hash;           // nDigest when last published
+    uint32_t                    nMessages;      // setTokens.size() when last published
+    uint32_t                    nDigest;        // order independent digest of setTokens
+    uint32_t                    nRejectedDigest; // order independent digest of setRejected
+    uint32_t                    nLegacyHash;
+    bool                        fLegacyHashValid;
     uint32_t                    nLockCount;     // set when smsgWant first sent, unset at end of smsgMsg, ticks down in ThreadSecureMsg()
     uint32_t                    nLockPeerId;    // id of peer that bucket is locked for
+    bool                        fRemoved;       // expired or dumped, files are gone
     std::set<SecMsgToken>       setTokens;
+    std::set<SecMsgToken>       setRejected;    // dropped for a missing or invalid stamp, not asked for again
+    boost::shared_ptr<SecMsgBucketMap> pmap;    // read-only mapping of the .dat file
 
 };
 
@@ -258,6 +308,32 @@ public:
     bool fNewAddressAnon;
 };
 
+// -- progress of the background scan of messages received while the wallet was locked
+class SecMsgUnlockScanStatus
+{
+public:
+    SecMsgUnlockScanStatus()
+    {
+        fRunning    = false;
+        nStartTime  = 0;
+        nFiles      = 0;
+        nFilesDone  = 0;
+        nBytes      = 0;
+        nBytesDone  = 0;
+        nMessages   = 0;
+        nReceived   = 0;
+    }
+
+    bool        fRunning;
+    int64_t     nStartTime;     // of the current or last pass
+    uint32_t    nFiles;         // wallet locked bucket files found by the pass
+    uint32_t    nFilesDone;
+    uint64_t    nBytes;
+    uint64_t    nBytesDone;
+    uint32_t    nMessages;      // messages trial decrypted
+    uint32_t    nReceived;      // messages added to the inbox
+};
+
 
 class SecMsgStored
 {
@@ -310,6 +386,9 @@ public:
     bool WritePK(CKeyID& addr, CPubKey& pubkey);
     bool ExistsPK(CKeyID& addr);
 
+    bool ReadScanCheckpoint(CBlockLocator& locator);
+    bool WriteScanCheckpoint(const CBlockLocator& locator);
+
     bool NextSmesg(leveldb::Iterator* it, std::string& prefix, unsigned char* vchKey, SecMsgStored& smsgStored);
     bool NextSmesgKey(leveldb::Iterator* it, std::string& prefix, unsigned char* vchKey);
     bool ReadSmesg(unsigned char* chKey, SecMsgStored& smsgStored);
@@ -324,6 +403,8 @@ public:
 
 
 int SecureMsgBuildBucketSet();
+boost::shared_ptr<SecMsgBucket> SecureMsgGetBucket(int64_t bucket, bool fCreate);
+void SecureMsgRemoveBucketFiles(int64_t bucket, SecMsgBucket& bkt); // must hold bkt.cs
 int SecureMsgAddWalletAddresses();
 
 int SecureMsgReadIni();
@@ -331,23 +412,23 @@ int SecureMsgWriteIni();
 
 bool SecureMsgStart(bool fDontStart, bool fScanChain);
 
+void SecureMsgReadArgs(); // -smsgreconcile, -smsgrequirestamp and -smsgpeerrate
 bool SecureMsgEnable();
 bool SecureMsgDisable();
 
+uint32_t SecureMsgPeerAllowance(CNode* pnode); // messages pnode may send now under -smsgpeerrate
 bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRecv);
 bool SecureMsgSendData(CNode* pto, bool fSendTrickle);
+uint32_t SecureMsgBuildInventory(int64_t lastMatched, std::vector<unsigned char>& vchData, bool fLegacyHash);
 
 
 bool SecureMsgScanBlock(CBlock& block);
-bool ScanChainForPublicKeys(CBlockIndex* pindexStart, size_t n);
-bool SecureMsgScanBlockChain();
-int SecureMsgScanBuckets(std::string &, bool = false);
-
+bool ScanChainForPublicKeys(int nStartHeight);
+bool SecureMsgScanBlockChain(bool fRescan = false);
+int SecureMsgScanBuckets(std::string &);
 
-static inline int SecureMsgWalletUnlocked() {
-    std::string error;
-    return SecureMsgScanBuckets(error, true);
-}
+int SecureMsgWalletUnlocked();
+void SecureMsgGetUnlockScanStatus(SecMsgUnlockScanStatus& status);
 int SecureMsgWalletKeyChanged(std::string sAddress, std::string sLabel, ChangeType mode);
 
 int SecureMsgScanMessage(const SecureMessageHeader &smsg, const unsigned char *pPayload, bool reportToGui);
@@ -358,7 +439,8 @@ int SecureMsgGetLocalPublicKey(std::string& strAddress, std::string& strPublicKe
 
 int SecureMsgAddAddress(std::string& address, std::string& publicKey);
 
-int SecureMsgRetrieve(SecMsgToken &token, SecureMessage &smsg);
+int SecureMsgRetrieve(SecMsgBucket& bkt, const SecMsgToken &token, const unsigned char*& pMessage); // must hold bkt.cs
+int SecureMsgRetrieve(const SecMsgToken &token, SecureMessage &smsg);
 
 int SecureMsgReceive(CNode* pfrom, std::vector<unsigned char>& vchData);
 
@@ -370,6 +452,8 @@ int SecureMsgStore(const SecureMessage &smsg, bool fUpdateBucket);
 int SecureMsgSend(std::string& addressFrom, std::string& addressTo, std::string& message, std::string& sError);
 
 int SecureMsgValidate(const SecureMessageHeader &smsg, size_t nPayload);
+bool SecureMsgStamp(SecureMessageHeader &smsg);
+bool SecureMsgCheckStamp(const SecureMessageHeader &smsg, const unsigned char *pPayload);
 
 int SecureMsgEncrypt(SecureMessage& smsg, std::string& addressFrom, std::string& addressTo, std::string& message);
 
@@ -0,0 +1,505 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "miner.h"
+#include "momentum.h"
+#include "net.h"
+#include "rpcprotocol.h"
+#include "rpcserver.h"
+#include "streams.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "wallet.h"
+
+#include <deque>
+#include <map>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace boost::asio;
+using namespace json_spirit;
+using namespace std;
+
+namespace {
+
+const uint32_t MAX_STRATUM_SESSIONS = (uint32_t)1 << (32 - STRATUM_NONCE_BITS);
+//! Jobs kept for late submissions while the tip does not change
+const size_t MAX_STRATUM_JOBS = 8;
+//! Seconds between checks whether the template should be rebuilt
+const int STRATUM_REFRESH_INTERVAL = 5;
+//! Longest request line accepted from a miner, in bytes
+const size_t MAX_STRATUM_LINE = 4096;
+
+class CStratumServer;
+
+/** One persistent miner connection. Only touched from the server thread. */
+class CStratumSession : public boost::enable_shared_from_this<CStratumSession>
+{
+public:
+    CStratumSession(io_service& io, CStratumServer& serverIn) :
+        socket(io), server(serverIn), nId(0), fSubscribed(false), buffer(MAX_STRATUM_LINE) {}
+
+    ip::tcp::socket socket;
+
+    void Start();
+    void Send(const string& strLine);
+    void Close();
+
+    uint32_t GetId() const { return nId; }
+    void SetId(uint32_t nIdIn) { nId = nIdIn; }
+    uint32_t GetNonceStart() const { return nId << STRATUM_NONCE_BITS; }
+    bool IsSubscribed() const { return fSubscribed; }
+    void SetSubscribed() { fSubscribed = true; }
+
+private:
+    CStratumServer& server;
+    uint32_t nId;
+    bool fSubscribed;
+    boost::asio::streambuf buffer;
+    deque<string> vSendQueue;
+
+    void Read();
+    void HandleRead(const boost::system::error_code& err, size_t nBytes);
+    void HandleWrite(const boost::system::error_code& err);
+};
+
+typedef boost::shared_ptr<CStratumSession> StratumSessionRef;
+
+/** Block template handed out as one job */
+struct CStratumJob
+{
+    boost::shared_ptr<CBlockTemplate> pblocktemplate;
+    uint256 hashTarget;
+};
+
+class CStratumServer
+{
+public:
+    CStratumServer(CWallet* pwalletIn) :
+        pwallet(pwalletIn), reservekey(pwalletIn), acceptor(io), timer(io),
+        nNextSession(0), nNextJob(0), nExtraNonce(0), pindexPrev(NULL),
+        nTransactionsUpdatedLast(0), nJobTime(0) {}
+
+    bool Bind(const ip::tcp::endpoint& endpoint, string& strError);
+    void Run();
+    void Stop();
+
+    /** Tip changed: called from validation, hands over to the server thread */
+    void BlockTip(const uint256& hash) { io.post(boost::bind(&CStratumServer::UpdateJob, this, true)); }
+
+    void ProcessLine(const StratumSessionRef& session, const string& strLine);
+    void RemoveSession(const CStratumSession* psession);
+
+private:
+    io_service io;
+    CWallet* pwallet;
+    CReserveKey reservekey;
+    ip::tcp::acceptor acceptor;
+    deadline_timer timer;
+
+    map<uint32_t, StratumSessionRef> mapSessions;
+    uint32_t nNextSession;
+
+    map<uint32_t, CStratumJob> mapJobs;
+    uint32_t nNextJob;
+    unsigned int nExtraNonce;
+    CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nJobTime;
+
+    void Accept();
+    void HandleAccept(StratumSessionRef session, const boost::system::error_code& err);
+    void ScheduleRefresh();
+    void HandleRefresh(const boost::system::error_code& err);
+
+    void UpdateJob(bool fForce);
+    void Notify(const StratumSessionRef& session, bool fClean);
+
+    Value Subscribe(const StratumSessionRef& session);
+    Value Submit(const StratumSessionRef& session, const Array& params);
+};
+
+void CStratumSession::Start()
+{
+    Read();
+}
+
+void CStratumSession::Read()
+{
+    async_read_until(socket, buffer, '\n',
+        boost::bind(&CStratumSession::HandleRead, shared_from_this(), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+void CStratumSession::HandleRead(const boost::system::error_code& err, size_t nBytes)
+{
+    if (err) {
+        // Covers disconnects as well as lines longer than MAX_STRATUM_LINE
+        if (err != error::operation_aborted)
+            LogPrint("stratum", "stratum: session %u closed: %s\n", nId, err.message());
+        Close();
+        return;
+    }
+
+    istream stream(&buffer);
+    string strLine;
+    getline(stream, strLine);
+    server.ProcessLine(shared_from_this(), strLine);
+    if (socket.is_open())
+        Read();
+}
+
+void CStratumSession::Send(const string& strLine)
+{
+    if (!socket.is_open())
+        return;
+    bool fWriting = !vSendQueue.empty();
+    vSendQueue.push_back(strLine);
+    if (!fWriting)
+        async_write(socket, boost::asio::buffer(vSendQueue.front()),
+            boost::bind(&CStratumSession::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CStratumSession::HandleWrite(const boost::system::error_code& err)
+{
+    if (err) {
+        Close();
+        return;
+    }
+    vSendQueue.pop_front();
+    if (!vSendQueue.empty())
+        async_write(socket, boost::asio::buffer(vSendQueue.front()),
+            boost::bind(&CStratumSession::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CStratumSession::Close()
+{
+    boost::system::error_code ec;
+    socket.close(ec);
+    server.RemoveSession(this);
+}
+
+bool CStratumServer::Bind(const ip::tcp::endpoint& endpoint, string& strError)
+{
+    try {
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen(socket_base::max_connections);
+    } catch (const boost::system::system_error& e) {
+        strError = strprintf(_("An error occurred while setting up the mining server address %s port %u for listening: %s"),
+                             endpoint.address().to_string(), endpoint.port(), e.what());
+        return false;
+    }
+    LogPrintf("Mining server listening on %s port %u\n", endpoint.address().to_string(), endpoint.port());
+    Accept();
+    ScheduleRefresh();
+    return true;
+}
+
+void CStratumServer::Run()
+{
+    RenameThread("bitcredit-stratum");
+    io.post(boost::bind(&CStratumServer::UpdateJob, this, true));
+    io.run();
+}
+
+void CStratumServer::Stop()
+{
+    // Safe from any thread; the acceptor, timer and sessions are torn down
+    // with the server once Run() has returned
+    io.stop();
+}
+
+void CStratumServer::RemoveSession(const CStratumSession* psession)
+{
+    // The id may already belong to a newer session if this one was closed twice
+    map<uint32_t, StratumSessionRef>::iterator it = mapSessions.find(psession->GetId());
+    if (it != mapSessions.end() && it->second.get() == psession)
+        mapSessions.erase(it);
+}
+
+void CStratumServer::Accept()
+{
+    StratumSessionRef session(new CStratumSession(io, *this));
+    acceptor.async_accept(session->socket, boost::bind(&CStratumServer::HandleAccept, this, session, boost::asio::placeholders::error));
+}
+
+void CStratumServer::HandleAccept(StratumSessionRef session, const boost::system::error_code& err)
+{
+    if (err == error::operation_aborted || !acceptor.is_open())
+        return;
+
+    if (err) {
+        LogPrintf("%s: Error: %s\n", __func__, err.message());
+    } else {
+        boost::system::error_code ec;
+        ip::tcp::endpoint peer = session->socket.remote_endpoint(ec);
+        if (ec || !ClientAllowed(peer.address()) || mapSessions.size() >= MAX_STRATUM_SESSIONS) {
+            // Not allowed, or every nonce range is in use
+            session->socket.close(ec);
+        } else {
+            while (mapSessions.count(nNextSession))
+                nNextSession = (nNextSession + 1) % MAX_STRATUM_SESSIONS;
+            session->SetId(nNextSession);
+            nNextSession = (nNextSession + 1) % MAX_STRATUM_SESSIONS;
+
+            LogPrint("stratum", "stratum: session %u connected from %s\n", session->GetId(), peer.address().to_string());
+            mapSessions[session->GetId()] = session;
+            session->Start();
+        }
+    }
+    Accept();
+}
+
+void CStratumServer::ScheduleRefresh()
+{
+    timer.expires_from_now(boost::posix_time::seconds(STRATUM_REFRESH_INTERVAL));
+    timer.async_wait(boost::bind(&CStratumServer::HandleRefresh, this, boost::asio::placeholders::error));
+}
+
+void CStratumServer::HandleRefresh(const boost::system::error_code& err)
+{
+    if (err == error::operation_aborted)
+        return;
+    UpdateJob(false);
+    ScheduleRefresh();
+}
+
+/**
+ * Build a new job when the tip moved, or when the mempool changed and the
+ * current template is over a minute old (the same rule as the internal
+ * miner and getwork), and push it to every subscribed miner.
+ */
+void CStratumServer::UpdateJob(bool fForce)
+{
+    CBlockIndex* pindexTip = chainActive.Tip();
+    bool fNewTip = pindexTip != pindexPrev;
+    if (!fForce && !fNewTip &&
+        !(mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nJobTime > 60))
+        return;
+
+    if (IsInitialBlockDownload() || (Params().MiningRequiresPeers() && vNodes.empty()))
+        return;
+
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    boost::shared_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
+    if (!pblocktemplate) {
+        LogPrintf("Error in mining server: Keypool ran out, please call keypoolrefill\n");
+        return;
+    }
+    CBlock* pblock = &pblocktemplate->block;
+    IncrementExtraNonce(pblock, pindexTip, nExtraNonce);
+
+    if (fNewTip)
+        mapJobs.clear();
+    while (mapJobs.size() >= MAX_STRATUM_JOBS)
+        mapJobs.erase(mapJobs.begin());
+
+    uint32_t nJobId = nNextJob++;
+    CStratumJob& job = mapJobs[nJobId];
+    job.pblocktemplate = pblocktemplate;
+    job.hashTarget.SetCompact(pblock->nBits);
+    pindexPrev = pindexTip;
+    nJobTime = GetTime();
+
+    LogPrint("stratum", "stratum: job %x at height %d for %u sessions\n", nJobId, pindexTip->nHeight + 1, mapSessions.size());
+    BOOST_FOREACH(const PAIRTYPE(uint32_t, StratumSessionRef)& item, mapSessions)
+        if (item.second->IsSubscribed())
+            Notify(item.second, fNewTip);
+}
+
+void CStratumServer::Notify(const StratumSessionRef& session, bool fClean)
+{
+    if (mapJobs.empty())
+        return;
+    uint32_t nJobId = mapJobs.rbegin()->first;
+    const CStratumJob& job = mapJobs.rbegin()->second;
+
+    CBlock block(job.pblocktemplate->block);
+    block.nNonce = session->GetNonceStart();
+    block.nBirthdayA = 0;
+    block.nBirthdayB = 0;
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << block.GetBlockHeader();
+
+    Array params;
+    params.push_back(strprintf("%x", nJobId));
+    params.push_back(HexStr(ssHeader.begin(), ssHeader.end()));
+    params.push_back(block.GetMidHash().GetHex());
+    params.push_back(HexStr(BEGIN(job.hashTarget), END(job.hashTarget)));
+    params.push_back(fClean);
+    session->Send(JSONRPCRequest("mining.notify", params, Value::null));
+}
+
+void CStratumServer::ProcessLine(const StratumSessionRef& session, const string& strLine)
+{
+    CStratumRequest request;
+    try {
+        ParseStratumRequest(strLine, request);
+
+        Value result;
+        if (request.strMethod == "mining.subscribe")
+            result = Subscribe(session);
+        else if (request.strMethod == "mining.submit")
+            result = Submit(session, request.params);
+        else
+            throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+
+        session->Send(JSONRPCReply(result, Value::null, request.id));
+        if (request.strMethod == "mining.subscribe")
+            Notify(session, true);
+    } catch (const Object& objError) {
+        session->Send(JSONRPCReply(Value::null, objError, request.id));
+    } catch (const std::exception& e) {
+        session->Send(JSONRPCReply(Value::null, JSONRPCError(RPC_PARSE_ERROR, e.what()), request.id));
+    }
+}
+
+Value CStratumServer::Subscribe(const StratumSessionRef& session)
+{
+    session->SetSubscribed();
+
+    Object result;
+    result.push_back(Pair("session", (int64_t)session->GetId()));
+    result.push_back(Pair("nonce_start", (int64_t)session->GetNonceStart()));
+    result.push_back(Pair("nonce_count", (int64_t)1 << STRATUM_NONCE_BITS));
+    return result;
+}
+
+Value CStratumServer::Submit(const StratumSessionRef& session, const Array& params)
+{
+    if (!session->IsSubscribed())
+        throw JSONRPCError(RPC_INVALID_REQUEST, "Not subscribed");
+    CStratumSolution solution;
+    ParseStratumSubmit(params, solution);
+
+    map<uint32_t, CStratumJob>::iterator it = mapJobs.find(solution.nJobId);
+    if (it == mapJobs.end())
+        throw JSONRPCError(RPC_VERIFY_ERROR, "stale-job");
+    const CStratumJob& job = it->second;
+
+    CBlock block(job.pblocktemplate->block);
+    CheckStratumSolution(block, solution, job.hashTarget, session->GetNonceStart());
+
+    LogPrintf("Mining server: session %u found block %s\n", session->GetId(), block.GetHash().ToString());
+    if (!ProcessBlockFound(&block, *pwallet, reservekey))
+        throw JSONRPCError(RPC_VERIFY_REJECTED, "rejected");
+    return true;
+}
+
+CStratumServer* pstratum = NULL;
+boost::thread* pstratumThread = NULL;
+
+} // anon namespace
+
+void ParseStratumRequest(const string& strLine, CStratumRequest& request)
+{
+    Value valRequest;
+    if (!read_string(strLine, valRequest) || valRequest.type() != obj_type)
+        throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+    const Object& obj = valRequest.get_obj();
+    request.id = find_value(obj, "id");
+
+    Value valMethod = find_value(obj, "method");
+    if (valMethod.type() != str_type)
+        throw JSONRPCError(RPC_INVALID_REQUEST, "Method must be a string");
+    request.strMethod = valMethod.get_str();
+
+    Value valParams = find_value(obj, "params");
+    if (valParams.type() == array_type)
+        request.params = valParams.get_array();
+    else if (valParams.type() == null_type)
+        request.params.clear();
+    else
+        throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
+}
+
+void ParseStratumSubmit(const Array& params, CStratumSolution& solution)
+{
+    if (params.size() != 4 || params[0].type() != str_type || params[1].type() != int_type ||
+        params[2].type() != int_type || params[3].type() != int_type)
+        throw JSONRPCError(RPC_INVALID_PARAMS, "Expected [job_id, nNonce, nBirthdayA, nBirthdayB]");
+
+    const string& strJobId = params[0].get_str();
+    if (strJobId.empty() || strJobId.size() > 8 || !IsHex(strJobId.size() % 2 ? "0" + strJobId : strJobId))
+        throw JSONRPCError(RPC_INVALID_PARAMS, "Invalid job_id");
+    solution.nJobId = strtoul(strJobId.c_str(), NULL, 16);
+    solution.nNonce = (uint32_t)params[1].get_int64();
+    solution.nBirthdayA = (uint32_t)params[2].get_int64();
+    solution.nBirthdayB = (uint32_t)params[3].get_int64();
+}
+
+void CheckStratumSolution(CBlock& block, const CStratumSolution& solution, const uint256& hashTarget, uint32_t nNonceStart)
+{
+    // Wraps for the last session, whose range ends at 2^32
+    if (solution.nNonce - nNonceStart >= (uint32_t)1 << STRATUM_NONCE_BITS)
+        throw JSONRPCError(RPC_VERIFY_REJECTED, "nonce-out-of-range");
+
+    block.nNonce = solution.nNonce;
+    block.nBirthdayA = solution.nBirthdayA;
+    block.nBirthdayB = solution.nBirthdayB;
+
+    if (!bts::momentum_verify(block.GetMidHash(), block.nBirthdayA, block.nBirthdayB))
+        throw JSONRPCError(RPC_VERIFY_REJECTED, "bad-birthdays");
+    if (block.GetHash() > hashTarget)
+        throw JSONRPCError(RPC_VERIFY_REJECTED, "high-hash");
+}
+
+bool StartStratumServer(CWallet* pwallet, string& strError)
+{
+    if (!GetBoolArg("-stratum", false))
+        return true;
+    if (!pwallet) {
+        strError = _("The mining server (-stratum) requires a wallet");
+        return false;
+    }
+
+    // Miners don't authenticate, so only listen beyond loopback when asked
+    // to; -rpcallowip still decides who may connect
+    int nPort = GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    ip::tcp::endpoint endpoint(ip::address_v4::loopback(), nPort);
+    if (mapArgs.count("-stratumbind")) {
+        boost::system::error_code ec;
+        ip::address address = ip::address::from_string(mapArgs["-stratumbind"], ec);
+        if (ec) {
+            strError = strprintf(_("Could not parse -stratumbind value %s as network address"), mapArgs["-stratumbind"]);
+            return false;
+        }
+        endpoint.address(address);
+    }
+
+    assert(pstratum == NULL);
+    pstratum = new CStratumServer(pwallet);
+    if (!pstratum->Bind(endpoint, strError)) {
+        delete pstratum;
+        pstratum = NULL;
+        return false;
+    }
+    uiInterface.NotifyBlockTip.connect(boost::bind(&CStratumServer::BlockTip, pstratum, _1));
+    pstratumThread = new boost::thread(boost::bind(&CStratumServer::Run, pstratum));
+    return true;
+}
+
+void StopStratumServer()
+{
+    if (pstratum == NULL)
+        return;
+    uiInterface.NotifyBlockTip.disconnect(boost::bind(&CStratumServer::BlockTip, pstratum, _1));
+    pstratum->Stop();
+    pstratumThread->join();
+    delete pstratumThread;
+    pstratumThread = NULL;
+    delete pstratum;
+    pstratum = NULL;
+}
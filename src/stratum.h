@@ -0,0 +1,87 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCREDIT_STRATUM_H
+#define BITCREDIT_STRATUM_H
+
+#include "json/json_spirit_value.h"
+
+#include <stdint.h>
+#include <string>
+
+class CBlock;
+class CWallet;
+class uint256;
+
+static const int DEFAULT_STRATUM_PORT = 3333;
+//! Each session mines its own 2^STRATUM_NONCE_BITS nonces of every job
+static const int STRATUM_NONCE_BITS = 20;
+
+/**
+ * Push-based mining server for external Momentum miners.
+ *
+ * Miners keep a TCP connection open and exchange newline-terminated JSON-RPC
+ * messages with the node, in the style of stratum:
+ *
+ *  - mining.subscribe []
+ *      Registers the connection for work. The reply carries the session
+ *      number and the nonce range [nonce_start, nonce_start + nonce_count)
+ *      reserved for it; the current job is pushed right after.
+ *
+ *  - mining.notify [job_id, data, midhash, target, clean_jobs]  (pushed)
+ *      Sent whenever the tip or the block template changes. data is the
+ *      88-byte header as in getwork, with nNonce set to nonce_start and no
+ *      birthdays; midhash is the Momentum midHash of that header. If
+ *      clean_jobs is true all earlier jobs are stale.
+ *
+ *  - mining.submit [job_id, nNonce, nBirthdayA, nBirthdayB]
+ *      Submits a solution. nNonce must lie in the session's nonce range,
+ *      the birthdays are checked with momentum_verify and the header hash
+ *      against the target before the block is processed like a locally
+ *      mined one.
+ */
+
+/** A request line from a miner */
+struct CStratumRequest
+{
+    std::string strMethod;
+    json_spirit::Array params;
+    json_spirit::Value id;
+};
+
+/**
+ * Parse one request line into request. Throws a JSON-RPC error object if
+ * it is malformed; request.id is filled in as soon as it is known, so the
+ * error can still be answered.
+ */
+void ParseStratumRequest(const std::string& strLine, CStratumRequest& request);
+
+/** The params of mining.submit */
+struct CStratumSolution
+{
+    uint32_t nJobId;
+    uint32_t nNonce;
+    uint32_t nBirthdayA;
+    uint32_t nBirthdayB;
+};
+
+/** Parse the params of mining.submit; throws a JSON-RPC error object if they are malformed */
+void ParseStratumSubmit(const json_spirit::Array& params, CStratumSolution& solution);
+
+/**
+ * Put solution into block, a copy of the job's block, and check that its
+ * nonce lies in the session's range starting at nNonceStart and its proof
+ * of work against hashTarget. Throws a JSON-RPC error object if it fails.
+ */
+void CheckStratumSolution(CBlock& block, const CStratumSolution& solution, const uint256& hashTarget, uint32_t nNonceStart);
+
+/**
+ * Start the mining server if -stratum is set; pwallet pays the coinbase.
+ * Returns false and sets strError if it could not be started.
+ */
+bool StartStratumServer(CWallet* pwallet, std::string& strError);
+/** Stop the mining server and drop all miner connections */
+void StopStratumServer();
+
+#endif // BITCREDIT_STRATUM_H
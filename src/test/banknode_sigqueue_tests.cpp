@@ -0,0 +1,91 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "banknode-sigqueue.h"
+
+#include "net.h"
+#include "netbase.h"
+#include "pubkey.h"
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+typedef CBanknodeSigQueue::CSigJob CSigJob;
+
+// Wait for the worker to verify the pending signatures and take nodeid's messages
+static bool WaitReady(CBanknodeSigQueue& queue, NodeId nodeid, vector<CSigJob>& vJobs)
+{
+    for (int i = 0; i < 500; i++) {
+        if (queue.TakeReady(nodeid, vJobs))
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_SUITE(banknode_sigqueue_tests)
+
+BOOST_AUTO_TEST_CASE(sigqueue_dedup_replay)
+{
+    CBanknodeSigQueue queue;
+    CNode node1(INVALID_SOCKET, CAddress(CService("127.0.0.1", 1)), "", true);
+    CNode node2(INVALID_SOCKET, CAddress(CService("127.0.0.2", 1)), "", true);
+
+    // Not running yet: the caller verifies itself
+    CPubKey pubkey;
+    vector<unsigned char> vchSig(65, 0x1f);
+    string strMessage = "banknode sigqueue test";
+    CDataStream vMsg1(SER_NETWORK, PROTOCOL_VERSION), vMsg2(SER_NETWORK, PROTOCOL_VERSION);
+    vMsg1 << 1;
+    vMsg2 << 2;
+    BOOST_CHECK(!queue.Defer(&node1, "dsee", vMsg1, pubkey, vchSig, strMessage));
+
+    boost::thread_group threadGroup;
+    queue.Start(threadGroup, 1);
+
+    // The same signature relayed by two peers, and twice by the first. The
+    // worker takes cs_vNodes before a batch, so all three are parked first
+    {
+        LOCK(cs_vNodes);
+        BOOST_CHECK(queue.Defer(&node1, "dsee", vMsg1, pubkey, vchSig, strMessage));
+        BOOST_CHECK(queue.Defer(&node1, "dsee", vMsg1, pubkey, vchSig, strMessage));
+        BOOST_CHECK(queue.Defer(&node2, "dsee", vMsg2, pubkey, vchSig, strMessage));
+    }
+
+    // Both peers get their own message back, once
+    vector<CSigJob> vJobs1, vJobs2;
+    BOOST_CHECK(WaitReady(queue, node1.id, vJobs1));
+    BOOST_CHECK(WaitReady(queue, node2.id, vJobs2));
+    BOOST_CHECK_EQUAL(vJobs1.size(), 1U);
+    BOOST_CHECK_EQUAL(vJobs2.size(), 1U);
+    if (vJobs1.size() == 1 && vJobs2.size() == 1) {
+        BOOST_CHECK_EQUAL(vJobs1[0].nodeid, node1.id);
+        BOOST_CHECK_EQUAL(vJobs1[0].strCommand, "dsee");
+        BOOST_CHECK(vJobs1[0].vMsg.str() == vMsg1.str());
+        BOOST_CHECK(vJobs2[0].vMsg.str() == vMsg2.str());
+        BOOST_CHECK(vJobs1[0].nTime > 0);
+    }
+    BOOST_CHECK(!queue.TakeReady(node1.id, vJobs1));
+
+    // Verified once; the handlers are answered from the cache when the messages are replayed
+    BOOST_CHECK_EQUAL(queue.GetVerifiedCount(), 1U);
+    BOOST_CHECK(!queue.Verify(pubkey, vchSig, strMessage));
+    BOOST_CHECK(!queue.Defer(&node2, "dsee", vMsg2, pubkey, vchSig, strMessage));
+    BOOST_CHECK_EQUAL(queue.GetVerifiedCount(), 1U);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "banknodeman.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "netbase.h"
+#include "streams.h"
+#include "timedata.h"
+#include "util.h"
+#include "version.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static CBanknode MakeBanknode(int n)
+{
+    CBanknode mn(CService("10.0.0.1", 9000 + n), CTxIn(COutPoint(uint256(n), 0)), CPubKey(), vector<unsigned char>(), GetAdjustedTime(), CPubKey(), PROTOCOL_VERSION);
+    mn.UpdateLastSeen();
+    return mn;
+}
+
+// Write ssData to mncache.dat the way CBanknodeDB does, under version nVersion
+static void WriteCacheFile(uint32_t nVersion, CDataStream ssData)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << string("BanknodeCache");
+    ss << FLATDATA(Params().MessageStart());
+    ss << nVersion;
+    ss.write(&ssData[0], ssData.size());
+    ss << Hash(ss.begin(), ss.end());
+
+    FILE* file = fopen((GetDataDir() / "mncache.dat").string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    fileout << ss;
+}
+
+BOOST_AUTO_TEST_SUITE(banknodeman_tests)
+
+BOOST_AUTO_TEST_CASE(mncache_roundtrip)
+{
+    CBanknodeMan mnodemanSave;
+    for (int i = 1; i <= 3; i++) {
+        CBanknode mn = MakeBanknode(i);
+        BOOST_CHECK(mnodemanSave.Add(mn));
+    }
+    mnodemanSave.nDsqCount = 7;
+
+    CBanknodeDB mndb;
+    BOOST_CHECK(mndb.Write(mnodemanSave));
+    BOOST_CHECK_EQUAL(mndb.Verify(), CBanknodeDB::Ok);
+
+    CBanknodeMan mnodemanLoad;
+    BOOST_CHECK_EQUAL(mndb.Read(mnodemanLoad), CBanknodeDB::Ok);
+    BOOST_CHECK_EQUAL(mnodemanLoad.size(), 3);
+    BOOST_CHECK_EQUAL(mnodemanLoad.nDsqCount, 7);
+    for (int i = 1; i <= 3; i++) {
+        CBanknode* pmn = mnodemanLoad.Find(CTxIn(COutPoint(uint256(i), 0)));
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->addr == CService("10.0.0.1", 9000 + i));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(mncache_corrupt_entry)
+{
+    // a garbled entry between two good ones is skipped by its length
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << map<CNetAddr, int64_t>() << map<CNetAddr, int64_t>() << map<COutPoint, int64_t>() << (int64_t)0;
+    ss << (uint32_t)3;
+    CBanknode mn1 = MakeBanknode(1), mn3 = MakeBanknode(3);
+    ss << (uint32_t)::GetSerializeSize(mn1, SER_DISK, CLIENT_VERSION) << mn1;
+    string strGarbage(5, '\xff');
+    ss << (uint32_t)strGarbage.size();
+    ss.write(strGarbage.data(), strGarbage.size());
+    ss << (uint32_t)::GetSerializeSize(mn3, SER_DISK, CLIENT_VERSION) << mn3;
+    WriteCacheFile(BANKNODES_CACHE_VERSION, ss);
+
+    CBanknodeDB mndb;
+    CBanknodeMan mnodemanLoad;
+    BOOST_CHECK_EQUAL(mndb.Read(mnodemanLoad), CBanknodeDB::Ok);
+    BOOST_CHECK_EQUAL(mnodemanLoad.size(), 2);
+    BOOST_CHECK(mnodemanLoad.Find(mn1.vin) != NULL);
+    BOOST_CHECK(mnodemanLoad.Find(CTxIn(COutPoint(uint256(2), 0))) == NULL);
+    BOOST_CHECK(mnodemanLoad.Find(mn3.vin) != NULL);
+
+    // a length running past the end of the data fails the whole file
+    CDataStream ssTruncated(SER_DISK, CLIENT_VERSION);
+    ssTruncated << map<CNetAddr, int64_t>() << map<CNetAddr, int64_t>() << map<COutPoint, int64_t>() << (int64_t)0;
+    ssTruncated << (uint32_t)1 << (uint32_t)1000 << mn1;
+    WriteCacheFile(BANKNODES_CACHE_VERSION, ssTruncated);
+    BOOST_CHECK_EQUAL(mndb.Read(mnodemanLoad), CBanknodeDB::IncorrectFormat);
+    BOOST_CHECK_EQUAL(mnodemanLoad.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mncache_version_mismatch)
+{
+    CBanknodeMan mnodemanSave;
+    CBanknode mn = MakeBanknode(1);
+    BOOST_CHECK(mnodemanSave.Add(mn));
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    mnodemanSave.WriteCache(ss);
+
+    // a file of another version is rebuilt from the network, not parsed
+    WriteCacheFile(BANKNODES_CACHE_VERSION - 1, ss);
+    CBanknodeDB mndb;
+    CBanknodeMan mnodemanLoad;
+    BOOST_CHECK_EQUAL(mndb.Verify(), CBanknodeDB::IncorrectFormat);
+    BOOST_CHECK_EQUAL(mndb.Read(mnodemanLoad), CBanknodeDB::IncorrectFormat);
+    BOOST_CHECK_EQUAL(mnodemanLoad.size(), 0);
+
+    WriteCacheFile(BANKNODES_CACHE_VERSION, ss);
+    BOOST_CHECK_EQUAL(mndb.Read(mnodemanLoad), CBanknodeDB::Ok);
+    BOOST_CHECK_EQUAL(mnodemanLoad.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bidtracker.h"
+
+#include "base58.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static string TestAddress(uint64_t n)
+{
+    return CBitcreditAddress(CKeyID(uint160(n))).ToString();
+}
+
+BOOST_AUTO_TEST_SUITE(bidtracker_tests)
+
+BOOST_AUTO_TEST_CASE(bidtracker_malformed_lines)
+{
+    boost::filesystem::path path = GetDataDir() / "bidtracker_tests.txt";
+    string strA = TestAddress(1), strB = TestAddress(2), strC = TestAddress(3), strD = TestAddress(4);
+    {
+        ofstream file(path.string().c_str(), ios::out | ios::trunc | ios::binary);
+        file << strA << ",100\n"
+             << "\n"
+             << "   \r\n"
+             << strB << ",250\r\n"            // CRLF line ending
+             << strC << " 300\n"              // missing comma
+             << "1NotAnAddress,400\n"         // bad address
+             << strD << ",-5\n"               // negative amount
+             << strD << ",12abc\n"            // not a number
+             << strC << ",\n"                 // no amount
+             << ",700\n"                      // no address
+             << strA << ",150";               // last one wins, no final newline
+    }
+
+    CBidTracker tracker;
+    tracker.Init(path);
+    map<string, CAmount> mapBids = tracker.GetBids();
+    BOOST_CHECK_EQUAL(mapBids.size(), 2U);
+    BOOST_CHECK_EQUAL(mapBids[strA], 150);
+    BOOST_CHECK_EQUAL(mapBids[strB], 250);
+    BOOST_CHECK(!mapBids.count(strC));
+    BOOST_CHECK(!mapBids.count(strD));
+
+    // An unchanged file is not reloaded; SetBid rewrites it
+    BOOST_CHECK(!tracker.Refresh());
+    BOOST_CHECK(tracker.SetBid(strC, 42));
+    BOOST_CHECK(tracker.SetBid(strB, 0));
+    CBidTracker reloaded;
+    reloaded.Init(path);
+    mapBids = reloaded.GetBids();
+    BOOST_CHECK_EQUAL(mapBids.size(), 2U);
+    BOOST_CHECK_EQUAL(mapBids[strA], 150);
+    BOOST_CHECK_EQUAL(mapBids[strC], 42);
+
+    // A missing file means no bids
+    boost::filesystem::remove(path);
+    BOOST_CHECK(reloaded.Refresh());
+    BOOST_CHECK(reloaded.GetBids().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
+#include "crypto/sha512_batch.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
 #include "random.h"
@@ -15,6 +16,7 @@
 #include <vector>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(crypto_tests)
@@ -282,4 +284,39 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+BOOST_AUTO_TEST_CASE(sha512_nonce_batch)
+{
+    unsigned char suffix[SHA512_BATCH_SUFFIX_SIZE];
+    for (unsigned int i = 0; i < sizeof(suffix); i++)
+        suffix[i] = insecure_rand();
+
+    std::vector<std::string> vKernels = SHA512NonceBatchKernels();
+    BOOST_CHECK(!vKernels.empty() && vKernels[0] == "scalar");
+    BOOST_CHECK(!SHA512NonceBatchSelect("no-such-kernel"));
+    BOOST_FOREACH(const std::string& strKernel, vKernels) {
+        BOOST_CHECK(SHA512NonceBatchSelect(strKernel));
+        BOOST_CHECK(SHA512NonceBatchKernel() == strKernel);
+        // Counts that are not a multiple of any lane width, and nonces that
+        // wrap around 2^32, must match plain SHA-512 of each message.
+        for (size_t nCount = 1; nCount <= 19; nCount++) {
+            uint32_t nNonce = 0xffffffc0 + insecure_rand() % 16;
+            std::vector<unsigned char> vOut(nCount * CSHA512::OUTPUT_SIZE);
+            SHA512NonceBatch(suffix, nNonce, 8, nCount, &vOut[0]);
+            for (size_t i = 0; i < nCount; i++) {
+                unsigned char message[4 + SHA512_BATCH_SUFFIX_SIZE];
+                uint32_t n = nNonce + i * 8;
+                message[0] = n;
+                message[1] = n >> 8;
+                message[2] = n >> 16;
+                message[3] = n >> 24;
+                memcpy(message + 4, suffix, sizeof(suffix));
+                unsigned char hash[CSHA512::OUTPUT_SIZE];
+                CSHA512().Write(message, sizeof(message)).Finalize(hash);
+                BOOST_CHECK(memcmp(hash, &vOut[i * CSHA512::OUTPUT_SIZE], CSHA512::OUTPUT_SIZE) == 0);
+            }
+        }
+    }
+    BOOST_CHECK(SHA512NonceBatchSelect("auto"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iblt.h"
+
+#include "hash.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+typedef vector<unsigned char> Key;
+
+static Key TestKey(uint32_t n)
+{
+    uint256 hash = Hash(BEGIN(n), END(n));
+    return Key(hash.begin(), hash.begin() + IBLT_KEY_SIZE);
+}
+
+BOOST_AUTO_TEST_SUITE(iblt_tests)
+
+BOOST_AUTO_TEST_CASE(iblt_reconcile)
+{
+    // 500 shared keys, 4 only on our side, 6 only on theirs
+    vector<Key> vShared, vOurs, vTheirs;
+    for (int i = 0; i < 500; i++)
+        vShared.push_back(TestKey(i));
+    for (int i = 500; i < 504; i++)
+        vOurs.push_back(TestKey(i));
+    for (int i = 504; i < 510; i++)
+        vTheirs.push_back(TestKey(i));
+
+    CIBLT ours(40, 0x1234), theirs(40, 0x1234);
+    BOOST_CHECK_EQUAL(ours.size(), 42U);
+    for (unsigned int i = 0; i < vShared.size(); i++) {
+        ours.insert(&vShared[i][0]);
+        theirs.insert(&vShared[i][0]);
+    }
+    for (unsigned int i = 0; i < vOurs.size(); i++)
+        ours.insert(&vOurs[i][0]);
+    for (unsigned int i = 0; i < vTheirs.size(); i++)
+        theirs.insert(&vTheirs[i][0]);
+
+    // Sent over the wire
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << theirs;
+    BOOST_CHECK_EQUAL(ss.size(), 1 + 42 * IBLT_CELL_SIZE + 4);
+    CIBLT received;
+    ss >> received;
+    BOOST_CHECK(received.IsWithinSizeConstraints(42));
+    BOOST_CHECK(!received.IsWithinSizeConstraints(41));
+
+    BOOST_CHECK(ours.subtract(received));
+    vector<Key> vPositive, vNegative;
+    BOOST_CHECK(ours.list(vPositive, vNegative));
+
+    sort(vOurs.begin(), vOurs.end());
+    sort(vTheirs.begin(), vTheirs.end());
+    sort(vPositive.begin(), vPositive.end());
+    sort(vNegative.begin(), vNegative.end());
+    BOOST_CHECK(vPositive == vOurs);
+    BOOST_CHECK(vNegative == vTheirs);
+}
+
+BOOST_AUTO_TEST_CASE(iblt_insert_erase)
+{
+    CIBLT iblt(12, 0);
+    Key vKey = TestKey(0);
+    iblt.insert(&vKey[0]);
+    iblt.erase(&vKey[0]);
+
+    vector<Key> vPositive, vNegative;
+    BOOST_CHECK(iblt.list(vPositive, vNegative));
+    BOOST_CHECK(vPositive.empty() && vNegative.empty());
+
+    // Tables of other sizes or tweaks can't be subtracted
+    BOOST_CHECK(!iblt.subtract(CIBLT(15, 0)));
+    BOOST_CHECK(!iblt.subtract(CIBLT(12, 1)));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_overfull)
+{
+    // Far more differences than cells can't be listed
+    CIBLT iblt(12, 0);
+    for (int i = 0; i < 100; i++)
+        iblt.insert(&TestKey(i)[0]);
+
+    vector<Key> vPositive, vNegative;
+    BOOST_CHECK(!iblt.list(vPositive, vNegative));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_forged)
+{
+    // The cells a single key lands in, one per sub-table of two cells
+    CIBLT valid(6, 0);
+    Key vKey = TestKey(0);
+    valid.insert(&vKey[0]);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << valid;
+    vector<CIBLT::Cell> vCells;
+    unsigned int nTweak;
+    ss >> vCells >> nTweak;
+    BOOST_CHECK_EQUAL(vCells.size(), 6U);
+    unsigned int nFirst = vCells[0].IsEmpty() ? 1 : 0;
+    BOOST_CHECK(!vCells[nFirst].IsEmpty());
+
+    // Forge a table holding that cell in the wrong slot of the first
+    // sub-table: it looks pure, but peeling the key never clears it
+    vector<CIBLT::Cell> vForged(6);
+    vForged[1 - nFirst] = vCells[nFirst];
+    CDataStream ssForged(SER_NETWORK, PROTOCOL_VERSION);
+    ssForged << vForged << nTweak;
+    CIBLT forged;
+    ssForged >> forged;
+    BOOST_CHECK(forged.IsWithinSizeConstraints(6));
+
+    vector<Key> vPositive, vNegative;
+    BOOST_CHECK(!forged.list(vPositive, vNegative));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_forged_count)
+{
+    // Counts out of range of the subtraction, or of anything listable
+    vector<CIBLT::Cell> vForged(6);
+    vForged[0].nCount = numeric_limits<int32_t>::min();
+    vForged[3].nCount = numeric_limits<int32_t>::max();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vForged << 0U;
+    CIBLT forged;
+    ss >> forged;
+    BOOST_CHECK(forged.IsWithinSizeConstraints(6));
+
+    vector<Key> vPositive, vNegative;
+    BOOST_CHECK(!forged.list(vPositive, vNegative));
+
+    // Subtracting it fails without touching our table
+    CIBLT ours(6, 0);
+    Key vKey = TestKey(0);
+    ours.insert(&vKey[0]);
+    BOOST_CHECK(!ours.subtract(forged));
+    BOOST_CHECK(ours.list(vPositive, vNegative));
+    BOOST_CHECK_EQUAL(vPositive.size(), 1U);
+    BOOST_CHECK(vNegative.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -127,6 +127,33 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         tx.vin[0].prevout.hash = hash;
     }
     BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    size_t nTemplateTx = pblocktemplate->block.vtx.size();
+    BOOST_CHECK(nTemplateTx > 1);
+    BOOST_CHECK(mempool.mapTx[pblocktemplate->block.vtx[1].GetHash()].IsScriptChecked());
+    delete pblocktemplate;
+
+    // a second template reuses the script checks of the first
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), nTemplateTx);
+    delete pblocktemplate;
+    mempool.clear();
+
+    // a failing script is dropped from the template until the entry is marked
+    // checked; after that neither the template nor its validity test runs it
+    tx2.vin.resize(1);
+    tx2.vin[0].scriptSig = CScript() << OP_0;
+    tx2.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx2.vin[0].prevout.n = 0;
+    tx2.vout.resize(1);
+    tx2.vout[0].nValue = 4900000000LL;
+    hash = tx2.GetHash();
+    mempool.addUnchecked(hash, CTxMemPoolEntry(tx2, 11, GetTime(), 111.0, 11));
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    delete pblocktemplate;
+    mempool.mapTx[hash].SetScriptChecked(0);
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
     delete pblocktemplate;
     mempool.clear();
 
@@ -0,0 +1,140 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smessage.h"
+
+#include "hash.h"
+#include "net.h"
+#include "netbase.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+// An smsg bunch for bktTime holding nMessages distinct unstamped messages
+static vector<unsigned char> MakeBunch(int64_t bktTime, uint32_t nMessages)
+{
+    vector<unsigned char> vchData(12);
+    memcpy(&vchData[0], &nMessages, 4);
+    memcpy(&vchData[4], &bktTime, 8);
+
+    for (uint32_t i = 0; i < nMessages; i++) {
+        vector<unsigned char> vchPayload(100, (unsigned char) i);
+        SecureMessageHeader smsg;
+        memset(smsg.begin(), 0, SMSG_HDR_LEN);
+        smsg.nVersion = 1;
+        smsg.nPayload = vchPayload.size();
+        smsg.timestamp = bktTime + i;
+        vchData.insert(vchData.end(), smsg.begin(), smsg.begin() + SMSG_HDR_LEN);
+        vchData.insert(vchData.end(), vchPayload.begin(), vchPayload.end());
+    }
+    return vchData;
+}
+
+BOOST_AUTO_TEST_SUITE(smessage_tests)
+
+BOOST_AUTO_TEST_CASE(smsg_stamp)
+{
+    vector<unsigned char> vchPayload(200);
+    for (size_t i = 0; i < vchPayload.size(); i++)
+        vchPayload[i] = i * 31;
+
+    SecureMessageHeader smsg;
+    memset(smsg.begin(), 0, SMSG_HDR_LEN);
+    smsg.nVersion = 1;
+    smsg.nPayload = vchPayload.size();
+    smsg.timestamp = 1430784000;
+    memset(smsg.cpkR, 0x02, sizeof(smsg.cpkR));
+    memcpy(smsg.hash, Hash(vchPayload.begin(), vchPayload.end()).begin(), 32);
+
+    BOOST_CHECK(SecureMsgStamp(smsg));
+    BOOST_CHECK(SecureMsgCheckStamp(smsg, &vchPayload[0]));
+
+    // the stamp covers the header and the payload
+    SecureMessageHeader smsgTime(smsg.begin());
+    smsgTime.timestamp++;
+    BOOST_CHECK(!SecureMsgCheckStamp(smsgTime, &vchPayload[0]));
+
+    vchPayload[100] ^= 1;
+    BOOST_CHECK(!SecureMsgCheckStamp(smsg, &vchPayload[0]));
+}
+
+BOOST_AUTO_TEST_CASE(smsg_peer_allowance)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 1)), "", true);
+
+    // no limit by default
+    SecureMsgReadArgs();
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&node), std::numeric_limits<uint32_t>::max());
+
+    // a new peer gets a full bucket, which sending empties
+    mapArgs["-smsgpeerrate"] = "4";
+    SecureMsgReadArgs();
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&node), 4U);
+    node.smsgData.dRateAllowance -= 4;
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&node), 0U);
+
+    // it refills at the rate over time, up to the rate
+    node.smsgData.nRateTime -= SMSG_RATE_PERIOD * 1000 / 2;
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&node), 2U);
+    node.smsgData.nRateTime -= SMSG_RATE_PERIOD * 1000 * 10;
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&node), 4U);
+
+    mapArgs.erase("-smsgpeerrate");
+    SecureMsgReadArgs();
+}
+
+BOOST_AUTO_TEST_CASE(smsg_receive_require_stamp)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 1)), "", true);
+    int64_t nNow = GetTime();
+    int64_t bktTime = nNow - nNow % SMSG_BUCKET_LEN;
+
+    // unstamped messages are not stored, but remembered as rejected
+    mapArgs["-smsgrequirestamp"] = "1";
+    SecureMsgReadArgs();
+    vector<unsigned char> vchData = MakeBunch(bktTime, 3);
+    BOOST_CHECK_EQUAL(SecureMsgReceive(&node, vchData), 0);
+    boost::shared_ptr<SecMsgBucket> pbkt = SecureMsgGetBucket(bktTime, false);
+    BOOST_REQUIRE(pbkt);
+    {
+        LOCK(pbkt->cs);
+        BOOST_CHECK_EQUAL(pbkt->setRejected.size(), 3U);
+        BOOST_CHECK(pbkt->setTokens.empty());
+        BOOST_CHECK(pbkt->nRejectedDigest != 0);
+    }
+
+    // sent again, they are counted once
+    BOOST_CHECK_EQUAL(SecureMsgReceive(&node, vchData), 0);
+    {
+        LOCK(pbkt->cs);
+        BOOST_CHECK_EQUAL(pbkt->setRejected.size(), 3U);
+    }
+
+    // over its rate limit the rest of the bunch is dropped unread
+    mapArgs["-smsgpeerrate"] = "2";
+    SecureMsgReadArgs();
+    CNode nodeLimited(INVALID_SOCKET, CAddress(CService("127.0.0.2", 1)), "", true);
+    vchData = MakeBunch(bktTime, 5);
+    BOOST_CHECK_EQUAL(SecureMsgReceive(&nodeLimited, vchData), 0);
+    {
+        LOCK(pbkt->cs);
+        BOOST_CHECK_EQUAL(pbkt->setRejected.size(), 3U);
+    }
+    BOOST_CHECK_EQUAL(SecureMsgPeerAllowance(&nodeLimited), 0U);
+
+    mapArgs.erase("-smsgrequirestamp");
+    mapArgs.erase("-smsgpeerrate");
+    SecureMsgReadArgs();
+    {
+        LOCK(cs_smsgBuckets);
+        smsgBuckets.erase(bktTime);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
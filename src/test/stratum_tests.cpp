@@ -0,0 +1,188 @@
+// Copyright (c) 2015 The Bitcredit Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "rpcprotocol.h"
+#include "uint256.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace json_spirit;
+using namespace std;
+
+static int ErrorCode(const Object& objError)
+{
+    return find_value(objError, "code").get_int();
+}
+
+static string ErrorMessage(const Object& objError)
+{
+    return find_value(objError, "message").get_str();
+}
+
+static Array SubmitParams(const string& strJobId, int64_t nNonce, int64_t nBirthdayA, int64_t nBirthdayB)
+{
+    Array params;
+    params.push_back(strJobId);
+    params.push_back(nNonce);
+    params.push_back(nBirthdayA);
+    params.push_back(nBirthdayB);
+    return params;
+}
+
+BOOST_AUTO_TEST_SUITE(stratum_tests)
+
+BOOST_AUTO_TEST_CASE(stratum_parse_request)
+{
+    CStratumRequest request;
+    ParseStratumRequest("{\"id\": 7, \"method\": \"mining.submit\", \"params\": [\"1f\", 2, 3, 4]}", request);
+    BOOST_CHECK_EQUAL(request.strMethod, "mining.submit");
+    BOOST_CHECK_EQUAL(request.id.get_int(), 7);
+    BOOST_CHECK_EQUAL(request.params.size(), 4U);
+
+    // Missing params are an empty array
+    ParseStratumRequest("{\"id\": \"a\", \"method\": \"mining.subscribe\"}", request);
+    BOOST_CHECK_EQUAL(request.strMethod, "mining.subscribe");
+    BOOST_CHECK_EQUAL(request.id.get_str(), "a");
+    BOOST_CHECK(request.params.empty());
+
+    // Garbage and non-objects
+    const char* vParseErrors[] = {"", "{", "mining.subscribe", "[1, 2]", "42"};
+    for (unsigned int i = 0; i < sizeof(vParseErrors) / sizeof(vParseErrors[0]); i++) {
+        CStratumRequest bad;
+        try {
+            ParseStratumRequest(vParseErrors[i], bad);
+            BOOST_ERROR("parsed " << vParseErrors[i]);
+        } catch (const Object& objError) {
+            BOOST_CHECK_EQUAL(ErrorCode(objError), RPC_PARSE_ERROR);
+        }
+    }
+
+    // Invalid requests still carry their id for the error reply
+    const char* vInvalid[] = {
+        "{\"id\": 3}",
+        "{\"id\": 3, \"method\": 1}",
+        "{\"id\": 3, \"method\": \"mining.subscribe\", \"params\": {}}",
+        "{\"id\": 3, \"method\": \"mining.subscribe\", \"params\": \"x\"}",
+    };
+    for (unsigned int i = 0; i < sizeof(vInvalid) / sizeof(vInvalid[0]); i++) {
+        CStratumRequest bad;
+        try {
+            ParseStratumRequest(vInvalid[i], bad);
+            BOOST_ERROR("parsed " << vInvalid[i]);
+        } catch (const Object& objError) {
+            BOOST_CHECK_EQUAL(ErrorCode(objError), RPC_INVALID_REQUEST);
+            BOOST_CHECK_EQUAL(bad.id.get_int(), 3);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stratum_parse_submit)
+{
+    CStratumSolution solution;
+    ParseStratumSubmit(SubmitParams("1f", 0x12345678, 26230443, 60109707), solution);
+    BOOST_CHECK_EQUAL(solution.nJobId, 0x1fU);
+    BOOST_CHECK_EQUAL(solution.nNonce, 0x12345678U);
+    BOOST_CHECK_EQUAL(solution.nBirthdayA, 26230443U);
+    BOOST_CHECK_EQUAL(solution.nBirthdayB, 60109707U);
+
+    ParseStratumSubmit(SubmitParams("abc", 0, 0, 0), solution);
+    BOOST_CHECK_EQUAL(solution.nJobId, 0xabcU);
+
+    vector<Array> vBad;
+    vBad.push_back(Array());
+    vBad.push_back(SubmitParams("", 0, 1, 2));
+    vBad.push_back(SubmitParams("zz", 0, 1, 2));
+    vBad.push_back(SubmitParams("123456789", 0, 1, 2));
+    Array params = SubmitParams("1", 0, 1, 2);
+    params[1] = "0";
+    vBad.push_back(params);
+    params = SubmitParams("1", 0, 1, 2);
+    params.push_back(3);
+    vBad.push_back(params);
+    params = SubmitParams("1", 0, 1, 2);
+    params[0] = 1;
+    vBad.push_back(params);
+    for (unsigned int i = 0; i < vBad.size(); i++) {
+        try {
+            ParseStratumSubmit(vBad[i], solution);
+            BOOST_ERROR("parsed submit " << i);
+        } catch (const Object& objError) {
+            BOOST_CHECK_EQUAL(ErrorCode(objError), RPC_INVALID_PARAMS);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stratum_check_solution)
+{
+    // The genesis block's solution, submitted against a job without one
+    const CBlock& genesis = Params().GenesisBlock();
+    CBlock job(genesis);
+    job.nNonce = 0;
+    job.nBirthdayA = 0;
+    job.nBirthdayB = 0;
+    uint256 hashTarget;
+    hashTarget.SetCompact(genesis.nBits);
+    uint32_t nNonceRange = (uint32_t)1 << STRATUM_NONCE_BITS;
+    uint32_t nNonceStart = genesis.nNonce - genesis.nNonce % nNonceRange;
+
+    CStratumSolution solution;
+    solution.nJobId = 0;
+    solution.nNonce = genesis.nNonce;
+    solution.nBirthdayA = genesis.nBirthdayA;
+    solution.nBirthdayB = genesis.nBirthdayB;
+
+    CBlock block(job);
+    CheckStratumSolution(block, solution, hashTarget, nNonceStart);
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+
+    // Not a collision
+    CStratumSolution bad(solution);
+    bad.nBirthdayB++;
+    block = job;
+    try {
+        CheckStratumSolution(block, bad, hashTarget, nNonceStart);
+        BOOST_ERROR("accepted bad birthdays");
+    } catch (const Object& objError) {
+        BOOST_CHECK_EQUAL(ErrorMessage(objError), "bad-birthdays");
+    }
+
+    // The same birthday twice
+    bad = solution;
+    bad.nBirthdayB = bad.nBirthdayA;
+    block = job;
+    try {
+        CheckStratumSolution(block, bad, hashTarget, nNonceStart);
+        BOOST_ERROR("accepted equal birthdays");
+    } catch (const Object& objError) {
+        BOOST_CHECK_EQUAL(ErrorMessage(objError), "bad-birthdays");
+    }
+
+    // A valid collision that misses the target
+    block = job;
+    try {
+        CheckStratumSolution(block, solution, uint256(0), nNonceStart);
+        BOOST_ERROR("accepted high hash");
+    } catch (const Object& objError) {
+        BOOST_CHECK_EQUAL(ErrorCode(objError), RPC_VERIFY_REJECTED);
+        BOOST_CHECK_EQUAL(ErrorMessage(objError), "high-hash");
+    }
+
+    // Solutions from the nonce ranges of the sessions next to ours
+    uint32_t vNonceStart[] = {nNonceStart + nNonceRange, nNonceStart - nNonceRange};
+    for (unsigned int i = 0; i < sizeof(vNonceStart) / sizeof(vNonceStart[0]); i++) {
+        block = job;
+        try {
+            CheckStratumSolution(block, solution, hashTarget, vNonceStart[i]);
+            BOOST_ERROR("accepted a nonce of another session");
+        } catch (const Object& objError) {
+            BOOST_CHECK_EQUAL(ErrorMessage(objError), "nonce-out-of-range");
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
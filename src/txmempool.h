@@ -43,6 +43,7 @@ private:
     int64_t nTime; //! Local time when entering the mempool
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    int nSigOpsChecked; //! Legacy plus P2SH sigops once CreateNewBlock verified the scripts, else -1
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -56,6 +57,15 @@ public:
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+
+    /**
+     * Scripts only depend on the outputs being spent, so once CreateNewBlock
+     * has verified them they stay valid for as long as the entry is in the
+     * pool, and later templates only redo the contextual input checks.
+     */
+    bool IsScriptChecked() const { return nSigOpsChecked >= 0; }
+    unsigned int GetSigOpsChecked() const { return nSigOpsChecked; }
+    void SetScriptChecked(unsigned int nSigOps) { nSigOpsChecked = nSigOps; }
 };
 
 class CMinerPolicyEstimator;